@@ -0,0 +1,1937 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dba.h"
+#include "dtw.h"
+#include "emg.h"
+#include "json.h"
+#include "keyframes.h"
+#include "libraryfile.h"
+#include "librarymatcher.h"
+#include "lowerbound.h"
+#include "orientation.h"
+#include "quatmatcher.h"
+#include "sessionlog.h"
+#include "shiftand.h"
+#include "spring.h"
+#include "streamcodec.h"
+#include "templatearena.h"
+#include "threadpool.h"
+
+// Offline benchmarks, run with "--bench <name>". Each one also checks its fast path against the reference path and
+// returns non-zero if they disagree, so they double as regression checks.
+
+inline double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Random unit quaternions in SoA form.
+inline void randomQuaternions(size_t n, unsigned int seed, std::vector<float>& w, std::vector<float>& x,
+	std::vector<float>& y, std::vector<float>& z)
+{
+	std::mt19937 random(seed);
+	std::normal_distribution<float> normal;
+	w.resize(n);
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		float a = normal(random), b = normal(random), c = normal(random), d = normal(random);
+		float length = std::sqrt(a * a + b * b + c * c + d * d);
+		w[i] = a / length;
+		x[i] = b / length;
+		y[i] = c / length;
+		z[i] = d / length;
+	}
+}
+
+// Number of samples where Q's batched kernel disagrees with its scalar path.
+template <class Q>
+size_t quantizerMismatches(const std::vector<float>& w, const std::vector<float>& x, const std::vector<float>& y,
+	const std::vector<float>& z)
+{
+	size_t n = w.size();
+	std::vector<int> roll(n), pitch(n), yaw(n);
+	Q::quantize(&w[0], &x[0], &y[0], &z[0], n, &roll[0], &pitch[0], &yaw[0]);
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		Quat q = { w[i], x[i], y[i], z[i] };
+		int r, p, yw;
+		Q::quantize(q, r, p, yw);
+		if (r != roll[i] || p != pitch[i] || yw != yaw[i])
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+// Scalar quantizeOrientation() per sample versus the batched quantizeOrientations() kernel, plus an identity check
+// of the other resolutions the quantizer is meant to be built at.
+inline int benchmarkEuler()
+{
+	const size_t n = 4000000;
+	std::vector<float> w, x, y, z;
+	randomQuaternions(n, 1, w, x, y, z);
+
+	std::vector<int> roll(n), pitch(n), yaw(n);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		Quat q = { w[i], x[i], y[i], z[i] };
+		quantizeOrientation(q, roll[i], pitch[i], yaw[i]);
+	}
+	double scalarMs = elapsedMs(start);
+
+	std::vector<int> batchRoll(n), batchPitch(n), batchYaw(n);
+	start = std::chrono::steady_clock::now();
+	size_t fallbacks = quantizeOrientations(&w[0], &x[0], &y[0], &z[0], n, &batchRoll[0], &batchPitch[0],
+		&batchYaw[0]);
+	double batchMs = elapsedMs(start);
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (roll[i] != batchRoll[i] || pitch[i] != batchPitch[i] || yaw[i] != batchYaw[i])
+		{
+			mismatches++;
+		}
+	}
+
+	std::cout << "euler: " << n << " quaternions\n"
+		<< "  scalar  " << scalarMs << " ms (" << scalarMs * 1e6 / n << " ns/sample)\n"
+		<< "  batched " << batchMs << " ms (" << batchMs * 1e6 / n << " ns/sample), "
+		<< scalarMs / batchMs << "x\n"
+		<< "  " << fallbacks << " samples near a bucket boundary took the scalar fallback\n"
+		<< "  " << mismatches << " bucket mismatches" << std::endl;
+
+	w.resize(n / 4);
+	x.resize(n / 4);
+	y.resize(n / 4);
+	z.resize(n / 4);
+	size_t other = 0;
+	other += quantizerMismatches<Quantizer<18> >(w, x, y, z);
+	other += quantizerMismatches<Quantizer<36> >(w, x, y, z);
+	other += quantizerMismatches<Quantizer<72> >(w, x, y, z);
+	other += quantizerMismatches<Quantizer<72, 180, 90> >(w, x, y, z);
+	std::cout << "  " << other << " mismatches at 18, 36, 72 and 72 over a narrowed range" << std::endl;
+
+	return mismatches == 0 && other == 0 ? 0 : 1;
+}
+
+// EMG window features worked out from scratch over the last window frames, oldest first.
+inline void referenceEmgFeatures(const std::vector<int8_t>& frames, size_t first, size_t count, int threshold,
+	EmgFeatures& out)
+{
+	for (int c = 0; c < EMG_CHANNELS; c++)
+	{
+		double squares = 0, absolute = 0;
+		int crossings = 0;
+		for (size_t k = first; k < first + count; k++)
+		{
+			int v = frames[k * EMG_CHANNELS + c];
+			squares += v * v;
+			absolute += std::abs(v);
+			if (k > first)
+			{
+				int previous = frames[(k - 1) * EMG_CHANNELS + c];
+				crossings += previous * v < 0 && std::abs(previous - v) >= threshold;
+			}
+		}
+		out.rms[c] = static_cast<float>(std::sqrt(squares / count));
+		out.mav[c] = static_cast<float>(absolute / count);
+		out.zeroCrossings[c] = crossings;
+	}
+}
+
+// The sliding EMG window against working its features out from scratch over the same frames, on a stream of quiet
+// stretches and contractions. The running sums must give the same features on every frame.
+inline int benchmarkEmg()
+{
+	const int window = 40;
+	const int threshold = 4;
+	const size_t n = 2000000;
+	const size_t checked = 200000;
+	std::mt19937 random(1);
+
+	std::vector<int8_t> frames(n * EMG_CHANNELS);
+	int level = 5;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (random() % 400 == 0)
+		{
+			level = random() % 3 == 0 ? 127 : 5 + static_cast<int>(random() % 40);
+		}
+		std::uniform_int_distribution<int> sample(-level - 1, level);
+		for (int c = 0; c < EMG_CHANNELS; c++)
+		{
+			frames[i * EMG_CHANNELS + c] = static_cast<int8_t>(std::max(-128, std::min(127, sample(random))));
+		}
+	}
+
+	EmgWindow<window> sliding(threshold);
+	EmgFeatures features, expected;
+	size_t mismatches = 0;
+	for (size_t i = 0; i < checked; i++)
+	{
+		sliding.push(&frames[i * EMG_CHANNELS]);
+		sliding.features(i, features);
+		size_t count = std::min<size_t>(i + 1, window);
+		referenceEmgFeatures(frames, i + 1 - count, count, threshold, expected);
+		for (int c = 0; c < EMG_CHANNELS; c++)
+		{
+			if (std::fabs(features.rms[c] - expected.rms[c]) > 1e-3f * (1 + expected.rms[c]) ||
+				std::fabs(features.mav[c] - expected.mav[c]) > 1e-3f * (1 + expected.mav[c]) ||
+				features.zeroCrossings[c] != expected.zeroCrossings[c])
+			{
+				mismatches++;
+				break;
+			}
+		}
+	}
+
+	sliding.reset();
+	float total = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		sliding.push(&frames[i * EMG_CHANNELS]);
+		sliding.features(i, features);
+		total += features.rms[i % EMG_CHANNELS];
+	}
+	double slidingMs = elapsedMs(start);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t count = std::min<size_t>(i + 1, window);
+		referenceEmgFeatures(frames, i + 1 - count, count, threshold, expected);
+		total -= expected.rms[i % EMG_CHANNELS];
+	}
+	double referenceMs = elapsedMs(start);
+
+	std::cout << "emg: " << n << " frames, " << window << "-frame window\n"
+		<< "  from scratch " << referenceMs * 1e6 / n << " ns/frame\n"
+		<< "  sliding      " << slidingMs * 1e6 / n << " ns/frame, " << referenceMs / slidingMs << "x\n"
+		<< "  " << mismatches << " mismatched frames over " << checked << ", mean RMS difference "
+		<< total / n << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// A random walk through the buckets 0..bins, the way a slowly moving arm looks after quantization, in SoA form. Each
+// step moves up to 20 degrees on each axis, whatever the resolution.
+inline void randomWalk(int n, std::mt19937& random, std::vector<float>& roll, std::vector<float>& pitch,
+	std::vector<float>& yaw, int bins = EulerQuantizer::bins)
+{
+	int stride = std::max(1, bins / 18);
+	std::uniform_int_distribution<int> step(-stride, stride);
+	roll.resize(n);
+	pitch.resize(n);
+	yaw.resize(n);
+	int r = bins / 2, p = bins / 2, y = bins / 2;
+	for (int i = 0; i < n; i++)
+	{
+		r = std::min(bins, std::max(0, r + step(random)));
+		p = std::min(bins, std::max(0, p + step(random)));
+		y = std::min(bins, std::max(0, y + step(random)));
+		roll[i] = static_cast<float>(r);
+		pitch[i] = static_cast<float>(p);
+		yaw[i] = static_cast<float>(y);
+	}
+}
+
+// DTW scoring of a live attempt against a template, with and without the vector pass, at a few band widths. The
+// per-sample figure is what one more live sample costs the DTW listener when it rescores its window.
+inline int benchmarkDtw()
+{
+	const int templateSteps = 100;
+	const int liveSamples = 150;
+	const int runs = 4000;
+	std::mt19937 random(1);
+	std::vector<float> roll, pitch, yaw, liveRoll, livePitch, liveYaw;
+	randomWalk(templateSteps, random, roll, pitch, yaw);
+	randomWalk(liveSamples, random, liveRoll, livePitch, liveYaw);
+
+	std::cout << "dtw: " << liveSamples << " live samples against " << templateSteps << " template steps" << std::endl;
+	size_t mismatches = 0;
+	const int bands[] = { 4, 16, 64 };
+	for (int b = 0; b < 3; b++)
+	{
+		DtwMatcher matcher(bands[b]);
+		float scalar = 0, vectorized = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < runs; i++)
+		{
+			scalar += matcher.distanceScalar(&liveRoll[0], &livePitch[0], &liveYaw[0], liveSamples, &roll[0],
+				&pitch[0], &yaw[0], templateSteps);
+		}
+		double scalarMs = elapsedMs(start);
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < runs; i++)
+		{
+			vectorized += matcher.distance(&liveRoll[0], &livePitch[0], &liveYaw[0], liveSamples, &roll[0], &pitch[0],
+				&yaw[0], templateSteps);
+		}
+		double vectorMs = elapsedMs(start);
+
+		if (scalar != vectorized)
+		{
+			mismatches++;
+		}
+		std::cout << "  band " << bands[b] << ": distance " << vectorized / runs << "\n"
+			<< "    scalar     " << scalarMs * 1e3 / runs << " us/score (" << scalarMs * 1e6 / runs / liveSamples
+			<< " ns/sample)\n"
+			<< "    vectorized " << vectorMs * 1e3 / runs << " us/score (" << vectorMs * 1e6 / runs / liveSamples
+			<< " ns/sample), " << scalarMs / vectorMs << "x" << std::endl;
+	}
+	std::cout << "  " << mismatches << " distance mismatches" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// The strike rules applied to every template on every sample, the way a single GestureListener does it.
+class ScanningStrikeMatcher
+{
+public:
+	ScanningStrikeMatcher(int tolerance, int maxStrikes)
+		: tolerance(tolerance), maxStrikes(maxStrikes)
+	{
+	}
+
+	void add(const std::vector<int>& roll, const std::vector<int>& pitch, const std::vector<int>& yaw)
+	{
+		rolls.push_back(roll);
+		pitches.push_back(pitch);
+		yaws.push_back(yaw);
+		position.push_back(0);
+		strikes.push_back(0);
+	}
+
+	void reset()
+	{
+		std::fill(position.begin(), position.end(), 0);
+		std::fill(strikes.begin(), strikes.end(), 0);
+	}
+
+	// Returns the first template this sample completed, or -1. completions() lists all of them.
+	int push(int r, int p, int y)
+	{
+		done.clear();
+		for (size_t t = 0; t < rolls.size(); t++)
+		{
+			int j = position[t];
+			if (std::abs(r - rolls[t][j]) <= tolerance && std::abs(p - pitches[t][j]) <= tolerance
+				&& std::abs(y - yaws[t][j]) <= tolerance)
+			{
+				if (++position[t] == static_cast<int>(rolls[t].size()))
+				{
+					position[t] = 0;
+					strikes[t] = 0;
+					done.push_back(static_cast<int>(t));
+				}
+			}
+			else if (strikes[t] >= maxStrikes)
+			{
+				position[t] = 0;
+				strikes[t] = 0;
+			}
+			else
+			{
+				strikes[t]++;
+			}
+		}
+		return done.empty() ? -1 : done[0];
+	}
+
+	const std::vector<int>& completions() const
+	{
+		return done;
+	}
+
+private:
+	int tolerance;
+	int maxStrikes;
+	std::vector<std::vector<int> > rolls, pitches, yaws;
+	std::vector<int> position;
+	std::vector<int> strikes;
+	std::vector<int> done;
+};
+
+// A library of random-walk templates and a live stream made of those templates, with strikes and idle movement mixed
+// in. The Shift-And matcher must complete exactly the templates the strike rules do, on exactly the same samples, as
+// GestureListener applies them to one template at a time; it is timed against that scan and the strike-rule
+// LibraryMatcher over the whole stream.
+inline int benchmarkShiftAnd()
+{
+	const int tolerance = EulerQuantizer::scale(2);
+	const int maxStrikes = 2;
+	const int templates = 64;
+	const size_t samples = 400000;
+	std::mt19937 random(1);
+
+	std::vector<std::vector<int> > rolls(templates), pitches(templates), yaws(templates);
+	ShiftAndMatcher shiftAnd(EulerQuantizer::bins, tolerance, maxStrikes);
+	LibraryMatcher library(EulerQuantizer::bins, tolerance, maxStrikes);
+	ScanningStrikeMatcher scanning(tolerance, maxStrikes);
+	for (int t = 0; t < templates; t++)
+	{
+		std::vector<float> roll, pitch, yaw;
+		randomWalk(20 + static_cast<int>(random() % 60), random, roll, pitch, yaw);
+		rolls[t].assign(roll.begin(), roll.end());
+		pitches[t].assign(pitch.begin(), pitch.end());
+		yaws[t].assign(yaw.begin(), yaw.end());
+		int steps = static_cast<int>(roll.size());
+		shiftAnd.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], steps);
+		library.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], steps);
+		scanning.add(rolls[t], pitches[t], yaws[t]);
+	}
+	// The first template again, so that every rep of it completes two templates on the same sample.
+	int firstSteps = static_cast<int>(rolls[0].size());
+	shiftAnd.add(&rolls[0][0], &pitches[0][0], &yaws[0][0], firstSteps);
+	library.add(&rolls[0][0], &pitches[0][0], &yaws[0][0], firstSteps);
+	scanning.add(rolls[0], pitches[0], yaws[0]);
+
+	std::vector<int> roll, pitch, yaw;
+	std::uniform_int_distribution<int> bucket(0, EulerQuantizer::bins);
+	while (roll.size() < samples)
+	{
+		int t = static_cast<int>(random() % templates);
+		for (size_t j = 0; j < rolls[t].size(); j++)
+		{
+			if (random() % 20 == 0)
+			{
+				roll.push_back(bucket(random));
+				pitch.push_back(bucket(random));
+				yaw.push_back(bucket(random));
+			}
+			roll.push_back(rolls[t][j]);
+			pitch.push_back(pitches[t][j]);
+			yaw.push_back(yaws[t][j]);
+		}
+		for (int k = static_cast<int>(random() % 10); k > 0; k--)
+		{
+			roll.push_back(bucket(random));
+			pitch.push_back(bucket(random));
+			yaw.push_back(bucket(random));
+		}
+	}
+	size_t n = roll.size();
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		shiftAnd.push(roll[i], pitch[i], yaw[i]);
+		scanning.push(roll[i], pitch[i], yaw[i]);
+		mismatches += shiftAnd.completions() != scanning.completions();
+	}
+	shiftAnd.reset();
+	scanning.reset();
+
+	size_t scanningFound = 0, shiftAndFound = 0, libraryFound = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		scanning.push(roll[i], pitch[i], yaw[i]);
+		scanningFound += scanning.completions().size();
+	}
+	double scanningMs = elapsedMs(start);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		shiftAndFound += shiftAnd.push(roll[i], pitch[i], yaw[i]);
+	}
+	double shiftAndMs = elapsedMs(start);
+
+	// The library matcher only reports the first template completed on a sample, so it is counted in samples.
+	size_t firstFound = 0;
+	scanning.reset();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		libraryFound += library.push(roll[i], pitch[i], yaw[i]) >= 0;
+	}
+	double libraryMs = elapsedMs(start);
+	for (size_t i = 0; i < n; i++)
+	{
+		firstFound += scanning.push(roll[i], pitch[i], yaw[i]) >= 0;
+	}
+
+	if (shiftAndFound != scanningFound || libraryFound != firstFound)
+	{
+		mismatches++;
+	}
+	std::cout << "shiftand: " << templates + 1 << " templates, " << n << " samples\n"
+		<< "  strike rules, scan   " << scanningMs * 1e6 / n << " ns/sample, " << scanningFound << " reps found on "
+		<< firstFound << " samples\n"
+		<< "  strike rules, index  " << libraryMs * 1e6 / n << " ns/sample, " << libraryFound << " samples with a rep, "
+		<< scanningMs / libraryMs << "x\n"
+		<< "  shift-and            " << shiftAndMs * 1e6 / n << " ns/sample, " << shiftAndFound << " reps found, "
+		<< scanningMs / shiftAndMs << "x\n"
+		<< "  " << mismatches << " mismatches against the strike rules" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Library-wide recognition with the inverted index against scanning every template, and the Shift-And matcher, for
+// libraries of growing size at the app's resolution and at two and four times as many buckets. All three follow the
+// strike rules, so they must report the same gestures on the same samples. The memory each one's tables take is
+// reported alongside.
+inline int benchmarkLibrary()
+{
+	const int maxStrikes = 2;
+	const size_t samples = 100000;
+	std::mt19937 random(1);
+
+	size_t mismatches = 0;
+	const int resolutions[] = { 18, 36, 72 };
+	const int sizes[] = { 10, 100, 1000 };
+	for (int b = 0; b < 3; b++)
+	{
+		int bins = resolutions[b];
+		int tolerance = 2 * bins / 18;
+
+		// A slowly wandering arm.
+		std::vector<float> walkRoll, walkPitch, walkYaw;
+		randomWalk(static_cast<int>(samples), random, walkRoll, walkPitch, walkYaw, bins);
+		std::vector<int> roll(walkRoll.begin(), walkRoll.end());
+		std::vector<int> pitch(walkPitch.begin(), walkPitch.end());
+		std::vector<int> yaw(walkYaw.begin(), walkYaw.end());
+
+		for (int s = 0; s < 3; s++)
+		{
+			LibraryMatcher indexed(bins, tolerance, maxStrikes);
+			ShiftAndMatcher shiftAnd(bins, tolerance, maxStrikes);
+			ScanningStrikeMatcher scanning(tolerance, maxStrikes);
+			for (int t = 0; t < sizes[s]; t++)
+			{
+				std::vector<float> r, p, y;
+				randomWalk(10 + static_cast<int>(random() % 40), random, r, p, y, bins);
+				std::vector<int> tr(r.begin(), r.end()), tp(p.begin(), p.end()), ty(y.begin(), y.end());
+				indexed.add(&tr[0], &tp[0], &ty[0], static_cast<int>(tr.size()));
+				shiftAnd.add(&tr[0], &tp[0], &ty[0], static_cast<int>(tr.size()));
+				scanning.add(tr, tp, ty);
+			}
+
+			std::vector<int> indexedFound(samples), shiftAndFound(samples), scanningFound(samples);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < samples; i++)
+			{
+				scanningFound[i] = scanning.push(roll[i], pitch[i], yaw[i]);
+			}
+			double scanningMs = elapsedMs(start);
+
+			start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < samples; i++)
+			{
+				indexedFound[i] = indexed.push(roll[i], pitch[i], yaw[i]);
+			}
+			double indexedMs = elapsedMs(start);
+
+			start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < samples; i++)
+			{
+				shiftAndFound[i] = shiftAnd.push(roll[i], pitch[i], yaw[i]) > 0 ? shiftAnd.completions()[0] : -1;
+			}
+			double shiftAndMs = elapsedMs(start);
+
+			size_t found = 0;
+			for (size_t i = 0; i < samples; i++)
+			{
+				mismatches += indexedFound[i] != scanningFound[i];
+				mismatches += shiftAndFound[i] != scanningFound[i];
+				found += indexedFound[i] >= 0;
+			}
+			std::cout << "library: " << bins << " bins, " << sizes[s] << " templates, " << samples << " samples, "
+				<< found << " recognized\n"
+				<< "  scanning  " << scanningMs * 1e6 / samples << " ns/sample\n"
+				<< "  indexed   " << indexedMs * 1e6 / samples << " ns/sample, " << scanningMs / indexedMs << "x, "
+				<< indexed.index().memoryBytes() / 1024 << " KB\n"
+				<< "  shift-and " << shiftAndMs * 1e6 / samples << " ns/sample, " << scanningMs / shiftAndMs << "x, "
+				<< shiftAnd.memoryBytes() / 1024 << " KB" << std::endl;
+		}
+	}
+
+	const int tolerance = EulerQuantizer::scale(2);
+	std::vector<float> walkRoll, walkPitch, walkYaw;
+	randomWalk(static_cast<int>(samples), random, walkRoll, walkPitch, walkYaw);
+	std::vector<int> roll(walkRoll.begin(), walkRoll.end());
+	std::vector<int> pitch(walkPitch.begin(), walkPitch.end());
+	std::vector<int> yaw(walkYaw.begin(), walkYaw.end());
+
+	// Every template saved over again and again, the way re-recording a gesture does it: the index must not keep
+	// growing, and must still match what a scan of the current templates finds.
+	const int saved = 100;
+	const int rounds = 20;
+	LibraryMatcher resaved(EulerQuantizer::bins, tolerance, maxStrikes);
+	ScanningStrikeMatcher scanning(tolerance, maxStrikes);
+	std::vector<std::vector<int> > rolls(saved), pitches(saved), yaws(saved);
+	std::vector<int> ids(saved);
+	for (int t = 0; t < saved; t++)
+	{
+		std::vector<float> r, p, y;
+		randomWalk(10 + static_cast<int>(random() % 40), random, r, p, y);
+		rolls[t].assign(r.begin(), r.end());
+		pitches[t].assign(p.begin(), p.end());
+		yaws[t].assign(y.begin(), y.end());
+		ids[t] = resaved.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], static_cast<int>(rolls[t].size()));
+		scanning.add(rolls[t], pitches[t], yaws[t]);
+	}
+	size_t freshEntries = resaved.index().entryCount();
+	size_t mostEntries = freshEntries;
+	for (int round = 0; round < rounds; round++)
+	{
+		// In template order, so the ids stay in the order the scan breaks ties in.
+		for (int t = 0; t < saved; t++)
+		{
+			resaved.disable(ids[t]);
+			ids[t] = resaved.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], static_cast<int>(rolls[t].size()));
+			mostEntries = std::max(mostEntries, resaved.index().entryCount());
+		}
+	}
+	std::vector<int> original(resaved.size(), -1);
+	for (int t = 0; t < saved; t++)
+	{
+		original[ids[t]] = t;
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t resavedMismatches = 0;
+	for (size_t i = 0; i < samples; i++)
+	{
+		int found = resaved.push(roll[i], pitch[i], yaw[i]);
+		resavedMismatches += (found < 0 ? -1 : original[found]) != scanning.push(roll[i], pitch[i], yaw[i]);
+	}
+	double resavedMs = elapsedMs(start);
+	std::cout << "library: " << saved << " templates saved over " << rounds << " times, at most " << mostEntries
+		<< " index entries against " << freshEntries << " fresh, " << resavedMs * 1e6 / samples
+		<< " ns/sample with a scan alongside" << std::endl;
+	mismatches += resavedMismatches;
+	if (mostEntries > 2 * freshEntries + 1)
+	{
+		std::cout << "  the index kept the entries of templates saved over" << std::endl;
+		mismatches++;
+	}
+	std::cout << "  " << mismatches << " mismatches" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// "Which exercise is this?" over a 10,000-template library: the LB_Kim / LB_Keogh / early-abandoning DTW cascade
+// against scoring every template in full. Queries are library templates replayed at a different pace with some
+// noise, as a patient would. Both must find the same nearest distance.
+inline int benchmarkLowerBound()
+{
+	const int templates = 10000;
+	const int queries = 200;
+	const int length = 32;
+	const int band = 3;
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+
+	std::vector<DtwEnvelope> library(templates);
+	std::vector<const DtwEnvelope*> candidates(templates);
+	std::vector<std::vector<float> > rolls(templates), pitches(templates), yaws(templates);
+	for (int t = 0; t < templates; t++)
+	{
+		randomWalk(20 + static_cast<int>(random() % 40), random, rolls[t], pitches[t], yaws[t]);
+		library[t].build(&rolls[t][0], &pitches[t][0], &yaws[t][0], static_cast<int>(rolls[t].size()), length, band);
+		candidates[t] = &library[t];
+	}
+
+	std::vector<DtwEnvelope> asked(queries);
+	for (int q = 0; q < queries; q++)
+	{
+		int t = static_cast<int>(random() % templates);
+		int steps = static_cast<int>(rolls[t].size());
+		int paced = steps * (60 + static_cast<int>(random() % 80)) / 100 + 1;
+		std::vector<float> roll(paced), pitch(paced), yaw(paced);
+		resampleColumn(&rolls[t][0], steps, &roll[0], paced);
+		resampleColumn(&pitches[t][0], steps, &pitch[0], paced);
+		resampleColumn(&yaws[t][0], steps, &yaw[0], paced);
+		for (int i = 0; i < paced; i++)
+		{
+			roll[i] += noise(random);
+			pitch[i] += noise(random);
+			yaw[i] += noise(random);
+		}
+		asked[q].build(&roll[0], &pitch[0], &yaw[0], paced, length, band);
+	}
+
+	DtwMatcher dtw(band);
+	std::vector<float> exhaustive(queries);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++)
+	{
+		float best = std::numeric_limits<float>::infinity();
+		for (int t = 0; t < templates; t++)
+		{
+			best = std::min(best, dtw.distance(&asked[q].roll[0], &asked[q].pitch[0], &asked[q].yaw[0], length,
+				&library[t].roll[0], &library[t].pitch[0], &library[t].yaw[0], length));
+		}
+		exhaustive[q] = best;
+	}
+	double exhaustiveMs = elapsedMs(start);
+
+	CascadeStats stats;
+	size_t mismatches = 0;
+	start = std::chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++)
+	{
+		float distance;
+		nearestTemplate(asked[q], &candidates[0], templates, dtw, distance, stats);
+		mismatches += distance != exhaustive[q];
+	}
+	double cascadeMs = elapsedMs(start);
+
+	double total = static_cast<double>(stats.candidates);
+	std::cout << "lb: " << queries << " queries against " << templates << " templates (length " << length
+		<< ", band " << band << ")\n"
+		<< "  full DTW  " << queries * 1000.0 / exhaustiveMs << " queries/s\n"
+		<< "  cascade   " << queries * 1000.0 / cascadeMs << " queries/s, " << exhaustiveMs / cascadeMs << "x\n"
+		<< "  pruned by LB_Kim " << 100.0 * stats.prunedByKim / total << "%, by LB_Keogh "
+		<< 100.0 * stats.prunedByKeogh / total << "%; DTW abandoned or not better " << 100.0 * stats.abandoned / total
+		<< "%, new best " << 100.0 * stats.scored / total << "%\n"
+		<< "  " << mismatches << " nearest-distance mismatches" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// quat rotated by angle radians about a random axis.
+inline Quat randomRotation(const Quat& quat, float angle, std::mt19937& random)
+{
+	std::normal_distribution<float> normal;
+	float ax = normal(random), ay = normal(random), az = normal(random);
+	float length = std::sqrt(ax * ax + ay * ay + az * az);
+	float s = std::sin(angle / 2) / length;
+	Quat r = { std::cos(angle / 2), ax * s, ay * s, az * s };
+	Quat q = { r.w * quat.w - r.x * quat.x - r.y * quat.y - r.z * quat.z,
+		r.w * quat.x + r.x * quat.w + r.y * quat.z - r.z * quat.y,
+		r.w * quat.y - r.x * quat.z + r.y * quat.w + r.z * quat.x,
+		r.w * quat.z + r.x * quat.y - r.y * quat.x + r.z * quat.w };
+	return q;
+}
+
+// Whether two orientations land within tolerance buckets of each other on every axis, the cell matchers' test.
+inline bool withinCells(const Quat& a, const Quat& b, int tolerance)
+{
+	int ra, pa, ya, rb, pb, yb;
+	quantizeOrientation(a, ra, pa, ya);
+	quantizeOrientation(b, rb, pb, yb);
+	return std::abs(ra - rb) <= tolerance && std::abs(pa - pb) <= tolerance && std::abs(ya - yb) <= tolerance;
+}
+
+// The quaternion matcher on a library of 64 templates: its SSE2 lanes against the scalar loop, its cost per sample
+// against quantizing and running the cell-mask Shift-And matcher, and how the two tests treat pairs of orientations
+// a fixed rotation apart, anywhere and in the places Euler angles handle badly.
+inline int benchmarkQuaternion()
+{
+	const int tolerance = EulerQuantizer::scale(2);
+	const float toleranceRadians = static_cast<float>(40 * M_PI / 180);
+	const int maxStrikes = 2;
+	const int templates = 64;
+	const size_t samples = 400000;
+	const float stepRadians = static_cast<float>(10 * M_PI / 180);
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<float> w, x, y, z;
+	randomQuaternions(templates, 2, w, x, y, z);
+	std::vector<std::vector<Quat> > library(templates);
+	std::vector<std::vector<int> > rolls(templates), pitches(templates), yaws(templates);
+	QuaternionMatcher quaternions(toleranceRadians, maxStrikes);
+	for (int t = 0; t < templates; t++)
+	{
+		Quat q = { w[t], x[t], y[t], z[t] };
+		int steps = 20 + static_cast<int>(random() % 60);
+		rolls[t].resize(steps);
+		pitches[t].resize(steps);
+		yaws[t].resize(steps);
+		for (int j = 0; j < steps; j++)
+		{
+			library[t].push_back(q);
+			quantizeOrientation(q, rolls[t][j], pitches[t][j], yaws[t][j]);
+			q = randomRotation(q, stepRadians, random);
+		}
+		quaternions.add(&library[t][0], steps);
+	}
+
+	// Reps of random templates, each step jittered by up to half a step, with idle movement in between.
+	std::vector<Quat> stream;
+	std::vector<float> sw, sx, sy, sz;
+	randomQuaternions(samples, 3, sw, sx, sy, sz);
+	size_t idle = 0;
+	while (stream.size() < samples)
+	{
+		int t = static_cast<int>(random() % templates);
+		for (size_t j = 0; j < library[t].size(); j++)
+		{
+			stream.push_back(randomRotation(library[t][j], stepRadians / 2 * unit(random), random));
+		}
+		for (int k = static_cast<int>(random() % 10); k > 0; k--, idle++)
+		{
+			Quat q = { sw[idle], sx[idle], sy[idle], sz[idle] };
+			stream.push_back(q);
+		}
+	}
+	size_t n = stream.size();
+
+	// The SSE2 lanes must follow every template exactly as the scalar loop does.
+	size_t mismatches = 0;
+	QuaternionMatcher scalarQuaternions(toleranceRadians, maxStrikes);
+	for (int t = 0; t < templates; t++)
+	{
+		scalarQuaternions.add(&library[t][0], static_cast<int>(library[t].size()));
+	}
+	for (size_t i = 0; i < n; i++)
+	{
+		quaternions.push(stream[i], true);
+		scalarQuaternions.push(stream[i], false);
+		mismatches += quaternions.completions() != scalarQuaternions.completions();
+	}
+
+	// One template is what a listener follows while counting reps; the whole library is the worst case.
+	std::cout << "quaternion: " << n << " samples\n";
+	const int sizes[] = { 1, templates };
+	for (int k = 0; k < 2; k++)
+	{
+		QuaternionMatcher someQuaternions(toleranceRadians, maxStrikes);
+		ShiftAndMatcher someCells(EulerQuantizer::bins, tolerance, maxStrikes);
+		for (int t = 0; t < sizes[k]; t++)
+		{
+			int steps = static_cast<int>(library[t].size());
+			someQuaternions.add(&library[t][0], steps);
+			someCells.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], steps);
+		}
+
+		size_t quaternionFound = 0, cellFound = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < n; i++)
+		{
+			quaternionFound += someQuaternions.push(stream[i]);
+		}
+		double quaternionMs = elapsedMs(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < n; i++)
+		{
+			int roll, pitch, yaw;
+			quantizeOrientation(stream[i], roll, pitch, yaw);
+			cellFound += someCells.push(roll, pitch, yaw);
+		}
+		double cellMs = elapsedMs(start);
+
+		std::cout << "  " << sizes[k] << " template(s)\n"
+			<< "    quantize + cell masks  " << cellMs * 1e6 / n << " ns/sample, " << cellFound << " reps found\n"
+			<< "    quaternion dot         " << quaternionMs * 1e6 / n << " ns/sample, " << quaternionFound
+			<< " reps found, " << cellMs / quaternionMs << "x\n";
+	}
+
+	// Pairs 20 degrees apart should always match, and pairs 80 degrees apart never.
+	const int pairs = 100000;
+	const char* regions[] = { "anywhere", "near yaw wrap", "near pitch 90" };
+	for (int region = 0; region < 3; region++)
+	{
+		int cellMisses = 0, cellFalse = 0, quaternionMisses = 0, quaternionFalse = 0;
+		for (int i = 0; i < pairs; i++)
+		{
+			Quat a;
+			if (region == 0)
+			{
+				a = randomRotation(quatFromEuler(0, 0, 0), static_cast<float>(M_PI) * unit(random), random);
+			}
+			else if (region == 1)
+			{
+				a = quatFromEuler(static_cast<float>(M_PI) * (2 * unit(random) - 1), 1.2f * (unit(random) - 0.5f),
+					static_cast<float>(M_PI) * (unit(random) < 0.5f ? 1 : -1) * (1 - 0.05f * unit(random)));
+			}
+			else
+			{
+				a = quatFromEuler(static_cast<float>(M_PI) * (2 * unit(random) - 1),
+					static_cast<float>(M_PI / 2) * (1 - 0.05f * unit(random)),
+					static_cast<float>(M_PI) * (2 * unit(random) - 1));
+			}
+			Quat near = randomRotation(a, static_cast<float>(20 * M_PI / 180), random);
+			Quat far = randomRotation(a, static_cast<float>(80 * M_PI / 180), random);
+			std::vector<Quat> pair(1, a);
+			QuaternionMatcher single(toleranceRadians, 0);
+			single.add(&pair[0], 1);
+			quaternionMisses += single.push(near) == 0;
+			quaternionFalse += single.push(far) != 0;
+			cellMisses += !withinCells(a, near, tolerance);
+			cellFalse += withinCells(a, far, tolerance);
+		}
+		std::cout << "  " << regions[region] << ": 20 degrees apart rejected by cells " << 100.0 * cellMisses / pairs
+			<< "%, by quaternion " << 100.0 * quaternionMisses / pairs << "%; 80 degrees apart accepted by cells "
+			<< 100.0 * cellFalse / pairs << "%, by quaternion " << 100.0 * quaternionFalse / pairs << "%\n";
+	}
+	std::cout << "  " << mismatches << " SSE2/scalar mismatches over " << n << " samples" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// The columns of a template replayed at a random pace between 60% and 140% with up to a bucket of noise, the way
+// a patient repeats an exercise.
+inline void pacedTake(const std::vector<float>& roll, const std::vector<float>& pitch, const std::vector<float>& yaw,
+	std::mt19937& random, std::vector<float>& takeRoll, std::vector<float>& takePitch, std::vector<float>& takeYaw)
+{
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	int steps = static_cast<int>(roll.size());
+	int paced = steps * (60 + static_cast<int>(random() % 80)) / 100 + 1;
+	takeRoll.resize(paced);
+	takePitch.resize(paced);
+	takeYaw.resize(paced);
+	resampleColumn(&roll[0], steps, &takeRoll[0], paced);
+	resampleColumn(&pitch[0], steps, &takePitch[0], paced);
+	resampleColumn(&yaw[0], steps, &takeYaw[0], paced);
+	for (int i = 0; i < paced; i++)
+	{
+		takeRoll[i] += noise(random);
+		takePitch[i] += noise(random);
+		takeYaw[i] += noise(random);
+	}
+}
+
+// Five takes of each of 50 exercises, merged by DTW Barycenter Averaging, against keeping the medoid take or keeping
+// all five. Fresh attempts are scored against each; the average should fit them at least as well as the medoid with
+// one comparison instead of five. Also checks that averaging never raises the takes' total alignment cost above the
+// medoid it starts from.
+inline int benchmarkDba()
+{
+	const int exercises = 50;
+	const int takes = 5;
+	const int attempts = 40;
+	std::mt19937 random(1);
+	DtwMatcher dtw(8);
+
+	double averageFit = 0, medoidFit = 0, allFit = 0, averageMs = 0, allMs = 0, buildMs = 0, spread = 0;
+	int worse = 0, steps = 0, rounds = 0;
+	for (int e = 0; e < exercises; e++)
+	{
+		std::vector<float> roll, pitch, yaw;
+		randomWalk(30 + static_cast<int>(random() % 30), random, roll, pitch, yaw);
+
+		DbaAverager averager;
+		std::vector<std::vector<float> > rolls(takes), pitches(takes), yaws(takes);
+		for (int t = 0; t < takes; t++)
+		{
+			pacedTake(roll, pitch, yaw, random, rolls[t], pitches[t], yaws[t]);
+			averager.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], static_cast<int>(rolls[t].size()));
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		AveragedTemplate average;
+		averager.average(average);
+		buildMs += elapsedMs(start);
+		int medoid = averager.medoid();
+
+		float medoidCost = averager.cost(&rolls[medoid][0], &pitches[medoid][0], &yaws[medoid][0],
+			static_cast<int>(rolls[medoid].size()));
+		float averageCost = averager.cost(&average.roll[0], &average.pitch[0], &average.yaw[0], average.length());
+		worse += averageCost > medoidCost * (1 + 1e-4f);
+		rounds += average.rounds;
+		for (int i = 0; i < average.length(); i++)
+		{
+			spread += std::sqrt(std::max(average.varianceRoll[i], std::max(average.variancePitch[i],
+				average.varianceYaw[i])));
+		}
+		steps += average.length();
+
+		for (int a = 0; a < attempts; a++)
+		{
+			std::vector<float> r, p, y;
+			pacedTake(roll, pitch, yaw, random, r, p, y);
+			int n = static_cast<int>(r.size());
+
+			start = std::chrono::steady_clock::now();
+			float fit = dtw.distance(&r[0], &p[0], &y[0], n, &average.roll[0], &average.pitch[0], &average.yaw[0],
+				average.length()) / std::max(n, average.length());
+			averageMs += elapsedMs(start);
+			averageFit += fit;
+
+			int m = static_cast<int>(rolls[medoid].size());
+			medoidFit += dtw.distance(&r[0], &p[0], &y[0], n, &rolls[medoid][0], &pitches[medoid][0],
+				&yaws[medoid][0], m) / std::max(n, m);
+
+			start = std::chrono::steady_clock::now();
+			float best = std::numeric_limits<float>::infinity();
+			for (int t = 0; t < takes; t++)
+			{
+				m = static_cast<int>(rolls[t].size());
+				best = std::min(best, dtw.distance(&r[0], &p[0], &y[0], n, &rolls[t][0], &pitches[t][0], &yaws[t][0],
+					m) / std::max(n, m));
+			}
+			allMs += elapsedMs(start);
+			allFit += best;
+		}
+	}
+
+	int scored = exercises * attempts;
+	std::cout << "dba: " << exercises << " exercises, " << takes << " takes each, " << scored << " attempts\n"
+		<< "  averaging  " << buildMs / exercises << " ms/exercise, " << static_cast<double>(rounds) / exercises
+		<< " rounds, step spread " << spread / steps << " buckets\n"
+		<< "  average    " << averageFit / scored << " per step, " << averageMs * 1e3 / scored << " us/attempt\n"
+		<< "  medoid     " << medoidFit / scored << " per step\n"
+		<< "  all takes  " << allFit / scored << " per step (best of " << takes << "), " << allMs * 1e3 / scored
+		<< " us/attempt\n"
+		<< "  " << worse << " averages costlier than their medoid" << std::endl;
+	return worse == 0 ? 0 : 1;
+}
+
+// A recorded movement: straight sweeps between a few random waypoints in one-bucket steps, the way the filtered
+// stream records them, with the odd bucket of wobble.
+inline void sweeps(std::mt19937& random, std::vector<float>& roll, std::vector<float>& pitch, std::vector<float>& yaw)
+{
+	std::uniform_int_distribution<int> bucket(0, EulerQuantizer::bins);
+	roll.clear();
+	pitch.clear();
+	yaw.clear();
+	float r = static_cast<float>(bucket(random)), p = static_cast<float>(bucket(random));
+	float y = static_cast<float>(bucket(random));
+	for (int waypoints = 3 + static_cast<int>(random() % 4); waypoints > 0; waypoints--)
+	{
+		float toR = static_cast<float>(bucket(random)), toP = static_cast<float>(bucket(random));
+		float toY = static_cast<float>(bucket(random));
+		int steps = std::max(1, static_cast<int>(std::max(std::fabs(toR - r), std::max(std::fabs(toP - p),
+			std::fabs(toY - y)))));
+		for (int i = 1; i <= steps; i++)
+		{
+			float t = static_cast<float>(i) / steps;
+			float wobble = random() % 10 == 0 ? (random() % 2 ? 1.0f : -1.0f) : 0.0f;
+			roll.push_back(std::floor(r + (toR - r) * t + 0.5f) + wobble);
+			pitch.push_back(std::floor(p + (toP - p) * t + 0.5f));
+			yaw.push_back(std::floor(y + (toY - y) * t + 0.5f));
+		}
+		r = toR;
+		p = toP;
+		y = toY;
+	}
+}
+
+// Keyframe compression of recorded movements at two error bounds: how much it saves, whether the reconstruction
+// stays within the bound, and what SPRING rep counting costs against the keyframes instead of every step.
+inline int benchmarkKeyframes()
+{
+	const int templates = 100;
+	const int reps = 10;
+	const float bounds[] = { 0.5f, 1.0f };
+	std::mt19937 random(1);
+
+	std::vector<std::vector<float> > rolls(templates), pitches(templates), yaws(templates);
+	for (int t = 0; t < templates; t++)
+	{
+		sweeps(random, rolls[t], pitches[t], yaws[t]);
+	}
+
+	int violations = 0;
+	std::cout << "keyframes: " << templates << " recordings, " << reps << " reps each\n";
+	for (int b = 0; b < 2; b++)
+	{
+		size_t steps = 0, keyframes = 0, stepSamples = 0, fullFound = 0, keyframeFound = 0;
+		double compressMs = 0, fullMs = 0, keyframeMs = 0;
+		float worst = 0;
+		for (int t = 0; t < templates; t++)
+		{
+			int n = static_cast<int>(rolls[t].size());
+			KeyframeTrack track;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			track.compress(&rolls[t][0], &pitches[t][0], &yaws[t][0], n, bounds[b]);
+			compressMs += elapsedMs(start);
+			steps += n;
+			keyframes += track.keyframes();
+
+			std::vector<float> r(n), p(n), y(n);
+			track.reconstruct(&r[0], &p[0], &y[0]);
+			for (int i = 0; i < n; i++)
+			{
+				float error = std::max(std::fabs(r[i] - rolls[t][i]), std::max(std::fabs(p[i] - pitches[t][i]),
+					std::fabs(y[i] - yaws[t][i])));
+				worst = std::max(worst, error);
+				violations += error > bounds[b] + 1e-4f;
+			}
+
+			// The same paced reps, back to back, through SPRING with the full template and with the keyframes.
+			std::vector<float> streamRoll, streamPitch, streamYaw;
+			for (int k = 0; k < reps; k++)
+			{
+				std::vector<float> takeRoll, takePitch, takeYaw;
+				pacedTake(rolls[t], pitches[t], yaws[t], random, takeRoll, takePitch, takeYaw);
+				streamRoll.insert(streamRoll.end(), takeRoll.begin(), takeRoll.end());
+				streamPitch.insert(streamPitch.end(), takePitch.begin(), takePitch.end());
+				streamYaw.insert(streamYaw.end(), takeYaw.begin(), takeYaw.end());
+			}
+			stepSamples += streamRoll.size();
+
+			SpringMatcher full(2.0f), compressed(2.0f);
+			full.setTemplate(&rolls[t][0], &pitches[t][0], &yaws[t][0], n);
+			compressed.setTemplate(track);
+			SpringMatch match;
+			start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < streamRoll.size(); i++)
+			{
+				fullFound += full.push(i, streamRoll[i], streamPitch[i], streamYaw[i], match);
+			}
+			fullFound += full.flush(match);
+			fullMs += elapsedMs(start);
+
+			start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < streamRoll.size(); i++)
+			{
+				keyframeFound += compressed.push(i, streamRoll[i], streamPitch[i], streamYaw[i], match);
+			}
+			keyframeFound += compressed.flush(match);
+			keyframeMs += elapsedMs(start);
+		}
+		std::cout << "  error " << bounds[b] << ": " << steps << " steps to " << keyframes << " keyframes ("
+			<< static_cast<double>(steps) / keyframes << "x), " << compressMs / templates
+			<< " ms/recording, worst reconstruction error " << worst << "\n"
+			<< "    spring, every step  " << fullMs * 1e6 / stepSamples << " ns/sample, " << fullFound << " / "
+			<< templates * reps << " reps found\n"
+			<< "    spring, keyframes   " << keyframeMs * 1e6 / stepSamples << " ns/sample, " << keyframeFound
+			<< " / " << templates * reps << " reps found\n";
+	}
+	std::cout << "  " << violations << " steps outside the error bound" << std::endl;
+	return violations == 0 ? 0 : 1;
+}
+
+// 1, 2, 4, ... threads, up to the hardware's and at least 4 so the parallel paths are always checked.
+inline std::vector<int> threadCounts()
+{
+	int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	std::vector<int> counts;
+	for (int n = 1; n < std::max(hardware, 4); n *= 2)
+	{
+		counts.push_back(n);
+	}
+	counts.push_back(std::max(hardware, 4));
+	return counts;
+}
+
+// Offline scoring spread across a growing number of threads: re-scoring about 40 hours of recorded sessions against a
+// 64-template library, and "which exercise is this?" over a 10,000-template library, one query at a time. Every
+// thread count must give the one-thread results. Counts past the hardware's only share its cores.
+inline int benchmarkThreads()
+{
+	const int tolerance = EulerQuantizer::scale(2);
+	const int maxStrikes = 2;
+	const int templates = 64;
+	const int sessions = 256;
+	const size_t sessionSamples = 30000;
+	std::mt19937 random(1);
+	std::uniform_int_distribution<int> bucket(0, EulerQuantizer::bins);
+
+	LibraryMatcher library(EulerQuantizer::bins, tolerance, maxStrikes);
+	std::vector<std::vector<int> > rolls(templates), pitches(templates), yaws(templates);
+	for (int t = 0; t < templates; t++)
+	{
+		std::vector<float> roll, pitch, yaw;
+		randomWalk(20 + static_cast<int>(random() % 60), random, roll, pitch, yaw);
+		rolls[t].assign(roll.begin(), roll.end());
+		pitches[t].assign(pitch.begin(), pitch.end());
+		yaws[t].assign(yaw.begin(), yaw.end());
+		library.add(&rolls[t][0], &pitches[t][0], &yaws[t][0], static_cast<int>(rolls[t].size()));
+	}
+
+	// Each session is exercises with the odd stray sample, between stretches of wandering.
+	std::vector<SessionColumns> recorded(sessions);
+	for (int s = 0; s < sessions; s++)
+	{
+		SessionColumns& session = recorded[s];
+		while (session.roll.size() < sessionSamples)
+		{
+			std::vector<float> roll, pitch, yaw;
+			randomWalk(20 + static_cast<int>(random() % 80), random, roll, pitch, yaw);
+			session.roll.insert(session.roll.end(), roll.begin(), roll.end());
+			session.pitch.insert(session.pitch.end(), pitch.begin(), pitch.end());
+			session.yaw.insert(session.yaw.end(), yaw.begin(), yaw.end());
+
+			int t = static_cast<int>(random() % templates);
+			for (size_t j = 0; j < rolls[t].size(); j++)
+			{
+				bool stray = random() % 20 == 0;
+				session.roll.push_back(stray ? bucket(random) : rolls[t][j]);
+				session.pitch.push_back(stray ? bucket(random) : pitches[t][j]);
+				session.yaw.push_back(stray ? bucket(random) : yaws[t][j]);
+			}
+		}
+		session.roll.resize(sessionSamples);
+		session.pitch.resize(sessionSamples);
+		session.yaw.resize(sessionSamples);
+	}
+
+	const int lookupTemplates = 10000;
+	const int queries = 200;
+	const int length = 32;
+	const int band = 3;
+	std::vector<DtwEnvelope> envelopes(lookupTemplates);
+	std::vector<const DtwEnvelope*> candidates(lookupTemplates);
+	std::vector<std::vector<float> > lookupRolls(lookupTemplates), lookupPitches(lookupTemplates),
+		lookupYaws(lookupTemplates);
+	for (int t = 0; t < lookupTemplates; t++)
+	{
+		randomWalk(20 + static_cast<int>(random() % 40), random, lookupRolls[t], lookupPitches[t], lookupYaws[t]);
+		envelopes[t].build(&lookupRolls[t][0], &lookupPitches[t][0], &lookupYaws[t][0],
+			static_cast<int>(lookupRolls[t].size()), length, band);
+		candidates[t] = &envelopes[t];
+	}
+	std::vector<DtwEnvelope> asked(queries);
+	for (int q = 0; q < queries; q++)
+	{
+		int t = static_cast<int>(random() % lookupTemplates);
+		std::vector<float> roll, pitch, yaw;
+		pacedTake(lookupRolls[t], lookupPitches[t], lookupYaws[t], random, roll, pitch, yaw);
+		asked[q].build(&roll[0], &pitch[0], &yaw[0], static_cast<int>(roll.size()), length, band);
+	}
+
+	std::cout << "threads: " << sessions << " sessions of " << sessionSamples << " samples against " << templates
+		<< " templates; " << queries << " lookups against " << lookupTemplates << " templates; "
+		<< std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+	size_t mismatches = 0;
+	std::vector<int> expectedCompletions;
+	std::vector<int> expectedNearest(queries);
+	double rescoreBaseMs = 0;
+	double lookupBaseMs = 0;
+	std::vector<int> counts = threadCounts();
+	for (size_t k = 0; k < counts.size(); k++)
+	{
+		ThreadPool pool(counts[k]);
+		std::vector<int> completions;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		rescoreSessions(library.index(), recorded, pool, completions);
+		double rescoreMs = elapsedMs(start);
+
+		std::vector<DtwMatcher> dtws(pool.size(), DtwMatcher(band));
+		std::vector<int> nearest(queries);
+		CascadeStats stats;
+		start = std::chrono::steady_clock::now();
+		for (int q = 0; q < queries; q++)
+		{
+			float distance;
+			nearest[q] = nearestTemplate(asked[q], &candidates[0], lookupTemplates, pool, dtws, distance, stats);
+		}
+		double lookupMs = elapsedMs(start);
+
+		if (k == 0)
+		{
+			expectedCompletions = completions;
+			expectedNearest = nearest;
+			rescoreBaseMs = rescoreMs;
+			lookupBaseMs = lookupMs;
+			size_t found = 0;
+			for (size_t i = 0; i < completions.size(); i++)
+			{
+				found += completions[i];
+			}
+			std::cout << "  " << found << " exercises found in the sessions" << std::endl;
+		}
+		for (size_t i = 0; i < completions.size(); i++)
+		{
+			mismatches += completions[i] != expectedCompletions[i];
+		}
+		for (int q = 0; q < queries; q++)
+		{
+			mismatches += nearest[q] != expectedNearest[q];
+		}
+		std::cout << "  " << counts[k] << " threads: rescoring " << sessions * sessionSamples / (rescoreMs * 1e3)
+			<< " M samples/s (" << rescoreBaseMs / rescoreMs << "x), lookups " << queries * 1000.0 / lookupMs
+			<< " queries/s (" << lookupBaseMs / lookupMs << "x)" << std::endl;
+	}
+	std::cout << "  " << mismatches << " mismatches against one thread" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// A 2,000-template library written to disk and opened again: how long opening takes with the file mapped against
+// reading it all in, and whether every template comes back as it was written. The file is written to the current
+// directory and removed afterwards.
+inline int benchmarkLibraryFile()
+{
+	const int templates = 2000;
+	const int opens = 100;
+	const std::string path = "benchmark.myolib";
+	std::mt19937 random(1);
+
+	std::vector<LibraryTemplate> written(templates);
+	for (int t = 0; t < templates; t++)
+	{
+		LibraryTemplate& stored = written[t];
+		stored.name = "exercise" + std::to_string(t);
+		std::vector<float> roll, pitch, yaw;
+		randomWalk(50 + static_cast<int>(random() % 150), random, roll, pitch, yaw);
+		int steps = static_cast<int>(roll.size());
+		for (int i = 0; i < steps; i++)
+		{
+			StoredStep step = { static_cast<uint8_t>(roll[i]), static_cast<uint8_t>(pitch[i]),
+				static_cast<uint8_t>(yaw[i]) };
+			stored.steps.push_back(step);
+			stored.orientations.push_back(quatFromEuler(EulerQuantizer::RollYaw::center(step.roll),
+				EulerQuantizer::Pitch::center(step.pitch), EulerQuantizer::RollYaw::center(step.yaw)));
+			if (t % 2 == 0)
+			{
+				stored.tolerances.push_back(static_cast<uint8_t>(2 + random() % 3));
+			}
+			if (i % 4 == 0 || i == steps - 1)
+			{
+				stored.keyframes.push_back(static_cast<uint32_t>(i));
+			}
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	writeLibrary(path, EulerQuantizer::bins, written);
+	double writeMs = elapsedMs(start);
+
+	size_t mismatches = 0;
+	size_t bytes = 0;
+	{
+		LibraryFile file(path);
+		mismatches += file.size() != templates;
+		for (int t = 0; t < file.size() && t < templates; t++)
+		{
+			const LibraryTemplate& stored = written[t];
+			int steps = file.stepCount(t);
+			mismatches += file.name(t) != stored.name || steps != static_cast<int>(stored.steps.size()) ||
+				(file.tolerances(t) != 0) != !stored.tolerances.empty() ||
+				file.keyframeCount(t) != static_cast<int>(stored.keyframes.size());
+			for (int i = 0; i < steps && i < static_cast<int>(stored.steps.size()); i++)
+			{
+				mismatches += file.steps(t)[i].roll != stored.steps[i].roll ||
+					file.steps(t)[i].pitch != stored.steps[i].pitch || file.steps(t)[i].yaw != stored.steps[i].yaw ||
+					file.orientations(t)[i].w != stored.orientations[i].w ||
+					file.orientations(t)[i].z != stored.orientations[i].z ||
+					(file.tolerances(t) != 0 && file.tolerances(t)[i] != stored.tolerances[i]);
+			}
+			for (int k = 0; k < file.keyframeCount(t) && k < static_cast<int>(stored.keyframes.size()); k++)
+			{
+				mismatches += file.keyframes(t)[k] != stored.keyframes[k];
+			}
+		}
+	}
+
+	// Opening and checking the file, against reading it into memory, which any loader that doesn't map has to do
+	// before it can even start parsing.
+	start = std::chrono::steady_clock::now();
+	size_t steps = 0;
+	for (int k = 0; k < opens; k++)
+	{
+		LibraryFile file(path);
+		steps += file.stepCount(file.size() - 1);
+	}
+	double mapMs = elapsedMs(start) / opens;
+
+	start = std::chrono::steady_clock::now();
+	for (int k = 0; k < opens; k++)
+	{
+		std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+		std::vector<char> contents(static_cast<size_t>(in.tellg()));
+		in.seekg(0);
+		in.read(&contents[0], contents.size());
+		bytes = contents.size();
+	}
+	double readMs = elapsedMs(start) / opens;
+
+	// Walking every step of every template through the mapping.
+	start = std::chrono::steady_clock::now();
+	uint64_t sum = 0;
+	{
+		LibraryFile file(path);
+		for (int t = 0; t < file.size(); t++)
+		{
+			const StoredStep* stored = file.steps(t);
+			for (int i = 0; i < file.stepCount(t); i++)
+			{
+				sum += stored[i].roll + stored[i].pitch + stored[i].yaw;
+			}
+		}
+	}
+	double walkMs = elapsedMs(start);
+	std::remove(path.c_str());
+
+	std::cout << "libraryfile: " << templates << " templates, " << bytes / 1024 << " KiB\n"
+		<< "  write               " << writeMs << " ms\n"
+		<< "  open, mapped        " << mapMs << " ms\n"
+		<< "  read into memory    " << readMs << " ms, " << readMs / mapMs << "x\n"
+		<< "  walk every step     " << walkMs << " ms (checksum " << sum + steps << ")\n"
+		<< "  " << mismatches << " mismatches after the round trip" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Whether JsonReader accepts text as one whole, well-formed document.
+inline bool parsesAsJson(const std::string& text)
+{
+	try {
+		JsonReader in(text.data(), text.size());
+		in.skip();
+		in.expect(jsonEnd);
+		return true;
+	}
+	catch (const std::runtime_error&) {
+		return false;
+	}
+}
+
+// Gesture export with the streaming writer against building the string the way Gesture::toJSONString used to, a
+// temporary per step and a "\b\b" over the last comma, at growing sizes; then reading it all back with the pull
+// parser. Also runs the parser over documents it must accept and reject.
+inline int benchmarkJson()
+{
+	std::mt19937 random(1);
+	size_t failures = 0;
+	JsonWriter writer;
+	std::string text;
+	const int sizes[] = { 1000, 10000, 100000, 1000000 };
+	for (int s = 0; s < 4; s++)
+	{
+		int steps = sizes[s];
+		std::vector<int> roll(steps), pitch(steps), yaw(steps);
+		for (int i = 0; i < steps; i++)
+		{
+			roll[i] = static_cast<int>(random() % (EulerQuantizer::bins + 1));
+			pitch[i] = static_cast<int>(random() % (EulerQuantizer::bins + 1));
+			yaw[i] = static_cast<int>(random() % (EulerQuantizer::bins + 1));
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::string builder = "{\n\"gesture\": [";
+		for (int i = 0; i < steps; i++)
+		{
+			builder += std::string("\n{\n\"roll\": ") + std::to_string(roll[i]) + ",\n\"pitch\": " +
+				std::to_string(pitch[i]) + ",\n\"yaw\": " + std::to_string(yaw[i]) + "\n}" + ", ";
+		}
+		builder += "\b\b]\n}";
+		double concatenatedMs = elapsedMs(start);
+
+		start = std::chrono::steady_clock::now();
+		writer.clear();
+		writer.beginObject();
+		writer.key("gesture");
+		writer.beginArray();
+		for (int i = 0; i < steps; i++)
+		{
+			writer.beginObject();
+			writer.key("roll");
+			writer.value(roll[i]);
+			writer.key("pitch");
+			writer.value(pitch[i]);
+			writer.key("yaw");
+			writer.value(yaw[i]);
+			writer.endObject();
+		}
+		writer.endArray();
+		writer.endObject();
+		double streamedMs = elapsedMs(start);
+		text = writer.buffer();
+
+		start = std::chrono::steady_clock::now();
+		size_t mismatches = 0;
+		int read = 0;
+		JsonReader in(text.data(), text.size());
+		in.expect(jsonBeginObject);
+		while (in.next() == jsonKey)
+		{
+			in.expect(jsonBeginArray);
+			while (in.nextElement(jsonBeginObject))
+			{
+				int step[3] = { 0, 0, 0 };
+				while (in.next() == jsonKey)
+				{
+					int axis = in.textEquals("roll") ? 0 : in.textEquals("pitch") ? 1 : 2;
+					in.expect(jsonNumber);
+					step[axis] = in.integer();
+				}
+				mismatches += read >= steps || step[0] != roll[read] || step[1] != pitch[read] || step[2] != yaw[read];
+				read++;
+			}
+		}
+		in.expect(jsonEnd);
+		double parsedMs = elapsedMs(start);
+		mismatches += read != steps;
+		failures += mismatches;
+
+		bool oldValid = parsesAsJson(builder);
+		std::cout << "json: " << steps << " steps\n"
+			<< "  concatenated " << concatenatedMs * 1e6 / steps << " ns/step, " << builder.size() << " bytes, "
+			<< (oldValid ? "valid" : "not valid JSON") << "\n"
+			<< "  streamed     " << streamedMs * 1e6 / steps << " ns/step, " << text.size() << " bytes, "
+			<< concatenatedMs / streamedMs << "x\n"
+			<< "  parsed       " << parsedMs * 1e6 / steps << " ns/step, " << text.size() / (parsedMs * 1e3)
+			<< " MB/s, " << mismatches << " mismatches" << std::endl;
+	}
+
+	const char* good[] = { "{}", "[]", " 0 ", "-0.5e+3", "\"\\u00e9\\ud83d\\ude00\\n\"",
+		"{\"a\":[1,{\"b\":null}],\"c\":true}", "[false, \"x\" , [ ] ]" };
+	const char* bad[] = { "", "{", "[1,]", "{\"a\":1,}", "{\"a\" 1}", "[01]", "[1.]", "[.5]", "\"\\x\"",
+		"\"tab\there\"", "[1] 2", "{1:2}", "[tru]", "[\"a\\u12\"]", "nul" };
+	size_t grammar = 0;
+	for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++)
+	{
+		grammar += !parsesAsJson(good[i]);
+	}
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+	{
+		grammar += parsesAsJson(bad[i]);
+	}
+	std::string decoded;
+	JsonReader escapes("\"\\u00e9\\ud83d\\ude00\\n\\\"\"", 25);
+	escapes.expect(jsonString);
+	escapes.text(decoded);
+	grammar += decoded != "\xc3\xa9\xf0\x9f\x98\x80\n\"" || !escapes.textEquals("\xc3\xa9\xf0\x9f\x98\x80\n\"");
+	writer.clear();
+	writer.value("quote \" backslash \\ newline \n bell \x07");
+	JsonReader quoted(writer.buffer().data(), writer.buffer().size());
+	quoted.expect(jsonString);
+	quoted.text(decoded);
+	grammar += decoded != "quote \" backslash \\ newline \n bell \x07";
+	std::cout << "  " << grammar << " grammar and escaping failures" << std::endl;
+	return failures == 0 && grammar == 0 ? 0 : 1;
+}
+
+// What the source thread pays to log a sample through the ring, against writing each one to the file itself, plus a
+// round trip through the file: two sessions written and read back, then a record cut short the way a crash would
+// leave it and a third session appended after it.
+inline int benchmarkSessionLog()
+{
+	const int records = 200000;
+	const int burst = 2000;
+	const int direct = 20000;
+	const std::string path = "benchmark.myolog";
+	std::remove(path.c_str());
+
+	// Bursts of samples with pauses between them, the way a hub delivers them, only much faster.
+	double pushNs = 0;
+	uint64_t dropped = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int session = 0; session < 2; session++)
+	{
+		SessionLog log(path, 5, 50);
+		for (int i = 0; i < records; i += burst)
+		{
+			std::chrono::steady_clock::time_point pushed = std::chrono::steady_clock::now();
+			for (int k = i; k < i + burst; k++)
+			{
+				Quat quat = { static_cast<float>(k), 0.5f, -0.5f, 0.25f };
+				log.orientation(session, 1000 + k * 20000ULL, quat, static_cast<PoseType>(k % 6), k % 3 == 0);
+			}
+			pushNs += elapsedMs(pushed) * 1e6;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		log.pose(session, 7, poseFist);
+		log.lock(session, 8, false);
+		log.stop();
+		dropped += log.recordsDropped();
+	}
+	double loggedMs = elapsedMs(start);
+
+	AppendFile file(path + ".direct");
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < direct; i++)
+	{
+		LogRecord record = {};
+		record.timestamp = i;
+		record.kind = logOrientation;
+		file.append(&record, sizeof(record));
+	}
+	double directNs = elapsedMs(start) * 1e6 / direct;
+	std::remove((path + ".direct").c_str());
+
+	// Every record back in order, with the pose and lock after each session's samples. Only checked when nothing was
+	// dropped, since drops leave gaps.
+	size_t mismatches = 0;
+	if (dropped == 0)
+	{
+		SessionLogFile log(path);
+		const LogRecord* read = log.records();
+		mismatches += log.size() != 2 * (1 + records + 2);
+		size_t i = 0;
+		for (int session = 0; session < 2 && log.size() == 2 * (1 + records + 2); session++)
+		{
+			mismatches += read[i++].kind != logSession;
+			for (int k = 0; k < records; k++, i++)
+			{
+				mismatches += read[i].kind != logOrientation || read[i].device != session ||
+					read[i].timestamp != 1000 + k * 20000ULL || read[i].quat.w != static_cast<float>(k) ||
+					read[i].quat.z != 0.25f || read[i].pose != k % 6 || read[i].locked != (k % 3 == 0);
+			}
+			mismatches += read[i].kind != logPose || read[i].pose != poseFist;
+			i++;
+			mismatches += read[i].kind != logLock || read[i].locked != 0;
+			i++;
+		}
+	}
+
+	// A crash partway through a record: the next session pads it out, and the reader skips the padding.
+	size_t before;
+	{
+		SessionLogFile log(path);
+		before = log.size();
+	}
+	{
+		std::ofstream torn(path.c_str(), std::ios::binary | std::ios::app);
+		torn.write("\x01\x02\x03\x04\x05\x06\x07", 7);
+	}
+	{
+		SessionLog log(path);
+		Quat quat = { 1, 0, 0, 0 };
+		log.orientation(3, 42, quat, poseRest, false);
+		log.stop();
+	}
+	{
+		SessionLogFile log(path);
+		const LogRecord* read = log.records();
+		mismatches += log.size() != before + 3;
+		if (log.size() == before + 3)
+		{
+			mismatches += read[before].kind != logPadding || read[before + 1].kind != logSession ||
+				read[before + 2].kind != logOrientation || read[before + 2].device != 3 ||
+				read[before + 2].timestamp != 42;
+		}
+	}
+	std::remove(path.c_str());
+
+	std::cout << "sessionlog: 2 sessions of " << records << " samples\n"
+		<< "  push from the callback   " << pushNs / (2.0 * records) << " ns/sample\n"
+		<< "  write each one directly  " << directNs << " ns/sample, " << directNs * 2.0 * records / pushNs << "x\n"
+		<< "  both sessions, paced     " << loggedMs << " ms, written and synced\n"
+		<< "  " << dropped << " dropped, " << mismatches << " mismatches" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Packed step streams (see streamcodec.h) against three ints a step: size, encoding, replaying a whole stream and
+// seeking to single steps, on an hour of quantized curls at 50 Hz and on a random walk that moves every step, plus
+// exact round trips, big jumps included.
+inline int benchmarkCodec()
+{
+	const int steps = 50 * 60 * 60;
+	const int seeks = 200000;
+	std::mt19937 random(1);
+	std::normal_distribution<float> noise(0.0f, 0.01f);
+
+	// Slow curls with a rest at the bottom and a hold at the top, plus sensor noise, quantized every sample.
+	std::vector<int> curlRoll(steps), curlPitch(steps), curlYaw(steps);
+	for (int i = 0; i < steps; i++)
+	{
+		float phase = std::fmod(i / 50.0f, 6.0f);
+		float lift = phase < 1 ? 0 : phase < 3 ? (1 - std::cos((phase - 1) * 1.5708f)) / 2 : phase < 4 ? 1 :
+			phase < 5.5f ? (1 + std::cos((phase - 4) / 1.5f * 3.14159f)) / 2 : 0;
+		Quat quat = quatFromEuler(0.3f + noise(random), -0.6f + 1.8f * lift + noise(random),
+			0.1f + i * 1e-5f + noise(random));
+		quantizeOrientation(quat, curlRoll[i], curlPitch[i], curlYaw[i]);
+	}
+	std::vector<float> walkRoll, walkPitch, walkYaw;
+	randomWalk(steps, random, walkRoll, walkPitch, walkYaw);
+	std::vector<int> walkR(walkRoll.begin(), walkRoll.end()), walkP(walkPitch.begin(), walkPitch.end()),
+		walkY(walkYaw.begin(), walkYaw.end());
+
+	size_t mismatches = 0;
+	std::cout << "codec: " << steps << " steps, " << steps * 3 * sizeof(int) / 1024 << " KiB as ints" << std::endl;
+	const int* streams[2][3] = { { &curlRoll[0], &curlPitch[0], &curlYaw[0] }, { &walkR[0], &walkP[0], &walkY[0] } };
+	const char* names[2] = { "curls", "random walk" };
+	for (int k = 0; k < 2; k++)
+	{
+		const int* roll = streams[k][0];
+		const int* pitch = streams[k][1];
+		const int* yaw = streams[k][2];
+		PackedStream packed;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		packed.encode(roll, pitch, yaw, steps);
+		double encodeMs = elapsedMs(start);
+		size_t bytes = packed.dataBytes() + packed.blockCount() * sizeof(uint32_t);
+
+		// Replaying: the whole stream out of the packed form, against copying it out of int columns.
+		std::vector<int> outRoll(steps), outPitch(steps), outYaw(steps);
+		start = std::chrono::steady_clock::now();
+		packed.decode(0, steps, &outRoll[0], &outPitch[0], &outYaw[0]);
+		double decodeMs = elapsedMs(start);
+		for (int i = 0; i < steps; i++)
+		{
+			mismatches += outRoll[i] != roll[i] || outPitch[i] != pitch[i] || outYaw[i] != yaw[i];
+		}
+		start = std::chrono::steady_clock::now();
+		std::copy(roll, roll + steps, outRoll.begin());
+		std::copy(pitch, pitch + steps, outPitch.begin());
+		std::copy(yaw, yaw + steps, outYaw.begin());
+		double copyMs = elapsedMs(start);
+
+		std::uniform_int_distribution<int> at(0, steps - 1);
+		start = std::chrono::steady_clock::now();
+		for (int q = 0; q < seeks; q++)
+		{
+			int i = at(random);
+			int r, p, y;
+			packed.decode(i, 1, &r, &p, &y);
+			mismatches += r != roll[i] || p != pitch[i] || y != yaw[i];
+		}
+		double seekNs = elapsedMs(start) * 1e6 / seeks;
+
+		std::cout << "  " << names[k] << ": " << bytes / 1024 << " KiB, " << steps * 3.0 * sizeof(int) / bytes
+			<< "x smaller, " << bytes * 8.0 / steps << " bits/step\n"
+			<< "    encode " << encodeMs << " ms, replay " << steps / (decodeMs * 1e3) << " M steps/s (ints: "
+			<< steps / (copyMs * 1e3) << "), seek " << seekNs << " ns" << std::endl;
+	}
+
+	// Jumps of every size, runs across block boundaries, and partial reads starting and ending anywhere.
+	std::vector<int> roll, pitch, yaw;
+	std::uniform_int_distribution<int> value(0, 255);
+	for (int i = 0; i < 3000; i++)
+	{
+		int run = 1 + static_cast<int>(random() % 300);
+		int v = value(random);
+		for (int k = 0; k < run; k++)
+		{
+			roll.push_back(v);
+			pitch.push_back(i % 2 == 0 ? value(random) : 255 - k % 256);
+			yaw.push_back(static_cast<int>(k % 256));
+		}
+	}
+	PackedStream packed;
+	packed.encode(&roll[0], &pitch[0], &yaw[0], roll.size());
+	for (int q = 0; q < 2000; q++)
+	{
+		size_t first = random() % roll.size();
+		size_t count = random() % std::min<size_t>(roll.size() - first, 1000);
+		std::vector<int> r(count + 1), p(count + 1), y(count + 1);
+		packed.decode(first, count, &r[0], &p[0], &y[0]);
+		for (size_t i = 0; i < count; i++)
+		{
+			mismatches += r[i] != roll[first + i] || p[i] != pitch[first + i] || y[i] != yaw[first + i];
+		}
+	}
+	bool rejected = false;
+	try {
+		decodePacked(packed.data(), packed.dataBytes() / 2, packed.blocks(), packed.size(), 0, packed.size(),
+			&roll[0], &pitch[0], &yaw[0]);
+	}
+	catch (const std::runtime_error&) {
+		rejected = true;
+	}
+	mismatches += !rejected;
+	std::cout << "  " << mismatches << " mismatches" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// A library-wide scan, every step of every template checked against a live step the way EulerAngle::equals() does,
+// over the old layout (a map of templates, each with its own heap vector of three ints a step) and over a
+// TemplateArena of three-byte steps. Then a check that the arena keeps every run intact and aligned through
+// replacements and compactions.
+inline int benchmarkArena()
+{
+	struct IntStep
+	{
+		int roll, pitch, yaw;
+	};
+	const int libraries[2] = { 100, 2000 };
+	const int queries = 200;
+	const int tolerance = EulerQuantizer::scale(2);
+	std::mt19937 random(1);
+
+	size_t mismatches = 0;
+	for (int l = 0; l < 2; l++)
+	{
+		int templates = libraries[l];
+		std::map<std::string, std::vector<IntStep>*> scattered;
+		std::vector<std::vector<char>*> neighbours;
+		TemplateArena<StoredStep> arena;
+		std::vector<int> runs;
+		size_t steps = 0;
+		for (int t = 0; t < templates; t++)
+		{
+			std::vector<float> roll, pitch, yaw;
+			randomWalk(100 + static_cast<int>(random() % 200), random, roll, pitch, yaw);
+			std::vector<IntStep>* wide = new std::vector<IntStep>();
+			std::vector<StoredStep> packed;
+			for (size_t i = 0; i < roll.size(); i++)
+			{
+				IntStep step = { static_cast<int>(roll[i]), static_cast<int>(pitch[i]), static_cast<int>(yaw[i]) };
+				wide->push_back(step);
+				StoredStep small = { static_cast<uint8_t>(step.roll), static_cast<uint8_t>(step.pitch),
+					static_cast<uint8_t>(step.yaw) };
+				packed.push_back(small);
+			}
+			scattered["exercise" + std::to_string(t)] = wide;
+			// What else a gesture allocates alongside its steps: envelopes, keyframes, orientations.
+			neighbours.push_back(new std::vector<char>(64 + random() % 2048));
+			runs.push_back(arena.add(&packed[0], static_cast<int>(packed.size())));
+			steps += packed.size();
+		}
+		std::vector<IntStep> asked(queries);
+		for (int q = 0; q < queries; q++)
+		{
+			asked[q].roll = static_cast<int>(random() % (EulerQuantizer::bins + 1));
+			asked[q].pitch = static_cast<int>(random() % (EulerQuantizer::bins + 1));
+			asked[q].yaw = static_cast<int>(random() % (EulerQuantizer::bins + 1));
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		size_t wideHits = 0;
+		for (int q = 0; q < queries; q++)
+		{
+			const IntStep& live = asked[q];
+			for (std::map<std::string, std::vector<IntStep>*>::const_iterator it = scattered.begin();
+				it != scattered.end(); ++it)
+			{
+				const std::vector<IntStep>& wide = *it->second;
+				for (size_t i = 0; i < wide.size(); i++)
+				{
+					wideHits += std::abs(wide[i].roll - live.roll) <= tolerance &&
+						std::abs(wide[i].pitch - live.pitch) <= tolerance &&
+						std::abs(wide[i].yaw - live.yaw) <= tolerance;
+				}
+			}
+		}
+		double wideMs = elapsedMs(start);
+
+		start = std::chrono::steady_clock::now();
+		size_t packedHits = 0;
+		for (int q = 0; q < queries; q++)
+		{
+			const IntStep& live = asked[q];
+			for (int t = 0; t < templates; t++)
+			{
+				const StoredStep* packed = arena.steps(runs[t]);
+				int count = arena.count(runs[t]);
+				for (int i = 0; i < count; i++)
+				{
+					packedHits += std::abs(packed[i].roll - live.roll) <= tolerance &&
+						std::abs(packed[i].pitch - live.pitch) <= tolerance &&
+						std::abs(packed[i].yaw - live.yaw) <= tolerance;
+				}
+			}
+		}
+		double packedMs = elapsedMs(start);
+		mismatches += wideHits != packedHits;
+
+		std::cout << "arena: " << templates << " templates, " << steps << " steps: ints "
+			<< steps * sizeof(IntStep) / 1024 << " KiB in " << templates << " allocations, arena " << arena.bytes() / 1024 << " KiB\n"
+			<< "  scan " << steps * queries / (wideMs * 1e3) << " M steps/s against "
+			<< steps * queries / (packedMs * 1e3) << " M steps/s, " << wideMs / packedMs << "x" << std::endl;
+
+		for (std::map<std::string, std::vector<IntStep>*>::const_iterator it = scattered.begin(); it != scattered.end();
+			++it)
+		{
+			delete it->second;
+		}
+		for (size_t i = 0; i < neighbours.size(); i++)
+		{
+			delete neighbours[i];
+		}
+	}
+
+	// Replacing templates at random, which frees runs, reuses their numbers and compacts the block now and then.
+	TemplateArena<StoredStep> arena;
+	std::vector<std::vector<StoredStep> > expected;
+	std::vector<int> runs;
+	for (int round = 0; round < 5000; round++)
+	{
+		std::vector<StoredStep> steps(random() % 300);
+		for (size_t i = 0; i < steps.size(); i++)
+		{
+			StoredStep step = { static_cast<uint8_t>(random()), static_cast<uint8_t>(random()),
+				static_cast<uint8_t>(random()) };
+			steps[i] = step;
+		}
+		if (runs.size() < 50)
+		{
+			runs.push_back(arena.add(steps.empty() ? 0 : &steps[0], static_cast<int>(steps.size())));
+			expected.push_back(steps);
+		}
+		else
+		{
+			size_t replaced = random() % runs.size();
+			arena.release(runs[replaced]);
+			runs[replaced] = arena.add(steps.empty() ? 0 : &steps[0], static_cast<int>(steps.size()));
+			expected[replaced] = steps;
+		}
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			mismatches += arena.count(runs[r]) != static_cast<int>(expected[r].size()) ||
+				reinterpret_cast<uintptr_t>(arena.steps(runs[r])) % TemplateArena<StoredStep>::ALIGNMENT != 0 ||
+				(!expected[r].empty() && std::memcmp(arena.steps(runs[r]), &expected[r][0],
+				expected[r].size() * sizeof(StoredStep)) != 0);
+		}
+	}
+	std::cout << "  " << mismatches << " mismatches, " << arena.bytes() / 1024 << " KiB in use for 50 templates"
+		<< std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+inline int runBenchmark(const std::string& name)
+{
+	if (name == "euler")
+	{
+		return benchmarkEuler();
+	}
+	if (name == "emg")
+	{
+		return benchmarkEmg();
+	}
+	if (name == "dtw")
+	{
+		return benchmarkDtw();
+	}
+	if (name == "shiftand")
+	{
+		return benchmarkShiftAnd();
+	}
+	if (name == "library")
+	{
+		return benchmarkLibrary();
+	}
+	if (name == "lb")
+	{
+		return benchmarkLowerBound();
+	}
+	if (name == "quaternion")
+	{
+		return benchmarkQuaternion();
+	}
+	if (name == "dba")
+	{
+		return benchmarkDba();
+	}
+	if (name == "keyframes")
+	{
+		return benchmarkKeyframes();
+	}
+	if (name == "threads")
+	{
+		return benchmarkThreads();
+	}
+	if (name == "libraryfile")
+	{
+		return benchmarkLibraryFile();
+	}
+	if (name == "json")
+	{
+		return benchmarkJson();
+	}
+	if (name == "sessionlog")
+	{
+		return benchmarkSessionLog();
+	}
+	if (name == "codec")
+	{
+		return benchmarkCodec();
+	}
+	if (name == "arena")
+	{
+		return benchmarkArena();
+	}
+	std::cerr << "Unknown benchmark " << name << "; available: euler, emg, dtw, shiftand, library, lb, quaternion, "
+		"dba, keyframes, threads, libraryfile, json, sessionlog, codec, arena" << std::endl;
+	return 2;
+}
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,295 @@
+#ifndef DBA_H
+#define DBA_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// DTW Barycenter Averaging (Petitjean, Ketterlin and Gancarski, "A global averaging method for dynamic time warping",
+// 2011): merges several recordings of one exercise into a single template. Starting from the recording closest to
+// all the others, each round aligns every recording to the current average with DTW and moves each average step to
+// the mean of the samples aligned to it. That never increases the total squared alignment cost, so a few rounds
+// settle it. The spread of the samples aligned to each step is kept as its variance, which tells how precisely the
+// therapist repeated that part of the movement.
+//
+// The alignment here is the unbanded textbook DTW with a squared Euclidean cost, the cost the mean minimizes. It
+// keeps the whole matrix to trace the path back, which is fine for a handful of recordings of a few hundred steps;
+// matching uses the banded, two-row DtwMatcher.
+
+// An averaged template: per-step means and variances of roll, pitch and yaw, in buckets.
+struct AveragedTemplate
+{
+	std::vector<float> roll, pitch, yaw;
+	std::vector<float> varianceRoll, variancePitch, varianceYaw;
+
+	// Rounds run, and the total squared alignment cost of the recordings against the result.
+	int rounds;
+	float cost;
+
+	AveragedTemplate()
+		: rounds(0), cost(0)
+	{
+	}
+
+	int length() const
+	{
+		return static_cast<int>(roll.size());
+	}
+};
+
+class DbaAverager
+{
+public:
+	explicit DbaAverager(int maxRounds = 10)
+		: maxRounds(maxRounds)
+	{
+	}
+
+	void clear()
+	{
+		recordings.clear();
+	}
+
+	// Adds one recording, as bucket columns. Empty recordings are ignored.
+	void add(const float* roll, const float* pitch, const float* yaw, int steps)
+	{
+		if (steps == 0)
+		{
+			return;
+		}
+		Columns recording;
+		recording.roll.assign(roll, roll + steps);
+		recording.pitch.assign(pitch, pitch + steps);
+		recording.yaw.assign(yaw, yaw + steps);
+		recordings.push_back(recording);
+	}
+
+	int size() const
+	{
+		return static_cast<int>(recordings.size());
+	}
+
+	// The total squared DTW alignment cost of every recording against the given columns.
+	float cost(const float* roll, const float* pitch, const float* yaw, int steps)
+	{
+		Columns columns;
+		columns.roll.assign(roll, roll + steps);
+		columns.pitch.assign(pitch, pitch + steps);
+		columns.yaw.assign(yaw, yaw + steps);
+		float total = 0;
+		for (size_t r = 0; r < recordings.size(); r++)
+		{
+			total += align(columns, recordings[r], 0);
+		}
+		return total;
+	}
+
+	// The index of the medoid, the recording with the least total cost against all the others, which is where the
+	// averaging starts. -1 without recordings.
+	int medoid()
+	{
+		int best = -1;
+		float bestCost = std::numeric_limits<float>::infinity();
+		for (size_t m = 0; m < recordings.size(); m++)
+		{
+			float total = 0;
+			for (size_t r = 0; r < recordings.size() && total < bestCost; r++)
+			{
+				if (r != m)
+				{
+					total += align(recordings[m], recordings[r], 0);
+				}
+			}
+			if (total < bestCost)
+			{
+				bestCost = total;
+				best = static_cast<int>(m);
+			}
+		}
+		return best;
+	}
+
+	// Averages the recordings into out. Returns false, leaving out empty, if there are none.
+	bool average(AveragedTemplate& out)
+	{
+		out = AveragedTemplate();
+		int start = medoid();
+		if (start < 0)
+		{
+			return false;
+		}
+
+		Columns current = recordings[start];
+		int n = static_cast<int>(current.roll.size());
+		float previous = std::numeric_limits<float>::infinity();
+		Sums sums;
+		for (int round = 0; round < maxRounds; round++)
+		{
+			sums.reset(n);
+			float total = 0;
+			for (size_t r = 0; r < recordings.size(); r++)
+			{
+				total += align(current, recordings[r], &sums);
+			}
+			out.rounds = round + 1;
+			out.cost = total;
+
+			for (int i = 0; i < n; i++)
+			{
+				// Every average step has at least one sample aligned to it, since a DTW path visits every row.
+				current.roll[i] = sums.roll[i] / sums.count[i];
+				current.pitch[i] = sums.pitch[i] / sums.count[i];
+				current.yaw[i] = sums.yaw[i] / sums.count[i];
+			}
+			if (total >= previous * (1 - 1e-4f))
+			{
+				break;
+			}
+			previous = total;
+		}
+
+		// The variances come from the last alignment, the one the final means were taken over.
+		out.roll = current.roll;
+		out.pitch = current.pitch;
+		out.yaw = current.yaw;
+		out.varianceRoll.resize(n);
+		out.variancePitch.resize(n);
+		out.varianceYaw.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			out.varianceRoll[i] = variance(sums.squaresRoll[i], sums.count[i], current.roll[i]);
+			out.variancePitch[i] = variance(sums.squaresPitch[i], sums.count[i], current.pitch[i]);
+			out.varianceYaw[i] = variance(sums.squaresYaw[i], sums.count[i], current.yaw[i]);
+		}
+		return true;
+	}
+
+private:
+	struct Columns
+	{
+		std::vector<float> roll, pitch, yaw;
+	};
+
+	// For each average step, the count, sum and sum of squares of the samples aligned to it.
+	struct Sums
+	{
+		std::vector<float> count;
+		std::vector<float> roll, pitch, yaw;
+		std::vector<float> squaresRoll, squaresPitch, squaresYaw;
+
+		void reset(int n)
+		{
+			count.assign(n, 0.0f);
+			roll.assign(n, 0.0f);
+			pitch.assign(n, 0.0f);
+			yaw.assign(n, 0.0f);
+			squaresRoll.assign(n, 0.0f);
+			squaresPitch.assign(n, 0.0f);
+			squaresYaw.assign(n, 0.0f);
+		}
+	};
+
+	// DTW between average and recording. With sums, also traces the optimal path back and adds each recording sample
+	// to the average step it is aligned with. Returns the path's total squared cost.
+	float align(const Columns& average, const Columns& recording, Sums* sums)
+	{
+		int n = static_cast<int>(average.roll.size());
+		int m = static_cast<int>(recording.roll.size());
+		matrix.resize(static_cast<size_t>(n) * m);
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = 0; j < m; j++)
+			{
+				float dr = average.roll[i] - recording.roll[j];
+				float dp = average.pitch[i] - recording.pitch[j];
+				float dy = average.yaw[i] - recording.yaw[j];
+				float best;
+				if (i == 0 && j == 0)
+				{
+					best = 0;
+				}
+				else if (i == 0)
+				{
+					best = at(0, j - 1, m);
+				}
+				else if (j == 0)
+				{
+					best = at(i - 1, 0, m);
+				}
+				else
+				{
+					best = std::min(at(i - 1, j - 1, m), std::min(at(i - 1, j, m), at(i, j - 1, m)));
+				}
+				matrix[static_cast<size_t>(i) * m + j] = best + dr * dr + dp * dp + dy * dy;
+			}
+		}
+
+		if (sums != 0)
+		{
+			int i = n - 1, j = m - 1;
+			while (true)
+			{
+				sums->count[i] += 1;
+				sums->roll[i] += recording.roll[j];
+				sums->pitch[i] += recording.pitch[j];
+				sums->yaw[i] += recording.yaw[j];
+				sums->squaresRoll[i] += recording.roll[j] * recording.roll[j];
+				sums->squaresPitch[i] += recording.pitch[j] * recording.pitch[j];
+				sums->squaresYaw[i] += recording.yaw[j] * recording.yaw[j];
+				if (i == 0 && j == 0)
+				{
+					break;
+				}
+				// Step back to whichever neighbour the cell's cost came from, preferring the diagonal on ties.
+				if (i == 0)
+				{
+					j--;
+				}
+				else if (j == 0)
+				{
+					i--;
+				}
+				else
+				{
+					float diagonal = at(i - 1, j - 1, m);
+					float up = at(i - 1, j, m);
+					float left = at(i, j - 1, m);
+					if (diagonal <= up && diagonal <= left)
+					{
+						i--;
+						j--;
+					}
+					else if (up <= left)
+					{
+						i--;
+					}
+					else
+					{
+						j--;
+					}
+				}
+			}
+		}
+		return matrix[static_cast<size_t>(n) * m - 1];
+	}
+
+	// E[x^2] - mean^2, which rounding can push slightly below zero.
+	static float variance(float squares, float count, float mean)
+	{
+		return std::max(0.0f, squares / count - mean * mean);
+	}
+
+	float at(int i, int j, int m) const
+	{
+		return matrix[static_cast<size_t>(i) * m + j];
+	}
+
+	int maxRounds;
+	std::vector<Columns> recordings;
+
+	// The cumulative cost matrix, reused between alignments.
+	std::vector<float> matrix;
+};
+
+#endif // DBA_H
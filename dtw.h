@@ -0,0 +1,159 @@
+#ifndef DTW_H
+#define DTW_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "simd.h"
+
+// Dynamic time warping between two orientation sequences, each given as roll/pitch/yaw bucket columns. Where the
+// strike matcher needs the patient to hit every template step in order at the therapist's pace, DTW finds the best
+// alignment of the two sequences, so doing the exercise slower or faster costs nothing as long as the path is right.
+//
+// The cost of aligning two samples is their Chebyshev distance, the largest bucket difference on any axis, which is
+// the same measure EulerAngle::equals() compares against TOLERANCE. Alignments are restricted to a Sakoe-Chiba band
+// around the diagonal, which bounds the cost at O(length * band) and stops pathological warps like matching the
+// whole attempt to one template step.
+//
+// Rows are the live samples and columns the template steps. Each row is filled in two passes. The first, four
+// columns at a time, takes each cell's cost plus the cheaper of the two cells above it; the second runs left to
+// right adding the cell to the left, which depends on the result just written and so can't be vectorized.
+class DtwMatcher
+{
+public:
+	// bandRadius is in template steps, measured from the diagonal once the two lengths are lined up.
+	explicit DtwMatcher(int bandRadius)
+		: bandRadius(bandRadius)
+	{
+	}
+
+	// The total cost of the cheapest banded alignment of the live sequence (n samples) with the template (m steps),
+	// or infinity if either is empty. Divide by max(n, m) for a per-step figure comparable across lengths.
+	//
+	// When only distances below abandonAbove are of interest, e.g. while looking for the nearest of many templates,
+	// scoring stops as soon as every cell of a row exceeds it, since costs only grow from there, and returns infinity.
+	float distance(const float* liveRoll, const float* livePitch, const float* liveYaw, int n,
+		const float* roll, const float* pitch, const float* yaw, int m,
+		float abandonAbove = std::numeric_limits<float>::infinity())
+	{
+		return run(liveRoll, livePitch, liveYaw, n, roll, pitch, yaw, m, true, abandonAbove);
+	}
+
+	// distance() without the vector pass, as a reference.
+	float distanceScalar(const float* liveRoll, const float* livePitch, const float* liveYaw, int n,
+		const float* roll, const float* pitch, const float* yaw, int m)
+	{
+		return run(liveRoll, livePitch, liveYaw, n, roll, pitch, yaw, m, false,
+			std::numeric_limits<float>::infinity());
+	}
+
+private:
+	float run(const float* liveRoll, const float* livePitch, const float* liveYaw, int n,
+		const float* roll, const float* pitch, const float* yaw, int m, bool vectorized, float abandonAbove)
+	{
+		const float infinity = std::numeric_limits<float>::infinity();
+		if (n == 0 || m == 0)
+		{
+			return infinity;
+		}
+
+		// Column j of the matrix lives at index j + 1; index 0 is the boundary before the first template step. The
+		// buffers only grow, so scoring the same sizes again doesn't allocate.
+		previous.assign(m + 1, infinity);
+		current.assign(m + 1, infinity);
+		cost.resize(m + 1);
+		previous[0] = 0;
+
+		// With unequal lengths the diagonal has slope m / n, so the band has to be at least that wide for
+		// consecutive rows to overlap.
+		int radius = std::max(bandRadius, (m + n - 1) / n);
+
+		// The index range of each buffer that may hold something other than infinity.
+		int previousFirst = 0, previousLast = 0;
+		int currentFirst = 1, currentLast = 0;
+		for (int i = 0; i < n; i++)
+		{
+			int center = n > 1 ? static_cast<int>(static_cast<long long>(i) * (m - 1) / (n - 1)) : m - 1;
+			int low = std::max(0, center - radius);
+			int high = std::min(m - 1, center + radius);
+
+			// Whatever this buffer held two rows ago is outside the band now, or about to be overwritten.
+			std::fill(current.begin() + currentFirst, current.begin() + currentLast + 1, infinity);
+
+			if (vectorized)
+			{
+				diagonalAndAbove(liveRoll[i], livePitch[i], liveYaw[i], roll, pitch, yaw, low, high);
+			}
+			else
+			{
+				diagonalAndAboveScalar(liveRoll[i], livePitch[i], liveYaw[i], roll, pitch, yaw, low, high);
+			}
+
+			// The left neighbour, in order. current[low] is outside the band and so infinite.
+			float rowMinimum = infinity;
+			for (int j = low; j <= high; j++)
+			{
+				current[j + 1] = std::min(current[j + 1], cost[j + 1] + current[j]);
+				rowMinimum = std::min(rowMinimum, current[j + 1]);
+			}
+			if (rowMinimum > abandonAbove)
+			{
+				return infinity;
+			}
+
+			previous.swap(current);
+			currentFirst = previousFirst;
+			currentLast = previousLast;
+			previousFirst = low + 1;
+			previousLast = high + 1;
+		}
+		return previous[m];
+	}
+
+	// cost[j + 1] = cost of (sample, step j); current[j + 1] = cost + min(previous[j + 1], previous[j]).
+	void diagonalAndAboveScalar(float r, float p, float y, const float* roll, const float* pitch, const float* yaw,
+		int low, int high)
+	{
+		for (int j = low; j <= high; j++)
+		{
+			float c = std::max(std::fabs(r - roll[j]), std::max(std::fabs(p - pitch[j]), std::fabs(y - yaw[j])));
+			cost[j + 1] = c;
+			current[j + 1] = c + std::min(previous[j + 1], previous[j]);
+		}
+	}
+
+	void diagonalAndAbove(float r, float p, float y, const float* roll, const float* pitch, const float* yaw,
+		int low, int high)
+	{
+		int j = low;
+#ifdef MYO_SSE2
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		const __m128 vr = _mm_set1_ps(r);
+		const __m128 vp = _mm_set1_ps(p);
+		const __m128 vy = _mm_set1_ps(y);
+		for (; j + 4 <= high + 1; j += 4)
+		{
+			__m128 dr = _mm_andnot_ps(signBit, _mm_sub_ps(vr, _mm_loadu_ps(roll + j)));
+			__m128 dp = _mm_andnot_ps(signBit, _mm_sub_ps(vp, _mm_loadu_ps(pitch + j)));
+			__m128 dy = _mm_andnot_ps(signBit, _mm_sub_ps(vy, _mm_loadu_ps(yaw + j)));
+			__m128 c = _mm_max_ps(dr, _mm_max_ps(dp, dy));
+			__m128 above = _mm_min_ps(_mm_loadu_ps(&previous[j + 1]), _mm_loadu_ps(&previous[j]));
+			_mm_storeu_ps(&cost[j + 1], c);
+			_mm_storeu_ps(&current[j + 1], _mm_add_ps(c, above));
+		}
+#endif
+		if (j <= high)
+		{
+			diagonalAndAboveScalar(r, p, y, roll, pitch, yaw, j, high);
+		}
+	}
+
+	int bandRadius;
+	std::vector<float> previous;
+	std::vector<float> current;
+	std::vector<float> cost;
+};
+
+#endif // DTW_H
@@ -0,0 +1,215 @@
+#ifndef EMG_H
+#define EMG_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "simd.h"
+
+// The Myo streams 8 channels of signed 8-bit EMG at 200 Hz.
+const int EMG_CHANNELS = 8;
+
+// Windowed features for every channel, as of the newest sample.
+struct EmgFeatures
+{
+	uint64_t timestamp;
+	float rms[EMG_CHANNELS];
+	float mav[EMG_CHANNELS];
+	int zeroCrossings[EMG_CHANNELS];
+
+	// Mean RMS across channels, scaled to 0-1.
+	float activation() const
+	{
+		float sum = 0;
+		for (int c = 0; c < EMG_CHANNELS; c++)
+		{
+			sum += rms[c];
+		}
+		return sum / (EMG_CHANNELS * 128.0f);
+	}
+};
+
+// Sliding window over the last Window EMG frames with running sums for root-mean-square, mean absolute value and
+// zero-crossing count. Each push() adds the new frame and retires the oldest one, so the cost per sample is constant
+// no matter how long the window is, and all 8 channels are updated together in SSE2 lanes.
+//
+// Each channel is its own ring, stored as one lane of a frame-major buffer so a whole frame loads as one vector.
+// Everything is preallocated; push() never allocates.
+template <int Window>
+class EmgWindow
+{
+	static_assert(Window > 1 && Window <= 255, "EmgWindow keeps its absolute-value sums in 16 bits");
+
+public:
+	// A zero crossing only counts if the signal moves by at least threshold, so noise around 0 doesn't register.
+	explicit EmgWindow(int threshold = 4)
+		: threshold(threshold)
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		std::memset(frames, 0, sizeof(frames));
+		std::memset(sumSquares, 0, sizeof(sumSquares));
+		std::memset(sumAbs, 0, sizeof(sumAbs));
+		std::memset(crossings, 0, sizeof(crossings));
+		next = 0;
+		count = 0;
+	}
+
+	void push(const int8_t* emg)
+	{
+		const int8_t* incoming = emg;
+		const int8_t* previous = frames[(next + Window - 1) % Window];
+		const int8_t* outgoing = frames[next];
+		const int8_t* afterOutgoing = frames[(next + 1) % Window];
+		bool full = count == Window;
+
+#ifdef MYO_SSE2
+		__m128i in = load(incoming);
+		__m128i prev = load(previous);
+		__m128i addSq = _mm_mullo_epi16(in, in);
+		__m128i addAbs = abs16(in);
+		__m128i addZc = count > 0 ? crossing(prev, in) : _mm_setzero_si128();
+
+		__m128i subSq = _mm_setzero_si128();
+		__m128i subAbs = _mm_setzero_si128();
+		__m128i subZc = _mm_setzero_si128();
+		if (full)
+		{
+			__m128i out = load(outgoing);
+			subSq = _mm_mullo_epi16(out, out);
+			subAbs = abs16(out);
+			subZc = crossing(out, load(afterOutgoing));
+		}
+
+		// Squares of 8-bit values fit in 16 bits, but their sums need 32.
+		__m128i sq = _mm_load_si128(reinterpret_cast<const __m128i*>(sumSquares));
+		__m128i sqHigh = _mm_load_si128(reinterpret_cast<const __m128i*>(sumSquares + 4));
+		sq = _mm_sub_epi32(_mm_add_epi32(sq, widenLow(addSq)), widenLow(subSq));
+		sqHigh = _mm_sub_epi32(_mm_add_epi32(sqHigh, widenHigh(addSq)), widenHigh(subSq));
+		_mm_store_si128(reinterpret_cast<__m128i*>(sumSquares), sq);
+		_mm_store_si128(reinterpret_cast<__m128i*>(sumSquares + 4), sqHigh);
+
+		__m128i abs = _mm_load_si128(reinterpret_cast<const __m128i*>(sumAbs));
+		abs = _mm_sub_epi16(_mm_add_epi16(abs, addAbs), subAbs);
+		_mm_store_si128(reinterpret_cast<__m128i*>(sumAbs), abs);
+
+		// crossing() yields -1 for each lane that crossed, hence the reversed add/sub.
+		__m128i zc = _mm_load_si128(reinterpret_cast<const __m128i*>(crossings));
+		zc = _mm_add_epi16(_mm_sub_epi16(zc, addZc), subZc);
+		_mm_store_si128(reinterpret_cast<__m128i*>(crossings), zc);
+#else
+		for (int c = 0; c < EMG_CHANNELS; c++)
+		{
+			int in = incoming[c];
+			sumSquares[c] += in * in;
+			sumAbs[c] += static_cast<int16_t>(std::abs(in));
+			if (count > 0)
+			{
+				crossings[c] += static_cast<int16_t>(crossing(previous[c], in));
+			}
+			if (full)
+			{
+				int out = outgoing[c];
+				sumSquares[c] -= out * out;
+				sumAbs[c] -= static_cast<int16_t>(std::abs(out));
+				crossings[c] -= static_cast<int16_t>(crossing(out, afterOutgoing[c]));
+			}
+		}
+#endif
+
+		std::memcpy(frames[next], incoming, EMG_CHANNELS);
+		next = (next + 1) % Window;
+		if (!full)
+		{
+			count++;
+		}
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	void features(uint64_t timestamp, EmgFeatures& out) const
+	{
+		out.timestamp = timestamp;
+		float n = count > 0 ? static_cast<float>(count) : 1.0f;
+#ifdef MYO_SSE2
+		__m128 inv = _mm_set1_ps(1.0f / n);
+		for (int c = 0; c < EMG_CHANNELS; c += 4)
+		{
+			__m128 sq = _mm_cvtepi32_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(sumSquares + c)));
+			_mm_storeu_ps(out.rms + c, _mm_sqrt_ps(_mm_mul_ps(sq, inv)));
+		}
+		__m128i abs = _mm_load_si128(reinterpret_cast<const __m128i*>(sumAbs));
+		_mm_storeu_ps(out.mav, _mm_mul_ps(_mm_cvtepi32_ps(widenLow(abs)), inv));
+		_mm_storeu_ps(out.mav + 4, _mm_mul_ps(_mm_cvtepi32_ps(widenHigh(abs)), inv));
+		for (int c = 0; c < EMG_CHANNELS; c++)
+		{
+			out.zeroCrossings[c] = crossings[c];
+		}
+#else
+		for (int c = 0; c < EMG_CHANNELS; c++)
+		{
+			out.rms[c] = std::sqrt(sumSquares[c] / n);
+			out.mav[c] = sumAbs[c] / n;
+			out.zeroCrossings[c] = crossings[c];
+		}
+#endif
+	}
+
+private:
+#ifdef MYO_SSE2
+	// Sign-extends the 8 channels of a frame to 16-bit lanes.
+	static __m128i load(const int8_t* frame)
+	{
+		__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(frame));
+		return _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+	}
+
+	static __m128i abs16(__m128i v)
+	{
+		__m128i sign = _mm_srai_epi16(v, 15);
+		return _mm_sub_epi16(_mm_xor_si128(v, sign), sign);
+	}
+
+	static __m128i widenLow(__m128i v)
+	{
+		return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+	}
+
+	static __m128i widenHigh(__m128i v)
+	{
+		return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+	}
+
+	// All ones in each lane where a and b have opposite signs and differ by at least the threshold.
+	__m128i crossing(__m128i a, __m128i b) const
+	{
+		__m128i opposite = _mm_cmplt_epi16(_mm_mullo_epi16(a, b), _mm_setzero_si128());
+		__m128i large = _mm_cmpgt_epi16(abs16(_mm_sub_epi16(a, b)), _mm_set1_epi16(static_cast<short>(threshold - 1)));
+		return _mm_and_si128(opposite, large);
+	}
+#else
+	int crossing(int a, int b) const
+	{
+		return (a * b < 0 && std::abs(a - b) >= threshold) ? 1 : 0;
+	}
+#endif
+
+	// Frame-major ring of the last Window frames; frames[next] is the oldest once the window is full.
+	int8_t frames[Window][EMG_CHANNELS];
+	alignas(16) int32_t sumSquares[EMG_CHANNELS];
+	alignas(16) int16_t sumAbs[EMG_CHANNELS];
+	alignas(16) int16_t crossings[EMG_CHANNELS];
+	int next;
+	int count;
+	int threshold;
+};
+
+#endif // EMG_H
@@ -1,7 +1,12 @@
 // Copyright (C) 2013-2014 Thalmic Labs Inc.
 // Distributed under the Myo SDK license agreement. See LICENSE.txt for details.
 #define _USE_MATH_DEFINES
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
@@ -11,139 +16,452 @@
 #include <time.h>
 #include <map>
 
+// Define MYO_SIMULATOR to build without the Myo SDK; only the replay and synthetic sources are available then.
+#ifndef MYO_SIMULATOR
 // The only file that needs to be included to use the Myo C++ SDK is myo.hpp.
 #include <myo/myo.hpp>
+#include "myosource.h"
+#endif
+
+#include "benchmarks.h"
+#include "dba.h"
+#include "dtw.h"
+#include "emg.h"
+#include "hubpump.h"
+#include "json.h"
+#include "keyframes.h"
+#include "libraryfile.h"
+#include "librarymatcher.h"
+#include "lowerbound.h"
+#include "orientation.h"
+#include "quatmatcher.h"
+#include "rawcapture.h"
+#include "resampler.h"
+#include "samplefilter.h"
+#include "samplering.h"
+#include "samplesource.h"
+#include "sessionarchive.h"
+#include "sessionlog.h"
+#include "shiftand.h"
+#include "simulatedsource.h"
+#include "spring.h"
+#include "streamcodec.h"
+#include "templatearena.h"
+#include "threadpool.h"
 
 //Constants
+// How often the hub pump thread returns from hub->run() to check whether it should stop. Samples are dispatched as
+// they arrive, so this no longer affects feedback latency.
 int FREQUENCY = 10;
-int TOLERANCE = 2;
+// How far, in buckets, a sample may be from a template step and still match it. Tuned at 18 buckets per axis and
+// scaled to whatever EULER_BINS the build uses.
+const int TOLERANCE = EulerQuantizer::scale(2);
 int MAX_STRIKES = 2;
 
-// Classes that inherit from myo::DeviceListener can be used to receive events from Myo devices. DeviceListener
-// provides several virtual functions for handling different kinds of events. If you do not override an event, the
-// default behavior is to do nothing.
-class DataCollector : public myo::DeviceListener {
-public:
+// A template averaged from several takes gives each step its own tolerance: TOLERANCE_SIGMAS standard deviations of
+// the takes around that step, but never tighter than TOLERANCE or looser than MAX_TOLERANCE.
+const float TOLERANCE_SIGMAS = 2.0f;
+const int MAX_TOLERANCE = EulerQuantizer::scale(4);
+
+// How GestureListener decides a rep is done. matchStrikes walks the template one step at a time and starts over
+// after MAX_STRIKES misses. matchDtw waits for the arm to reach the template's last step and then scores the attempt
+// as a whole with dynamic time warping, so the pace doesn't matter. matchSpring watches the whole set of reps as one
+// continuous stream and picks out each rep as it ends, so the patient never has to start over. matchQuaternion
+// follows the same strike rules as matchStrikes, but compares the raw orientation instead of Euler buckets, so it
+// doesn't miss matches near pitch +-90 degrees or where yaw wraps. It also skips quantizing, and costs less per sample
+// than the cell masks do (--bench quaternion).
+enum MatchMode
+{
+	matchStrikes,
+	matchDtw,
+	matchSpring,
+	matchQuaternion
+};
+
+// DTW alignments may stray this many template steps from the diagonal. An attempt passes if its cost per step is
+// within DTW_TOLERANCE buckets, and is scored over at most DTW_WINDOW times the template's length of recent samples.
+const int DTW_BAND = 8;
+const float DTW_TOLERANCE = static_cast<float>(TOLERANCE);
+const int DTW_WINDOW = 2;
+
+// In matchQuaternion mode a sample matches a step if the rotation between them is at most this many degrees. About
+// the reach of TOLERANCE's two 20-degree buckets, but the same in every direction.
+const float QUATERNION_TOLERANCE_DEGREES = 40.0f;
+
+// "Which exercise is this?" lookups compare whole attempts against the library with DTW, after resampling both to
+// LOOKUP_LENGTH steps so lower bounds can prune most of the library. See lowerbound.h.
+const int LOOKUP_LENGTH = 32;
+const int LOOKUP_BAND = 3;
+
+// matchSpring follows a template compressed to keyframes (see keyframes.h) instead of every step, kept within
+// KEYFRAME_ERROR buckets of every recorded step. It has to be a whole bucket to pay: at half a bucket only exact
+// straight runs merge, about 3 steps to a keyframe, and the segment rows cost nearly what the steps they replace do
+// (375 against 400 ns a sample in --bench keyframes); at one bucket it is about 7 steps to a keyframe and 143 against
+// 343 ns, with every rep still found. That is half of TOLERANCE, so what it rounds off a template can't turn a match
+// into a miss.
+const float KEYFRAME_ERROR = 1.0f;
+
+// Saved gestures are kept in this library file between runs (see libraryfile.h), unless "--library" names another.
+const char* const LIBRARY_PATH = "gestures.myolib";
+
+// Every session's raw stream is appended to this log (see sessionlog.h), unless "--log" names another.
+const char* const SESSION_LOG_PATH = "sessions.myolog";
+
+// In matchSpring mode a rep is normally confirmed by the movement that follows it. If the arm stays still at the
+// template's end position for this long instead, the best rep so far is taken as final.
+const int SPRING_SETTLE_MS = 500;
+
+// Orientation is resampled to this rate, on the armband's clock, before anything consumes it. 50 Hz is the Myo's
+// own IMU rate, so live samples are mostly just realigned rather than invented.
+const unsigned int RESAMPLE_HZ = 50;
+
+// One step of the resampled orientation stream: the quaternion, quantized the same way print() shows it, together
+// with the pose that was active at that moment and the muscle activation (0-1, from EMG).
+struct Sample
+{
+	uint64_t timestamp;
+	Quat quat;
+	int roll;
+	int pitch;
+	int yaw;
+	PoseType pose;
+	float activation;
+};
+
+// Orientation arrives at roughly 50 Hz, so this holds a few seconds of samples.
+const size_t SAMPLE_RING_SIZE = 256;
+
+// EMG arrives at 200 Hz. Features are taken over a 200 ms window and published 20 times a second.
+const int EMG_WINDOW = 40;
+const int EMG_FEATURE_STRIDE = 10;
+
+// Orientation changes of up to this many buckets only count once the arm has held the new position for
+// FILTER_HOLD_STEPS resampled steps (60 ms at 50 Hz). Anything bigger counts immediately.
+const int FILTER_DEAD_BAND = EulerQuantizer::scale(1);
+const int FILTER_HOLD_STEPS = 3;
+
+// Up to this many armbands can be used at once, e.g. one on each arm for bilateral exercises.
+const int MAX_DEVICES = 4;
+
+// Everything DataCollector knows about one armband. Each device gets its own sample ring and signal, so consumers of
+// one armband never wait on, or get woken by, another.
+struct DeviceState
+{
+	DeviceState()
+		: seen(false), onArm(false), whichArm(sideUnknown), isUnlocked(false), roll_w(0), pitch_w(0), yaw_w(0),
+		currentPose(poseUnknown), timestamp(0), resampler(RESAMPLE_HZ), filter(FILTER_DEAD_BAND, FILTER_HOLD_STEPS),
+		filterReset(false), activation(0), emgCount(0), capture(0)
+	{
+	}
+
+	// Consumer side. Drops anything queued so far and has the producer pass the very next sample regardless of the
+	// filter, so a new recording or attempt starts from where the arm is now.
+	void restartStream()
+	{
+		samples.clear();
+		filterReset = true;
+	}
+
+	// Blocks the calling (consumer) thread until at least one sample is queued, or timeoutMs has passed.
+	void waitForSamples(unsigned int timeoutMs)
+	{
+		uint64_t ticket = signal.ticket();
+		if (!samples.empty())
+		{
+			return;
+		}
+		signal.wait(ticket, timeoutMs);
+	}
+
+	// Set once the device has sent anything at all.
+	std::atomic<bool> seen;
+
+	// These values are set by onArmSync() and onArmUnsync().
+	bool onArm;
+	ArmSide whichArm;
+
+	// This is set by onUnlocked() and onLocked().
+	bool isUnlocked;
+
+	// These values are set by onOrientationData() and onPose().
+	int roll_w, pitch_w, yaw_w;
+	PoseType currentPose;
 	uint64_t timestamp;
+
+	// Every resampled orientation step that passes the filter, in order, filled by onOrientationData() and drained by
+	// the recorder or listener.
+	Resampler resampler;
+	SampleFilter filter;
+	std::atomic<bool> filterReset;
+	SampleRing<Sample, SAMPLE_RING_SIZE> samples;
+	SampleSignal signal;
+
+	// Windowed EMG features, published every EMG_FEATURE_STRIDE samples. activation is the newest overall level.
+	EmgWindow<EMG_WINDOW> emgWindow;
+	SampleRing<EmgFeatures, SAMPLE_RING_SIZE> emgFeatures;
+	float activation;
+	uint64_t emgCount;
+
+	// When set, every raw quaternion, accelerometer and gyroscope sample is also stored at full resolution.
+	RawCapture* capture;
+};
+
+// Classes that inherit from SampleListener can be used to receive events from a SampleSource, whether that is a Myo
+// or a simulation. SampleListener provides several virtual functions for handling different kinds of events. If you
+// do not override an event, the default behavior is to do nothing.
+//
+// Every event carries the device it came from and only touches that device's DeviceState. The states are allocated
+// up front, so the callbacks never allocate or lock.
+class DataCollector : public SampleListener {
+public:
 	DataCollector()
-		: onArm(false), isUnlocked(false), roll_w(0), pitch_w(0), yaw_w(0), currentPose()
+		: log(0)
+	{
+		for (int i = 0; i < MAX_DEVICES; i++)
+		{
+			devices[i] = new DeviceState();
+		}
+	}
+
+	~DataCollector()
+	{
+		for (int i = 0; i < MAX_DEVICES; i++)
+		{
+			delete devices[i];
+		}
+	}
+
+	// Every device's raw stream is also appended to log when one is set. It is only set before the source starts.
+	void setLog(SessionLog* log)
+	{
+		this->log = log;
+	}
+
+	// The state of one armband, or null if the index is beyond MAX_DEVICES.
+	DeviceState* device(int index)
+	{
+		return index >= 0 && index < MAX_DEVICES ? devices[index] : 0;
+	}
+
+	// How many armbands have sent anything so far. Devices are numbered in the order they were first seen.
+	int deviceCount()
 	{
+		int count = 0;
+		while (count < MAX_DEVICES && devices[count]->seen.load())
+		{
+			count++;
+		}
+		return count;
 	}
 
 	// onUnpair() is called whenever the Myo is disconnected from Myo Connect by the user.
-	void onUnpair(myo::Myo* myo, uint64_t timestamp)
+	void onUnpair(int device, uint64_t timestamp)
 	{
+		DeviceState* state = track(device);
+		if (!state)
+		{
+			return;
+		}
+
 		// We've lost a Myo.
 		// Let's clean up some leftover state.
-		roll_w = 0;
-		pitch_w = 0;
-		yaw_w = 0;
-		onArm = false;
-		isUnlocked = false;
+		state->roll_w = 0;
+		state->pitch_w = 0;
+		state->yaw_w = 0;
+		state->onArm = false;
+		state->isUnlocked = false;
+		state->resampler.reset();
 	}
 
 	// onOrientationData() is called whenever the Myo device provides its current orientation, which is represented
 	// as a unit quaternion.
-	void onOrientationData(myo::Myo* myo, uint64_t timestamp, const myo::Quaternion<float>& quat)
+	void onOrientationData(int device, uint64_t timestamp, const Quat& quat)
 	{
-		using std::atan2;
-		using std::asin;
-		using std::sqrt;
-		using std::max;
-		using std::min;
+		DeviceState* state = track(device);
+		if (!state)
+		{
+			return;
+		}
+
+		if (state->capture)
+		{
+			state->capture->addOrientation(timestamp, quat);
+		}
+		if (log)
+		{
+			log->orientation(device, timestamp, quat, state->currentPose, !state->isUnlocked);
+		}
+
+		state->timestamp = timestamp;
+		if (state->filterReset.exchange(false))
+		{
+			state->filter.reset();
+		}
 
-		// Calculate Euler angles (roll, pitch, and yaw) from the unit quaternion.
-		float roll = atan2(2.0f * (quat.w() * quat.x() + quat.y() * quat.z()),
-			1.0f - 2.0f * (quat.x() * quat.x() + quat.y() * quat.y()));
-		float pitch = asin(max(-1.0f, min(1.0f, 2.0f * (quat.w() * quat.y() - quat.z() * quat.x()))));
-		float yaw = atan2(2.0f * (quat.w() * quat.z() + quat.x() * quat.y()),
-			1.0f - 2.0f * (quat.y() * quat.y() + quat.z() * quat.z()));
+		// Queue every resampled step that changes something, so consumers see the whole stream, at a fixed rate, not
+		// just whatever is current when they look.
+		state->resampler.push(timestamp, quat, [state](uint64_t stepTimestamp, const Quat& stepQuat)
+		{
+			// Convert the unit quaternion to Euler angles on a scale from 0 to EULER_BINS.
+			quantizeOrientation(stepQuat, state->roll_w, state->pitch_w, state->yaw_w);
+			if (!state->filter.accept(state->roll_w, state->pitch_w, state->yaw_w, state->currentPose))
+			{
+				return;
+			}
 
-		// Convert the floating point angles in radians to a scale from 0 to 18.
-		roll_w = static_cast<int>((roll + (float)M_PI) / (M_PI * 2.0f) * 18);
-		pitch_w = static_cast<int>((pitch + (float)M_PI / 2.0f) / M_PI * 18);
-		yaw_w = static_cast<int>((yaw + (float)M_PI) / (M_PI * 2.0f) * 18);
-		this->timestamp = timestamp;
+			Sample sample;
+			sample.timestamp = stepTimestamp;
+			sample.quat = stepQuat;
+			sample.roll = state->roll_w;
+			sample.pitch = state->pitch_w;
+			sample.yaw = state->yaw_w;
+			sample.pose = state->currentPose;
+			sample.activation = state->activation;
+			state->samples.push(sample);
+		});
+		state->signal.notify();
 	}
 
 	// onPose() is called whenever the Myo detects that the person wearing it has changed their pose, for example,
-	// making a fist, or not making a fist anymore.
-	void onPose(myo::Myo* myo, uint64_t timestamp, myo::Pose pose)
+	// making a fist, or not making a fist anymore. Keeping the Myo unlocked while a pose is held is handled by
+	// MyoSource.
+	void onPose(int device, uint64_t timestamp, PoseType pose)
 	{
-		currentPose = pose;
-
-		if (pose != myo::Pose::unknown && pose != myo::Pose::rest) {
-			// Tell the Myo to stay unlocked until told otherwise. We do that here so you can hold the poses without the
-			// Myo becoming locked.
-			myo->unlock(myo::Myo::unlockHold);
-
-			// Notify the Myo that the pose has resulted in an action, in this case changing
-			// the text on the screen. The Myo will vibrate.
-			myo->notifyUserAction();
-		}
-		else {
-			// Tell the Myo to stay unlocked only for a short period. This allows the Myo to stay unlocked while poses
-			// are being performed, but lock after inactivity.
-			//myo->unlock(myo::Myo::unlockTimed);
+		DeviceState* state = track(device);
+		if (state)
+		{
+			state->currentPose = pose;
+			if (log)
+			{
+				log->pose(device, timestamp, pose);
+			}
 		}
 	}
 
 	// onArmSync() is called whenever Myo has recognized a Sync Gesture after someone has put it on their
-	// arm. This lets Myo know which arm it's on and which way it's facing.
-	void onArmSync(myo::Myo* myo, uint64_t timestamp, myo::Arm arm, myo::XDirection xDirection, float rotation,
-		myo::WarmupState warmupState)
+	// arm. This lets Myo know which arm it's on.
+	void onArmSync(int device, uint64_t timestamp, ArmSide arm)
 	{
-		onArm = true;
-		whichArm = arm;
+		DeviceState* state = track(device);
+		if (state)
+		{
+			state->onArm = true;
+			state->whichArm = arm;
+		}
 	}
 
 	// onArmUnsync() is called whenever Myo has detected that it was moved from a stable position on a person's arm after
 	// it recognized the arm. Typically this happens when someone takes Myo off of their arm, but it can also happen
 	// when Myo is moved around on the arm.
-	void onArmUnsync(myo::Myo* myo, uint64_t timestamp)
+	void onArmUnsync(int device, uint64_t timestamp)
 	{
-		onArm = false;
+		DeviceState* state = track(device);
+		if (state)
+		{
+			state->onArm = false;
+		}
 	}
 
 	// onUnlock() is called whenever Myo has become unlocked, and will start delivering pose events.
-	void onUnlock(myo::Myo* myo, uint64_t timestamp)
+	void onUnlock(int device, uint64_t timestamp)
 	{
-		isUnlocked = true;
+		DeviceState* state = track(device);
+		if (state)
+		{
+			state->isUnlocked = true;
+			if (log)
+			{
+				log->lock(device, timestamp, false);
+			}
+		}
 	}
 
 	// onLock() is called whenever Myo has become locked. No pose events will be sent until the Myo is unlocked again.
-	void onLock(myo::Myo* myo, uint64_t timestamp)
+	void onLock(int device, uint64_t timestamp)
+	{
+		DeviceState* state = track(device);
+		if (state)
+		{
+			state->isUnlocked = false;
+			if (log)
+			{
+				log->lock(device, timestamp, true);
+			}
+		}
+	}
+
+	// onAccelerometerData() and onGyroscopeData() are only needed for the full-resolution capture.
+	void onAccelerometerData(int device, uint64_t timestamp, const Vec3& accel)
+	{
+		DeviceState* state = track(device);
+		if (state && state->capture)
+		{
+			state->capture->addAccelerometer(timestamp, accel);
+		}
+	}
+
+	void onGyroscopeData(int device, uint64_t timestamp, const Vec3& gyro)
+	{
+		DeviceState* state = track(device);
+		if (state && state->capture)
+		{
+			state->capture->addGyroscope(timestamp, gyro);
+		}
+	}
+
+	// onEmgData() is called 200 times a second per device once EMG streaming is enabled. The window update is
+	// constant time and vectorized across channels, so it stays cheap on the source thread.
+	void onEmgData(int device, uint64_t timestamp, const int8_t* emg)
 	{
-		isUnlocked = false;
+		DeviceState* state = track(device);
+		if (!state)
+		{
+			return;
+		}
+
+		state->emgWindow.push(emg);
+		if (++state->emgCount % EMG_FEATURE_STRIDE == 0)
+		{
+			EmgFeatures features;
+			state->emgWindow.features(timestamp, features);
+			state->activation = features.activation();
+			state->emgFeatures.push(features);
+			state->signal.notify();
+		}
 	}
 
-	// There are other virtual functions in DeviceListener that we could override here, like onAccelerometerData().
+	// There are other virtual functions in SampleListener that we could override here, like onPair().
 	// For this example, the functions overridden above are sufficient.
 
 	// We define this function to print the current values that were updated by the on...() functions above.
-	void print()
+	void print(int index)
 	{
+		DeviceState* state = device(index);
+		if (!state)
+		{
+			return;
+		}
+
 		// Clear the current line
 		std::cout << '\r';
 
 		// Print out the orientation. Orientation data is always available, even if no arm is currently recognized.
-		/*std::cout << '[' << std::string(roll_w, '*') << std::string(18 - roll_w, ' ') << ']'
-		<< '[' << std::string(pitch_w, '*') << std::string(18 - pitch_w, ' ') << ']'
-		<< '[' << std::string(yaw_w, '*') << std::string(18 - yaw_w, ' ') << ']';*/
-		std::cout << '[' << "roll: " << roll_w << ']'
-			<< '[' << "pitch: " << pitch_w << ']'
-			<< '[' << "yaw: " << yaw_w << ']';
-
-		if (onArm) {
+		/*std::cout << '[' << std::string(state->roll_w, '*') << std::string(EulerQuantizer::bins - state->roll_w, ' ') << ']'
+		<< '[' << std::string(state->pitch_w, '*') << std::string(EulerQuantizer::bins - state->pitch_w, ' ') << ']'
+		<< '[' << std::string(state->yaw_w, '*') << std::string(EulerQuantizer::bins - state->yaw_w, ' ') << ']';*/
+		std::cout << '[' << "roll: " << state->roll_w << ']'
+			<< '[' << "pitch: " << state->pitch_w << ']'
+			<< '[' << "yaw: " << state->yaw_w << ']';
+
+		if (state->onArm) {
 			// Print out the lock state, the currently recognized pose, and which arm Myo is being worn on.
 
-			// Pose::toString() provides the human-readable name of a pose. We can also output a Pose directly to an
-			// output stream (e.g. std::cout << currentPose;). In this case we want to get the pose name's length so
-			// that we can fill the rest of the field with spaces below, so we obtain it as a string using toString().
-			std::string poseString = currentPose.toString();
+			// poseName() provides the human-readable name of a pose. We want to get the pose name's length so that we
+			// can fill the rest of the field with spaces below, so we obtain it as a string.
+			std::string poseString = poseName(state->currentPose);
 
-			std::cout << '[' << (isUnlocked ? "unlocked" : "locked  ") << ']'
-				<< '[' << (whichArm == myo::armLeft ? "L" : "R") << ']'
+			std::cout << '[' << (state->isUnlocked ? "unlocked" : "locked  ") << ']'
+				<< '[' << (state->whichArm == sideLeft ? "L" : "R") << ']'
 				<< '[' << poseString << std::string(14 - poseString.size(), ' ') << ']';
 		}
 		else {
@@ -154,24 +472,39 @@ public:
 		std::cout << std::flush;
 	}
 
-	// These values are set by onArmSync() and onArmUnsync() above.
-	bool onArm;
-	myo::Arm whichArm;
-
-	// This is set by onUnlocked() and onLocked() above.
-	bool isUnlocked;
+private:
+	// Looks up the state for an incoming event and marks the device as seen.
+	DeviceState* track(int index)
+	{
+		DeviceState* state = device(index);
+		if (state && !state->seen.load(std::memory_order_relaxed))
+		{
+			state->seen.store(true);
+		}
+		return state;
+	}
 
-	// These values are set by onOrientationData() and onPose() above.
-	int roll_w, pitch_w, yaw_w;
-	myo::Pose currentPose;
+	DeviceState* devices[MAX_DEVICES];
+	SessionLog* log;
 };
+// One step of a gesture: its roll, pitch and yaw buckets, a byte each.
 struct EulerAngle
 {
-	int roll = 0;
-	int pitch = 0;
-	int yaw = 0;
+	uint8_t roll;
+	uint8_t pitch;
+	uint8_t yaw;
+
+	EulerAngle()
+		: roll(0), pitch(0), yaw(0)
+	{
+	}
 
-	bool equals(EulerAngle ua)
+	EulerAngle(int roll, int pitch, int yaw)
+		: roll(static_cast<uint8_t>(roll)), pitch(static_cast<uint8_t>(pitch)), yaw(static_cast<uint8_t>(yaw))
+	{
+	}
+
+	bool equals(const EulerAngle& ua) const
 	{
 		if (std::abs(roll - ua.roll) <=TOLERANCE 
 			&& std::abs(pitch - ua.pitch)<=TOLERANCE
@@ -185,297 +518,684 @@ struct EulerAngle
 		}
 	}
 
-	std::string toJSONString()
+	void writeJSON(JsonWriter& out) const
 	{
-		return std::string("\n{\n\"roll\": ") + std::to_string(roll) +
-			",\n\"pitch\": " + std::to_string(pitch) +
-			",\n\"yaw\": " + std::to_string(yaw) + "\n}";
+		out.beginObject();
+		out.key("roll");
+		out.value(static_cast<int>(roll));
+		out.key("pitch");
+		out.value(static_cast<int>(pitch));
+		out.key("yaw");
+		out.value(static_cast<int>(yaw));
+		out.endObject();
+	}
+
+	// Reads the members of an object writeJSON() wrote, once its start has been read. Keys it doesn't know are
+	// skipped.
+	void readJSON(JsonReader& in)
+	{
+		while (in.next() == jsonKey)
+		{
+			uint8_t* field = in.textEquals("roll") ? &roll : in.textEquals("pitch") ? &pitch :
+				in.textEquals("yaw") ? &yaw : 0;
+			if (field == 0)
+			{
+				in.skip();
+				continue;
+			}
+			in.expect(jsonNumber);
+			int bucket = in.integer();
+			if (bucket < 0 || bucket > EulerQuantizer::bins)
+			{
+				throw std::runtime_error("Step bucket " + std::to_string(bucket) + " at byte " +
+					std::to_string(in.offset()) + " is out of range");
+			}
+			*field = static_cast<uint8_t>(bucket);
+		}
+	}
 
+	std::string toJSONString() const
+	{
+		JsonWriter out;
+		writeJSON(out);
+		return out.buffer();
 	}
 };
+
+static_assert(sizeof(EulerAngle) == 3, "EulerAngle must be three packed bytes");
+static_assert(sizeof(EulerAngle) == sizeof(StoredStep), "EulerAngle must be laid out like a library file's steps");
+static_assert(EulerQuantizer::bins <= 255, "EulerAngle keeps a bucket in a byte, so EULER_BINS can't pass 255");
+
+// A recorded exercise: its steps, and everything worked out from them. Steps are added one at a time while the
+// gesture is recorded; once it joins a library (see Gestures::add()) they move into the library's arena, next to
+// every other template's, and can no longer change. A gesture loaded from a library file joins with its steps and
+// orientations left where they are in the mapped file, and only gets copies of its own if it leaves.
 class Gesture
 {
 public:
-	std::vector<EulerAngle>* values;
+	Gesture()
+		: arena(0), run(-1), mappedOrientations(0)
+	{
+	}
 
-	Gesture(std::vector<EulerAngle>* val)
+	bool equals(const EulerAngle& euler, int n) const
 	{
-		values = val;
+		return step(n).equals(euler);
 	}
 
-	Gesture()
+	int getNumSteps() const
 	{
-		values = new std::vector<EulerAngle>();
+		return arena ? arena->count(run) : static_cast<int>(own.size());
 	}
-	
-	bool equals(EulerAngle euler, int n)
+
+	// Every step, contiguous.
+	const EulerAngle* steps() const
 	{
-		if ((values->at(n)).equals(euler))
-		{
-			return true;
-		}
-		else
+		return arena ? arena->steps(run) : own.empty() ? 0 : &own[0];
+	}
+
+	const EulerAngle& step(int n) const
+	{
+		if (n < 0 || n >= getNumSteps())
 		{
-			return false;
+			throw std::out_of_range("Step " + std::to_string(n) + " of a gesture with " +
+				std::to_string(getNumSteps()));
 		}
+		return steps()[n];
 	}
 
-	int getNumSteps()
+	void addStep(const EulerAngle& angle)
 	{
-		return values->size();
+		if (arena)
+		{
+			throw std::runtime_error("A gesture's steps can't change once it is in a library");
+		}
+		own.push_back(angle);
 	}
 
-	std::string toJSONString()
+	// Moves the steps into library's arena, where they stay until leave().
+	void join(TemplateArena<EulerAngle>& library)
 	{
-		std::string builder = "{\n\"gesture\": [";
-
-		for (int i = 0; i < values->size(); i++)
+		if (arena == &library)
 		{
-			builder += values->at(i).toJSONString() + ", ";
+			return;
 		}
-		builder += "\b\b]\n}";
-		return builder;
+		leave();
+		run = library.add(steps(), getNumSteps());
+		arena = &library;
+		std::vector<EulerAngle>().swap(own);
 	}
-};
-
-class GestureRecorder
-{
-private:
-	myo::Myo* myo;
-	myo::Hub* hub;
-	DataCollector* collector;
-	Gesture * lastGesture;
 
-public:
-	GestureRecorder(myo::Myo* myo, myo::Hub* hub, DataCollector* collector)
+	// Joins library with count steps, and an orientation for each, that stay where they are in a mapped library
+	// file, which must outlive the gesture or its leave().
+	void joinMapped(TemplateArena<EulerAngle>& library, const EulerAngle* mapped, const Quat* orientations, int count)
 	{
-		this->myo = myo;
-		this->hub = hub;
-		this->collector = collector;
-		hub->addListener(collector);
-		lastGesture = new Gesture();
+		leave();
+		std::vector<EulerAngle>().swap(own);
+		run = library.adopt(mapped, count);
+		arena = &library;
+		mappedOrientations = orientations;
 	}
 
-	void reset()
+	// Whether the steps are still those in a mapped file.
+	bool isMapped() const
 	{
-		lastGesture = new Gesture;
-		lastGesture->values = new std::vector<EulerAngle>();
+		return arena != 0 && arena->adopted(run);
 	}
 
-	void record()
+	// Copies the steps back out of the arena, or out of the mapped file, and gives their space back.
+	void leave()
 	{
-		reset();
-		EulerAngle lastAngle;
-		bool minorChange = false;
-
-		while (true)
+		if (!arena)
 		{
-			EulerAngle newAngle = lastAngle;
-			hub->run(1000/FREQUENCY);
-			if (collector->currentPose == myo::Pose::doubleTap)
-			{
-				break;
-			}
-			/*
-			if (collector->currentPose == myo::Pose::waveOut)
-			{
-				minorChange = false;
-				std::cout << "Reset" << std::endl;
-				reset();
-			}
-			*/
-			if (lastAngle.pitch == collector->pitch_w && lastAngle.roll == collector->roll_w && lastAngle.yaw == collector->yaw_w)
-			{
-				minorChange = false;
-				continue;
-			}
-			if (std::abs(lastAngle.pitch - collector->pitch_w) <= 1 && std::abs(lastAngle.roll - collector->roll_w) <= 1 && std::abs(lastAngle.yaw - collector->yaw_w) <= 1 && minorChange)
-			{
-				minorChange = true;
-				continue;
-			}
-			minorChange = false;
-			newAngle.pitch = collector->pitch_w;
-			newAngle.roll = collector->roll_w;
-			newAngle.yaw = collector->yaw_w;
+			return;
+		}
+		own.assign(steps(), steps() + getNumSteps());
+		if (mappedOrientations != 0)
+		{
+			recorded.assign(mappedOrientations, mappedOrientations + getNumSteps());
+			mappedOrientations = 0;
+		}
+		arena->release(run);
+		arena = 0;
+		run = -1;
+	}
 
-			std::cout << "\r[R: " << newAngle.roll << "][P: " << newAngle.pitch << "][Y: " << newAngle.yaw << "]";
+	// The steps resampled to LOOKUP_LENGTH, with their envelopes. Kept up to date by updateEnvelope().
+	DtwEnvelope envelope;
 
-			lastGesture->values->push_back(newAngle);
+	void updateEnvelope()
+	{
+		std::vector<int> roll, pitch, yaw;
+		getColumns(roll, pitch, yaw);
+		std::vector<float> r(roll.begin(), roll.end()), p(pitch.begin(), pitch.end()), y(yaw.begin(), yaw.end());
+		envelope.build(r.data(), p.data(), y.data(), getNumSteps(), LOOKUP_LENGTH, LOOKUP_BAND);
+	}
 
-			//std::cout << '\r' << collector->currentPose.toString();
+	// The orientation each step was recorded at, unless they are in the mapped file. Gestures loaded without them
+	// get bucket centers from orientations().
+	std::vector<Quat> recorded;
 
-			lastAngle = newAngle;
+	// The orientation each step was recorded at, or null if there isn't one per step.
+	const Quat* recordedOrientations() const
+	{
+		if (mappedOrientations != 0)
+		{
+			return mappedOrientations;
 		}
+		return !recorded.empty() && static_cast<int>(recorded.size()) == getNumSteps() ? &recorded[0] : 0;
 	}
 
-	void printLastGesture()
+	// One unit quaternion per step, for matchQuaternion.
+	std::vector<Quat> orientations()
 	{
-		for (int i = 0; i < lastGesture->values->size(); i++)
+		if (recordedOrientations() != 0)
+		{
+			return std::vector<Quat>(recordedOrientations(), recordedOrientations() + getNumSteps());
+		}
+		std::vector<Quat> centers;
+		for (int i = 0; i < getNumSteps(); i++)
 		{
-			EulerAngle angle = lastGesture->values->at(i);
-			std::cout << "\nR: " << angle.roll << " P: " << angle.pitch << " Y: " << angle.yaw;
+			const EulerAngle& angle = step(i);
+			centers.push_back(quatFromEuler(EulerQuantizer::RollYaw::center(angle.roll),
+				EulerQuantizer::Pitch::center(angle.pitch), EulerQuantizer::RollYaw::center(angle.yaw)));
 		}
+		return centers;
 	}
 
-	Gesture * getGesture()
+	// The steps compressed to keyframes, and how to rebuild them. Only worked out when getKeyframes() is first asked
+	// for them, or taken from a library file that has them, as compressing is cubic in the number of steps.
+	KeyframeTrack keyframes;
+
+	bool hasKeyframes() const
 	{
-		return lastGesture;
+		return getNumSteps() > 0 && keyframes.length() == getNumSteps();
 	}
 
-};
+	const KeyframeTrack& getKeyframes()
+	{
+		if (!hasKeyframes())
+		{
+			std::vector<int> roll, pitch, yaw;
+			getColumns(roll, pitch, yaw);
+			std::vector<float> r(roll.begin(), roll.end()), p(pitch.begin(), pitch.end()), y(yaw.begin(), yaw.end());
+			keyframes.compress(r.data(), p.data(), y.data(), getNumSteps(), KEYFRAME_ERROR);
+		}
+		return keyframes;
+	}
 
-class GestureListener
-{
-private:
-	myo::Myo* myo;
-	myo::Hub* hub;
-	DataCollector* collector;
-	Gesture * lastGesture;
+	// Per-step tolerances, for templates averaged from several takes. Empty means TOLERANCE everywhere.
+	std::vector<int> tolerances;
 
-public:
-	GestureListener(myo::Myo* myo, myo::Hub* hub, DataCollector* collector)
+	// One tolerance per step for the matchers, or null to use their own.
+	const int* getTolerances()
 	{
-		this->myo = myo;
-		this->hub = hub;
-		this->collector = collector;
-		hub->addListener(collector);
-		lastGesture = new Gesture();
+		return tolerances.empty() || static_cast<int>(tolerances.size()) != getNumSteps() ? 0 : tolerances.data();
 	}
 
-	bool isGesture(Gesture * gesture)
+	// The steps as separate roll, pitch and yaw columns, appended to the given vectors.
+	void getColumns(std::vector<int>& roll, std::vector<int>& pitch, std::vector<int>& yaw)
 	{
-		EulerAngle lastAngle;
-		int correct = 0;
-		int numSteps = gesture->getNumSteps();
-		int strikes = 0;
-		bool minorChange = false;
-		while (correct < numSteps)
+		for (int i = 0; i < getNumSteps(); i++)
 		{
-			if (collector->currentPose == myo::Pose::waveOut)
-			{
-				break;
-			}
-			EulerAngle newAngle = lastAngle;
-			hub->run(1000/FREQUENCY);
-			if (lastAngle.pitch == collector->pitch_w && lastAngle.roll == collector->roll_w && lastAngle.yaw == collector->yaw_w)
-			{
-				minorChange = false;
-				continue;
-			}
-			if (std::abs(lastAngle.pitch - collector->pitch_w) <= 1 && std::abs(lastAngle.roll - collector->roll_w) <= 1 && std::abs(lastAngle.yaw - collector->yaw_w) <= 1 && minorChange)
-			{
-				minorChange = true;
-				continue;
-			}
-			minorChange = false;
-			newAngle.pitch = collector->pitch_w;
-			newAngle.roll = collector->roll_w;
-			newAngle.yaw = collector->yaw_w;
-
-			std::cout << "\r[R: " << newAngle.roll << "][P: " << newAngle.pitch << "][Y: " << newAngle.yaw << "]";
+			roll.push_back(step(i).roll);
+			pitch.push_back(step(i).pitch);
+			yaw.push_back(step(i).yaw);
+		}
+	}
 
-			if (gesture->equals(newAngle, correct))
-			{
-				correct++;
-			}
-			else if (strikes>=MAX_STRIKES)
+	// {"gesture": [step, ...]}, with "orientations" ([w, x, y, z] per step) and "tolerances" when the gesture has
+	// them. Keyframes and envelopes are left out; they are worked out again from the steps.
+	void writeJSON(JsonWriter& out)
+	{
+		out.beginObject();
+		out.key("gesture");
+		out.beginArray();
+		for (int i = 0; i < getNumSteps(); i++)
+		{
+			step(i).writeJSON(out);
+		}
+		out.endArray();
+		const Quat* orientations = recordedOrientations();
+		if (orientations != 0)
+		{
+			out.key("orientations");
+			out.beginArray();
+			for (int i = 0; i < getNumSteps(); i++)
 			{
-				correct = 0;
-				strikes = 0;
+				out.beginArray();
+				out.value(orientations[i].w);
+				out.value(orientations[i].x);
+				out.value(orientations[i].y);
+				out.value(orientations[i].z);
+				out.endArray();
 			}
-			else
+			out.endArray();
+		}
+		if (getTolerances() != 0)
+		{
+			out.key("tolerances");
+			out.beginArray();
+			for (size_t i = 0; i < tolerances.size(); i++)
 			{
-				strikes++;
+				out.value(tolerances[i]);
 			}
-
-			//std::cout << '\r' << collector->currentPose.toString();
-
-			lastAngle = newAngle;
+			out.endArray();
 		}
-		return true;
+		out.endObject();
 	}
-	/*
-	std::string isGesture(std::map<std::string>, Gesture * gesture>)
+
+	// Reads the members of an object writeJSON() wrote, once its start has been read, adding its steps after any
+	// already here. Keys it doesn't know are skipped.
+	void readJSON(JsonReader& in)
 	{
-		EulerAngle lastAngle;
-		int correct = 0;
-		int numSteps = gesture->getNumSteps();
-		int strikes = 0;
-		bool minorChange = false;
-		while (correct < numSteps)
+		while (in.next() == jsonKey)
 		{
-			if (collector->currentPose == myo::Pose::waveOut)
-			{
-				break;
-			}
-			EulerAngle newAngle = lastAngle;
-			hub->run(1000 / FREQUENCY);
-			if (lastAngle.pitch == collector->pitch_w && lastAngle.roll == collector->roll_w && lastAngle.yaw == collector->yaw_w)
-			{
-				minorChange = false;
-				continue;
-			}
-			if (std::abs(lastAngle.pitch - collector->pitch_w) <= 1 && std::abs(lastAngle.roll - collector->roll_w) <= 1 && std::abs(lastAngle.yaw - collector->yaw_w) <= 1 && minorChange)
+			if (in.textEquals("gesture"))
 			{
-				minorChange = true;
-				continue;
+				in.expect(jsonBeginArray);
+				while (in.nextElement(jsonBeginObject))
+				{
+					EulerAngle angle;
+					angle.readJSON(in);
+					addStep(angle);
+				}
 			}
-			minorChange = false;
-			newAngle.pitch = collector->pitch_w;
-			newAngle.roll = collector->roll_w;
-			newAngle.yaw = collector->yaw_w;
-
-			std::cout << "\r[R: " << newAngle.roll << "][P: " << newAngle.pitch << "][Y: " << newAngle.yaw << "]";
-
-			if (gesture->equals(newAngle, correct))
+			else if (in.textEquals("orientations"))
 			{
-				correct++;
+				in.expect(jsonBeginArray);
+				while (in.nextElement(jsonBeginArray))
+				{
+					float component[4];
+					for (int c = 0; c < 4; c++)
+					{
+						in.expect(jsonNumber);
+						component[c] = static_cast<float>(in.number());
+					}
+					in.expect(jsonEndArray);
+					Quat quat = { component[0], component[1], component[2], component[3] };
+					recorded.push_back(quat);
+				}
 			}
-			else if (strikes >= MAX_STRIKES)
+			else if (in.textEquals("tolerances"))
 			{
-				correct = 0;
-				strikes = 0;
-				std::cout << "RESET" << std::endl;
+				in.expect(jsonBeginArray);
+				while (in.nextElement(jsonNumber))
+				{
+					// The library file keeps a tolerance in a byte, like a bucket.
+					int tolerance = in.integer();
+					if (tolerance < 0 || tolerance > 255)
+					{
+						throw std::runtime_error("Tolerance " + std::to_string(tolerance) + " at byte " +
+							std::to_string(in.offset()) + " is out of range");
+					}
+					tolerances.push_back(tolerance);
+				}
 			}
 			else
 			{
-				strikes++;
-				std::cout << "strike" << std::endl;
+				in.skip();
 			}
-
-			//std::cout << '\r' << collector->currentPose.toString();
-
-			lastAngle = newAngle;
 		}
-		return true;
 	}
-	*/
-	void printLastGesture()
+
+	std::string toJSONString()
 	{
-		for (int i = 0; i < lastGesture->values->size(); i++)
+		JsonWriter out;
+		writeJSON(out);
+		return out.buffer();
+	}
+
+private:
+	// A copy would share the arena run, and the first of the two to leave() would free it under the other.
+	Gesture(const Gesture&);
+	Gesture& operator=(const Gesture&);
+
+	// The steps while the gesture is being built, or its run in arena once it is in a library.
+	std::vector<EulerAngle> own;
+	TemplateArena<EulerAngle>* arena;
+	int run;
+	// With a mapped run, the orientations next to it in the file.
+	const Quat* mappedOrientations;
+};
+
+// Merges several takes of one exercise into a single template with DTW Barycenter Averaging (see dba.h). Steps the
+// takes agreed on keep TOLERANCE; steps where they spread out get more room.
+Gesture* averageGestures(const std::vector<Gesture*>& takes)
+{
+	DbaAverager averager;
+	for (size_t t = 0; t < takes.size(); t++)
+	{
+		std::vector<int> roll, pitch, yaw;
+		takes[t]->getColumns(roll, pitch, yaw);
+		std::vector<float> r(roll.begin(), roll.end()), p(pitch.begin(), pitch.end()), y(yaw.begin(), yaw.end());
+		averager.add(r.data(), p.data(), y.data(), takes[t]->getNumSteps());
+	}
+
+	Gesture* gesture = new Gesture();
+	AveragedTemplate average;
+	if (!averager.average(average))
+	{
+		return gesture;
+	}
+	for (int i = 0; i < average.length(); i++)
+	{
+		gesture->addStep(EulerAngle(static_cast<int>(average.roll[i] + 0.5f), static_cast<int>(average.pitch[i] + 0.5f),
+			static_cast<int>(average.yaw[i] + 0.5f)));
+
+		float spread = std::sqrt(std::max(average.varianceRoll[i], std::max(average.variancePitch[i],
+			average.varianceYaw[i])));
+		int tolerance = static_cast<int>(std::ceil(TOLERANCE_SIGMAS * spread));
+		gesture->tolerances.push_back(std::min(MAX_TOLERANCE, std::max(TOLERANCE, tolerance)));
+	}
+	return gesture;
+}
+
+class GestureRecorder
+{
+private:
+	HubPump* pump;
+	DeviceState* device;
+	Gesture * lastGesture;
+
+public:
+	GestureRecorder(HubPump* pump, DeviceState* device)
+	{
+		this->pump = pump;
+		this->device = device;
+		lastGesture = new Gesture();
+	}
+
+	void reset()
+	{
+		lastGesture = new Gesture();
+	}
+
+	void record()
+	{
+		reset();
+		bool done = false;
+
+		// Anything queued before recording started belongs to someone else.
+		device->restartStream();
+
+		while (!done)
+		{
+			pump->check();
+			if (pump->finished() && device->samples.empty())
+			{
+				break;
+			}
+			device->waitForSamples(1000/FREQUENCY);
+
+			Sample sample;
+			while (device->samples.pop(sample))
+			{
+				if (sample.pose == poseDoubleTap)
+				{
+					done = true;
+					break;
+				}
+				// The filter only lets through samples that differ from the last one it passed, so every one is a step.
+				std::cout << "\r[R: " << sample.roll << "][P: " << sample.pitch << "][Y: " << sample.yaw << "]";
+				if (sample.activation > 0)
+				{
+					std::cout << "[EMG: " << std::setw(3) << static_cast<int>(sample.activation * 100) << "%]";
+				}
+
+				lastGesture->addStep(EulerAngle(sample.roll, sample.pitch, sample.yaw));
+				lastGesture->recorded.push_back(sample.quat);
+			}
+		}
+	}
+
+	void printLastGesture()
+	{
+		for (int i = 0; i < lastGesture->getNumSteps(); i++)
 		{
-			EulerAngle angle = lastGesture->values->at(i);
-			std::cout << "\nR: " << angle.roll << " P: " << angle.pitch << " Y: " << angle.yaw;
+			const EulerAngle& angle = lastGesture->step(i);
+			std::cout << "\nR: " << static_cast<int>(angle.roll) << " P: " << static_cast<int>(angle.pitch) << " Y: "
+				<< static_cast<int>(angle.yaw);
 		}
 	}
 
+	Gesture * getGesture()
+	{
+		return lastGesture;
+	}
+
 };
 
+// The gesture library. Gestures are saved with add(), and filed in the index used to recognize any of them at once
+// the next time recognizer() is called.
 class Gestures
 {
 public:
 	std::map<std::string, Gesture*> gest;
+
+	// Template t of recognizer() is the gesture named names[t].
+	std::vector<std::string> names;
+
+	Gestures()
+		: matcher(EulerQuantizer::bins, TOLERANCE, MAX_STRIKES), lookups(pool.size(), DtwMatcher(LOOKUP_BAND))
+	{
+	}
+
+	~Gestures()
+	{
+		for (size_t f = 0; f < files.size(); f++)
+		{
+			delete files[f];
+		}
+	}
+
+	// The name of the gesture attempt is closest to by DTW, with the distance per step, or an empty string if the
+	// library or attempt is empty. A large library is scored on every core.
+	std::string nearest(Gesture* attempt, float& distance)
+	{
+		attempt->updateEnvelope();
+		std::vector<const DtwEnvelope*> candidates;
+		std::vector<std::string> candidateNames;
+		for (std::map<std::string, Gesture*>::const_iterator it = gest.begin(); it != gest.end(); ++it)
+		{
+			candidates.push_back(&it->second->envelope);
+			candidateNames.push_back(it->first);
+		}
+
+		CascadeStats stats;
+		int best = nearestTemplate(attempt->envelope, candidates.data(), static_cast<int>(candidates.size()), pool,
+			lookups, distance, stats);
+		distance /= LOOKUP_LENGTH;
+		return best < 0 ? "" : candidateNames[best];
+	}
+
+	// Saves gesture under name, replacing any gesture already called that. Its steps move into the library's arena;
+	// a gesture it replaces gets its own copy back.
+	void add(const std::string& name, Gesture* gesture)
+	{
+		Gesture*& saved = gest[name];
+		if (saved != 0 && saved != gesture)
+		{
+			saved->leave();
+		}
+		saved = gesture;
+		gesture->join(arena);
+		gesture->updateEnvelope();
+		if (std::find(unindexed.begin(), unindexed.end(), name) == unindexed.end())
+		{
+			unindexed.push_back(name);
+		}
+	}
+
+	// Recognizes every gesture in the library at once. Gestures added since the last call are indexed first; only
+	// their steps are, the rest of the index is left as it is. Indexing waits until here because it is by far the
+	// most expensive part of adding a gesture, and a library loaded at startup may never be used this way. Only one
+	// listener can use it at a time.
+	LibraryMatcher& recognizer()
+	{
+		for (size_t i = 0; i < unindexed.size(); i++)
+		{
+			const std::string& name = unindexed[i];
+			std::map<std::string, int>::const_iterator old = templates.find(name);
+			if (old != templates.end())
+			{
+				matcher.disable(old->second);
+			}
+			Gesture* gesture = gest[name];
+			std::vector<int> roll, pitch, yaw;
+			gesture->getColumns(roll, pitch, yaw);
+			templates[name] = matcher.add(roll.data(), pitch.data(), yaw.data(), gesture->getNumSteps(),
+				gesture->getTolerances());
+			names.push_back(name);
+		}
+		unindexed.clear();
+		return matcher;
+	}
+
+	// Writes every gesture to the library file at path, replacing it.
+	void save(const std::string& path)
+	{
+		std::vector<LibraryTemplate> templates;
+		for (std::map<std::string, Gesture*>::const_iterator it = gest.begin(); it != gest.end(); ++it)
+		{
+			Gesture* gesture = it->second;
+			LibraryTemplate stored;
+			stored.name = it->first;
+			for (int i = 0; i < gesture->getNumSteps(); i++)
+			{
+				const EulerAngle& angle = gesture->step(i);
+				StoredStep packed = { angle.roll, angle.pitch, angle.yaw };
+				stored.steps.push_back(packed);
+			}
+			stored.orientations = gesture->orientations();
+			if (gesture->getTolerances() != 0)
+			{
+				stored.tolerances.assign(gesture->tolerances.begin(), gesture->tolerances.end());
+			}
+			if (gesture->hasKeyframes())
+			{
+				stored.keyframes.assign(gesture->keyframes.index.begin(), gesture->keyframes.index.end());
+			}
+			templates.push_back(stored);
+		}
+#ifdef _WIN32
+		// Windows won't replace a file anyone has mapped, so loaded gestures take copies and the files are let go.
+		for (std::map<std::string, Gesture*>::const_iterator it = gest.begin(); it != gest.end(); ++it)
+		{
+			if (it->second->isMapped())
+			{
+				it->second->leave();
+				it->second->join(arena);
+			}
+		}
+		for (size_t f = 0; f < files.size(); f++)
+		{
+			delete files[f];
+		}
+		files.clear();
+#endif
+		writeLibrary(path, EulerQuantizer::bins, templates);
+	}
+
+	// Adds every gesture in the library file at path and returns how many there were. The file stays mapped, and the
+	// gestures' steps and orientations are read where they lie in it, so they cost no memory of their own and every
+	// process using the library shares one copy. Only tolerances, which the matchers want as ints, are copied out.
+	int load(const std::string& path)
+	{
+		LibraryFile* mapped = new LibraryFile(path);
+		files.push_back(mapped);
+		const LibraryFile& file = *mapped;
+		if (file.bins() != EulerQuantizer::bins)
+		{
+			throw std::runtime_error("Library " + path + " has " + std::to_string(file.bins()) + " buckets per axis, "
+				"this build " + std::to_string(EulerQuantizer::bins));
+		}
+		for (int t = 0; t < file.size(); t++)
+		{
+			Gesture* gesture = new Gesture();
+			int steps = file.stepCount(t);
+			gesture->joinMapped(arena, reinterpret_cast<const EulerAngle*>(file.steps(t)), file.orientations(t), steps);
+			if (file.tolerances(t) != 0)
+			{
+				gesture->tolerances.assign(file.tolerances(t), file.tolerances(t) + steps);
+			}
+			if (file.keyframeCount(t) > 0)
+			{
+				std::vector<int> roll, pitch, yaw;
+				gesture->getColumns(roll, pitch, yaw);
+				std::vector<float> r(roll.begin(), roll.end()), p(pitch.begin(), pitch.end()), y(yaw.begin(), yaw.end());
+				std::vector<int> keyframes(file.keyframes(t), file.keyframes(t) + file.keyframeCount(t));
+				gesture->keyframes.select(r.data(), p.data(), y.data(), steps, keyframes.data(), file.keyframeCount(t));
+			}
+			add(file.name(t), gesture);
+		}
+		return file.size();
+	}
+
+	// Writes every gesture to path as JSON, {"gestures": {name: gesture, ...}}, streaming it out as it goes.
+	void exportJSON(const std::string& path)
+	{
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		JsonWriter out(&file);
+		out.beginObject();
+		out.key("gestures");
+		out.beginObject();
+		for (std::map<std::string, Gesture*>::const_iterator it = gest.begin(); it != gest.end(); ++it)
+		{
+			out.key(it->first);
+			it->second->writeJSON(out);
+		}
+		out.endObject();
+		out.endObject();
+		out.flush();
+		if (!file)
+		{
+			throw std::runtime_error("Unable to write gestures to " + path);
+		}
+	}
+
+	// Adds every gesture in a JSON file exportJSON() wrote and returns how many there were. The file is mapped and
+	// parsed where it lies. Like add(), it leaves indexing and keyframes until something first needs them.
+	int importJSON(const std::string& path)
+	{
+		MappedFile file(path);
+		JsonReader in(file.data(), file.size());
+		int count = 0;
+		std::string name;
+		in.expect(jsonBeginObject);
+		while (in.next() == jsonKey)
+		{
+			if (!in.textEquals("gestures"))
+			{
+				in.skip();
+				continue;
+			}
+			in.expect(jsonBeginObject);
+			while (in.next() == jsonKey)
+			{
+				in.text(name);
+				in.expect(jsonBeginObject);
+				Gesture* gesture = new Gesture();
+				gesture->readJSON(in);
+				add(name, gesture);
+				count++;
+			}
+		}
+		in.expect(jsonEnd);
+		return count;
+	}
+
 	std::string keyAt(int n)
 	{
 		int i = 0;
-		for (std::map<std::string, Gesture*>::const_iterator it = gest.begin(); it != gest.end(); ++it)
+		for (std::map<std::string, Gesture*>::const_iterator it = gest.begin(); it != gest.end(); ++it, ++i)
 		{
 			if (i == n)
 			{
 				return it->first;
 			}
 		}
+		return "";
 	}
 	int getSize()
 	{
@@ -486,49 +1206,776 @@ public:
 		}
 		return i;
 	}
+
+private:
+	Gestures(const Gestures&);
+	Gestures& operator=(const Gestures&);
+
+	// Every saved gesture's steps, in one block, apart from those still in the library files they were loaded from.
+	TemplateArena<EulerAngle> arena;
+	std::vector<LibraryFile*> files;
+
+	// The index behind recognizer(), each name's current template in it, and the names added since it was updated.
+	LibraryMatcher matcher;
+	std::map<std::string, int> templates;
+	std::vector<std::string> unindexed;
+
+	// Threads for scoring the library, and each one's DTW rows.
+	ThreadPool pool;
+	std::vector<DtwMatcher> lookups;
 };
 
+class GestureListener
+{
+private:
+	HubPump* pump;
+	DeviceState* device;
+	Gesture * lastGesture;
+	MatchMode mode;
+
+	// DTW mode state: the template and the attempt so far as bucket columns, and the matcher's reusable rows.
+	DtwMatcher dtw;
+	std::vector<float> templateRoll, templatePitch, templateYaw;
+	std::vector<float> liveRoll, livePitch, liveYaw;
+	SpringMatcher spring;
+
+	// Strike mode: the template compiled into per-axis step masks. Quaternion mode: its orientations.
+	ShiftAndMatcher strikeMatcher;
+	QuaternionMatcher quaternionMatcher;
+
+
+	void loadTemplate(Gesture * gesture)
+	{
+		templateRoll.clear();
+		templatePitch.clear();
+		templateYaw.clear();
+		for (int i = 0; i < gesture->getNumSteps(); i++)
+		{
+			const EulerAngle& step = gesture->step(i);
+			templateRoll.push_back(static_cast<float>(step.roll));
+			templatePitch.push_back(static_cast<float>(step.pitch));
+			templateYaw.push_back(static_cast<float>(step.yaw));
+		}
+	}
+
+	// Appends one sample to the attempt. Once it reaches the template's final step, scores the most recent part of
+	// the attempt against the whole template and reports whether it is close enough.
+	bool completesDtw(Gesture * gesture, const EulerAngle& angle)
+	{
+		liveRoll.push_back(static_cast<float>(angle.roll));
+		livePitch.push_back(static_cast<float>(angle.pitch));
+		liveYaw.push_back(static_cast<float>(angle.yaw));
+
+		int numSteps = gesture->getNumSteps();
+		int n = static_cast<int>(liveRoll.size());
+		if (!gesture->equals(angle, numSteps - 1) || 2 * n < numSteps)
+		{
+			return false;
+		}
+
+		int window = std::min(n, DTW_WINDOW * numSteps);
+		int first = n - window;
+		float cost = dtw.distance(&liveRoll[first], &livePitch[first], &liveYaw[first], window, &templateRoll[0],
+			&templatePitch[0], &templateYaw[0], numSteps) / std::max(window, numSteps);
+		std::cout << "[DTW: " << static_cast<int>(cost * 100 + 0.5f) / 100.0 << ']';
+		return cost <= DTW_TOLERANCE;
+	}
+
+public:
+	GestureListener(HubPump* pump, DeviceState* device)
+		: mode(matchStrikes), dtw(DTW_BAND), spring(DTW_TOLERANCE),
+		strikeMatcher(EulerQuantizer::bins, TOLERANCE, MAX_STRIKES),
+		quaternionMatcher(static_cast<float>(QUATERNION_TOLERANCE_DEGREES * M_PI / 180), MAX_STRIKES)
+	{
+		this->pump = pump;
+		this->device = device;
+		lastGesture = new Gesture();
+	}
+
+	void setMode(MatchMode mode)
+	{
+		this->mode = mode;
+	}
+
+	MatchMode getMode()
+	{
+		return mode;
+	}
+
+	// Counts reps of gesture in one continuous stream until there are totalReps of them, the patient waves out, or
+	// the source ends. Each rep is reported with when it started and ended and how closely it followed the template.
+	int countReps(Gesture * gesture, int totalReps)
+	{
+		if (gesture->getNumSteps() == 0)
+		{
+			return 0;
+		}
+		spring.setTemplate(gesture->getKeyframes());
+
+		int reps = 0;
+		bool cancelled = false;
+		bool started = false;
+		uint64_t sessionStart = 0;
+		std::chrono::steady_clock::time_point lastSample = std::chrono::steady_clock::now();
+		SpringMatch match;
+		EulerAngle lastAngle;
+		EulerAngle endAngle = gesture->step(gesture->getNumSteps() - 1);
+
+		device->restartStream();
+
+		while (reps < totalReps && !cancelled)
+		{
+			pump->check();
+			if (pump->finished() && device->samples.empty())
+			{
+				break;
+			}
+			device->waitForSamples(1000/FREQUENCY);
+
+			Sample sample;
+			bool any = false;
+			while (reps < totalReps && device->samples.pop(sample))
+			{
+				any = true;
+				if (sample.pose == poseWaveOut)
+				{
+					cancelled = true;
+					break;
+				}
+				if (!started)
+				{
+					started = true;
+					sessionStart = sample.timestamp;
+				}
+				lastAngle = EulerAngle(sample.roll, sample.pitch, sample.yaw);
+
+				std::cout << "\r[R: " << sample.roll << "][P: " << sample.pitch << "][Y: " << sample.yaw << "]";
+				if (sample.activation > 0)
+				{
+					std::cout << "[EMG: " << std::setw(3) << static_cast<int>(sample.activation * 100) << "%]";
+				}
+
+				if (spring.push(sample.timestamp, static_cast<float>(sample.roll), static_cast<float>(sample.pitch),
+					static_cast<float>(sample.yaw), match))
+				{
+					printRep(++reps, totalReps, match, sessionStart, gesture->getNumSteps());
+				}
+			}
+
+			if (any)
+			{
+				lastSample = std::chrono::steady_clock::now();
+			}
+			else if (spring.hasCandidate() && lastAngle.equals(endAngle) && std::chrono::steady_clock::now() - lastSample >
+				std::chrono::milliseconds(SPRING_SETTLE_MS) && spring.flush(match))
+			{
+				printRep(++reps, totalReps, match, sessionStart, gesture->getNumSteps());
+			}
+		}
+
+		if (reps < totalReps && spring.flush(match))
+		{
+			printRep(++reps, totalReps, match, sessionStart, gesture->getNumSteps());
+		}
+		return reps;
+	}
+
+	void printRep(int rep, int totalReps, const SpringMatch& match, uint64_t sessionStart, int numSteps)
+	{
+		std::cout << "\nRep " << rep << " / " << totalReps << ": " << (match.start - sessionStart) / 1e6 << "s to "
+			<< (match.end - sessionStart) / 1e6 << "s, distance " << match.distance / numSteps << std::endl;
+	}
+
+	bool isGesture(Gesture * gesture)
+	{
+		int numSteps = gesture->getNumSteps();
+		bool completed = numSteps == 0;
+		bool cancelled = false;
+
+		if (mode == matchDtw)
+		{
+			loadTemplate(gesture);
+			liveRoll.clear();
+			livePitch.clear();
+			liveYaw.clear();
+		}
+		else if (mode == matchQuaternion)
+		{
+			std::vector<Quat> steps = gesture->orientations();
+			quaternionMatcher.clear();
+			quaternionMatcher.add(steps.data(), numSteps);
+		}
+		else
+		{
+			std::vector<int> roll, pitch, yaw;
+			gesture->getColumns(roll, pitch, yaw);
+			strikeMatcher.clear();
+			strikeMatcher.add(roll.data(), pitch.data(), yaw.data(), numSteps, gesture->getTolerances());
+		}
+
+		device->restartStream();
+
+		while (!completed && !cancelled)
+		{
+			pump->check();
+			if (pump->finished() && device->samples.empty())
+			{
+				break;
+			}
+			device->waitForSamples(1000/FREQUENCY);
+
+			Sample sample;
+			while (!completed && device->samples.pop(sample))
+			{
+				if (sample.pose == poseWaveOut)
+				{
+					cancelled = true;
+					break;
+				}
+				EulerAngle newAngle(sample.roll, sample.pitch, sample.yaw);
+
+				std::cout << "\r[R: " << sample.roll << "][P: " << sample.pitch << "][Y: " << sample.yaw << "]";
+				if (sample.activation > 0)
+				{
+					std::cout << "[EMG: " << std::setw(3) << static_cast<int>(sample.activation * 100) << "%]";
+				}
+
+				if (mode == matchDtw)
+				{
+					completed = completesDtw(gesture, newAngle);
+				}
+				else if (mode == matchQuaternion)
+				{
+					completed = quaternionMatcher.push(sample.quat) > 0;
+				}
+				else
+				{
+					completed = strikeMatcher.push(newAngle.roll, newAngle.pitch, newAngle.yaw) > 0;
+				}
+			}
+		}
+		return true;
+	}
+	// Listens for every gesture in the library at once and returns the name of the first one the patient completes,
+	// or an empty string if they wave out or the source ends first.
+	std::string isGesture(Gestures& library)
+	{
+		LibraryMatcher& matcher = library.recognizer();
+		matcher.reset();
+		device->restartStream();
+
+		while (true)
+		{
+			pump->check();
+			if (pump->finished() && device->samples.empty())
+			{
+				return "";
+			}
+			device->waitForSamples(1000/FREQUENCY);
+
+			Sample sample;
+			while (device->samples.pop(sample))
+			{
+				if (sample.pose == poseWaveOut)
+				{
+					return "";
+				}
+
+				std::cout << "\r[R: " << sample.roll << "][P: " << sample.pitch << "][Y: " << sample.yaw << "]";
+				if (sample.activation > 0)
+				{
+					std::cout << "[EMG: " << std::setw(3) << static_cast<int>(sample.activation * 100) << "%]";
+				}
+
+				int completed = matcher.push(sample.roll, sample.pitch, sample.yaw);
+				if (completed >= 0)
+				{
+					return library.names[completed];
+				}
+			}
+		}
+	}
+
+	void printLastGesture()
+	{
+		for (int i = 0; i < lastGesture->getNumSteps(); i++)
+		{
+			const EulerAngle& angle = lastGesture->step(i);
+			std::cout << "\nR: " << static_cast<int>(angle.roll) << " P: " << static_cast<int>(angle.pitch) << " Y: "
+				<< static_cast<int>(angle.yaw);
+		}
+	}
+
+};
+
+// Reads every session in a session log (see sessionlog.h) or archive (see sessionarchive.h). streams[s] is one device
+// in one session and columns[s] the steps the recognizer would have seen from it: from a log, each device's raw
+// orientation goes through the same resampling, quantization and filtering it got live; an archive already holds
+// them. A log's steps are resampled first and then quantized a whole stream at a time, with the batched kernel.
+void readSessions(const std::string& path, std::vector<ArchiveSession>& sessions, std::vector<ArchiveStream>& streams,
+	std::vector<SessionColumns>& columns)
+{
+	sessions.clear();
+	streams.clear();
+	columns.clear();
+	char magic[8] = {};
+	std::ifstream(path.c_str(), std::ios::binary).read(magic, sizeof(magic));
+	if (std::memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0)
+	{
+		ArchiveFile archive(path);
+		for (int s = 0; s < archive.sessionCount(); s++)
+		{
+			sessions.push_back(archive.session(s));
+		}
+		for (int s = 0; s < archive.streamCount(); s++)
+		{
+			const ArchiveStream& stream = archive.stream(s);
+			streams.push_back(stream);
+			columns.push_back(SessionColumns());
+			SessionColumns& steps = columns.back();
+			steps.roll.resize(stream.steps);
+			steps.pitch.resize(stream.steps);
+			steps.yaw.resize(stream.steps);
+			if (stream.steps > 0)
+			{
+				archive.decode(s, 0, stream.steps, &steps.roll[0], &steps.pitch[0], &steps.yaw[0]);
+			}
+		}
+		return;
+	}
+
+	// Each stream's resampled steps, waiting to be quantized, and the pose at each.
+	struct Resampled
+	{
+		std::vector<float> w, x, y, z;
+		std::vector<PoseType> pose;
+	};
+	std::vector<Resampled> resampled;
+
+	SessionLogFile log(path);
+	std::vector<Resampler> resamplers(MAX_DEVICES, Resampler(RESAMPLE_HZ));
+	int current[MAX_DEVICES];
+	const LogRecord* records = log.records();
+	for (size_t i = 0; i < log.size(); i++)
+	{
+		const LogRecord& record = records[i];
+		if (record.kind == logSession)
+		{
+			ArchiveSession session = { record.timestamp, 0 };
+			sessions.push_back(session);
+			for (int d = 0; d < MAX_DEVICES; d++)
+			{
+				current[d] = -1;
+				resamplers[d].reset();
+			}
+		}
+		else if (record.kind == logDropped && !sessions.empty())
+		{
+			sessions.back().dropped += record.count;
+		}
+		else if (record.kind == logOrientation && !sessions.empty() && record.device < MAX_DEVICES)
+		{
+			int d = record.device;
+			if (current[d] < 0)
+			{
+				current[d] = static_cast<int>(streams.size());
+				ArchiveStream stream;
+				std::memset(&stream, 0, sizeof(stream));
+				stream.first = record.timestamp;
+				stream.session = static_cast<uint32_t>(sessions.size() - 1);
+				stream.device = static_cast<uint32_t>(d);
+				streams.push_back(stream);
+				resampled.push_back(Resampled());
+			}
+			ArchiveStream& stream = streams[current[d]];
+			Resampled& steps = resampled[current[d]];
+			stream.samples++;
+			stream.locked += record.locked;
+			stream.last = record.timestamp;
+			PoseType pose = static_cast<PoseType>(record.pose);
+			resamplers[d].push(record.timestamp, record.quat, [&](uint64_t stepTimestamp, const Quat& stepQuat)
+			{
+				steps.w.push_back(stepQuat.w);
+				steps.x.push_back(stepQuat.x);
+				steps.y.push_back(stepQuat.y);
+				steps.z.push_back(stepQuat.z);
+				steps.pose.push_back(pose);
+			});
+		}
+	}
+
+	columns.resize(streams.size());
+	std::vector<int> roll, pitch, yaw;
+	for (size_t s = 0; s < streams.size(); s++)
+	{
+		const Resampled& steps = resampled[s];
+		size_t n = steps.w.size();
+		roll.resize(n);
+		pitch.resize(n);
+		yaw.resize(n);
+		if (n > 0)
+		{
+			quantizeOrientations(&steps.w[0], &steps.x[0], &steps.y[0], &steps.z[0], n, &roll[0], &pitch[0], &yaw[0]);
+		}
+		SampleFilter filter(FILTER_DEAD_BAND, FILTER_HOLD_STEPS);
+		SessionColumns& kept = columns[s];
+		for (size_t i = 0; i < n; i++)
+		{
+			if (filter.accept(roll[i], pitch[i], yaw[i], steps.pose[i]))
+			{
+				kept.roll.push_back(roll[i]);
+				kept.pitch.push_back(pitch[i]);
+				kept.yaw.push_back(yaw[i]);
+			}
+		}
+		streams[s].steps = static_cast<uint32_t>(kept.roll.size());
+	}
+}
+
+// Prints what each session in a log or archive recorded, and re-scores it against the library, replaying the
+// sessions through the library's recognizer in parallel.
+void auditSessions(const std::string& path, Gestures& library)
+{
+	std::vector<ArchiveSession> sessions;
+	std::vector<ArchiveStream> streams;
+	std::vector<SessionColumns> columns;
+	readSessions(path, sessions, streams, columns);
+
+	LibraryMatcher& matcher = library.recognizer();
+	ThreadPool pool;
+	std::vector<int> completions;
+	rescoreSessions(matcher.index(), columns, pool, completions);
+
+	size_t s = 0;
+	for (size_t session = 0; session < sessions.size(); session++)
+	{
+		time_t seconds = static_cast<time_t>(sessions[session].started / 1000000);
+		char when[32];
+		std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&seconds));
+		std::cout << "Session " << session + 1 << ", started " << when;
+		if (sessions[session].dropped > 0)
+		{
+			std::cout << ", " << sessions[session].dropped << " records dropped";
+		}
+		std::cout << std::endl;
+		for (; s < streams.size() && streams[s].session == session; s++)
+		{
+			const ArchiveStream& stream = streams[s];
+			std::cout << "  Device " << stream.device << ": " << stream.samples << " samples over "
+				<< (stream.last - stream.first) / 1e6 << " s, " << stream.locked * 100 / stream.samples << "% locked, "
+				<< stream.steps << " steps";
+			for (int t = 0; t < matcher.size(); t++)
+			{
+				int count = completions[s * matcher.size() + t];
+				if (count > 0)
+				{
+					std::cout << ", " << library.names[t] << " x" << count;
+				}
+			}
+			std::cout << std::endl;
+		}
+	}
+}
+
+// Packs every session in a log (or another archive) into an archive at archivePath.
+void archiveSessions(const std::string& path, const std::string& archivePath)
+{
+	std::vector<ArchiveSession> sessions;
+	std::vector<ArchiveStream> streams;
+	std::vector<SessionColumns> columns;
+	readSessions(path, sessions, streams, columns);
+
+	std::vector<PackedStream> packed(streams.size());
+	size_t steps = 0;
+	for (size_t s = 0; s < streams.size(); s++)
+	{
+		const SessionColumns& stream = columns[s];
+		if (!stream.roll.empty())
+		{
+			packed[s].encode(&stream.roll[0], &stream.pitch[0], &stream.yaw[0], stream.roll.size());
+		}
+		steps += stream.roll.size();
+	}
+	writeArchive(archivePath, sessions, streams, packed);
+
+	MappedFile from(path), to(archivePath);
+	std::cout << "Archived " << sessions.size() << " sessions, " << steps << " steps, from " << from.size()
+		<< " bytes to " << to.size() << " (" << steps * 3 * sizeof(int) << " as ints)." << std::endl;
+}
+
 int main(int argc, char** argv)
 {
 	// We catch any exceptions that might occur below -- see the catch statement for more details.
 	try {
 
-		// First, we create a Hub with our application identifier. Be sure not to use the com.example namespace when
-		// publishing your application. The Hub provides access to one or more Myos.
-		myo::Hub *hub = new myo::Hub("com.example.hello-myo");
-
-		std::cout << "Attempting to find a Myo..." << std::endl;
+		// "--replay <file>" and "--synthetic" drive everything from a recording or a generator instead of an armband.
+		// "--speed <n>" plays those back n times faster than real time; 0 means as fast as the consumers keep up.
+		// "--bench <name>" runs one of the offline benchmarks in benchmarks.h and exits.
+		// "--match <strikes|dtw|spring|quaternion>" picks how reps are recognized; see MatchMode.
+		// "--devices <n>" gives the synthetic source n armbands.
+		// "--emg" turns on the armband's EMG stream for muscle-activation feedback.
+		// "--capture <file>" keeps the raw motion data of the whole session and writes it out, in the replay format,
+		// on exit.
+		// "--library <file>" keeps saved gestures in that file instead of LIBRARY_PATH.
+		// "--import <file>" adds the gestures in a JSON file to the library at startup; "--export <file>" writes the
+		// library out as JSON on exit.
+		// "--log <file>" appends the session's raw stream to that file instead of SESSION_LOG_PATH; "--no-log" keeps
+		// nothing. "--audit <file>" summarizes and re-scores every session in a log or archive against the library,
+		// and exits. "--archive <log> <file>" packs a log's sessions into a much smaller archive, and exits.
+		std::string replayPath;
+		std::string capturePath;
+		std::string libraryPath = LIBRARY_PATH;
+		std::string importPath;
+		std::string exportPath;
+		std::string logPath = SESSION_LOG_PATH;
+		std::string auditPath;
+		bool synthetic = false;
+		bool streamEmg = false;
+		int syntheticDevices = 1;
+		MatchMode matchMode = matchStrikes;
+		double speed = 1.0;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--replay" && i + 1 < argc)
+			{
+				replayPath = argv[++i];
+			}
+			else if (arg == "--capture" && i + 1 < argc)
+			{
+				capturePath = argv[++i];
+			}
+			else if (arg == "--library" && i + 1 < argc)
+			{
+				libraryPath = argv[++i];
+			}
+			else if (arg == "--import" && i + 1 < argc)
+			{
+				importPath = argv[++i];
+			}
+			else if (arg == "--export" && i + 1 < argc)
+			{
+				exportPath = argv[++i];
+			}
+			else if (arg == "--log" && i + 1 < argc)
+			{
+				logPath = argv[++i];
+			}
+			else if (arg == "--no-log")
+			{
+				logPath.clear();
+			}
+			else if (arg == "--audit" && i + 1 < argc)
+			{
+				auditPath = argv[++i];
+			}
+			else if (arg == "--archive" && i + 2 < argc)
+			{
+				archiveSessions(argv[i + 1], argv[i + 2]);
+				return 0;
+			}
+			else if (arg == "--bench" && i + 1 < argc)
+			{
+				return runBenchmark(argv[i + 1]);
+			}
+			else if (arg == "--emg")
+			{
+				streamEmg = true;
+			}
+			else if (arg == "--synthetic")
+			{
+				synthetic = true;
+			}
+			else if (arg == "--match" && i + 1 < argc)
+			{
+				std::string mode = argv[++i];
+				if (mode == "dtw")
+				{
+					matchMode = matchDtw;
+				}
+				else if (mode == "spring")
+				{
+					matchMode = matchSpring;
+				}
+				else if (mode == "quaternion")
+				{
+					matchMode = matchQuaternion;
+				}
+				else if (mode != "strikes")
+				{
+					throw std::runtime_error("Unknown match mode " + mode + "; use strikes, dtw, spring or quaternion");
+				}
+			}
+			else if (arg == "--devices" && i + 1 < argc)
+			{
+				syntheticDevices = std::max(1, std::min(MAX_DEVICES, std::atoi(argv[++i])));
+			}
+			else if (arg == "--speed" && i + 1 < argc)
+			{
+				speed = std::atof(argv[++i]);
+			}
+			else
+			{
+				throw std::runtime_error("Unknown argument " + arg);
+			}
+		}
 
-		// Next, we attempt to find a Myo to use. If a Myo is already paired in Myo Connect, this will return that Myo
-		// immediately.
-		// waitForMyo() takes a timeout value in milliseconds. In this case we will try to find a Myo for 10 seconds, and
-		// if that fails, the function will return a null pointer.
-		myo::Myo* myo = hub->waitForMyo(10000);
+		Gestures gestures;
+		if (fileExists(libraryPath))
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			int loaded = gestures.load(libraryPath);
+			std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+			std::cout << "Loaded " << loaded << " gestures from " << libraryPath << " in " << took.count() << " ms."
+				<< std::endl;
+		}
+		if (!importPath.empty())
+		{
+			int imported = gestures.importJSON(importPath);
+			gestures.save(libraryPath);
+			std::cout << "Imported " << imported << " gestures from " << importPath << "." << std::endl;
+		}
+		if (!auditPath.empty())
+		{
+			auditSessions(auditPath, gestures);
+			return 0;
+		}
 
-		// If waitForMyo() returned a null pointer, we failed to find a Myo, so exit with an error message.
-		if (!myo) {
-			throw std::runtime_error("Unable to find a Myo!");
+		SampleSource * source;
+		if (!replayPath.empty())
+		{
+			source = new ReplaySource(replayPath, speed);
+		}
+		else if (synthetic)
+		{
+			source = new SyntheticSource(speed, 50, 4, 0, syntheticDevices);
 		}
+		else
+		{
+#ifdef MYO_SIMULATOR
+			std::cout << "Built without the Myo SDK, using a synthetic arm." << std::endl;
+			if (streamEmg)
+			{
+				std::cout << "There is no EMG without an armband; ignoring --emg." << std::endl;
+			}
+			source = new SyntheticSource(speed, 50, 4, 0, syntheticDevices);
+#else
+			// First, we create a Hub with our application identifier. Be sure not to use the com.example namespace when
+			// publishing your application. The Hub provides access to one or more Myos.
+			myo::Hub *hub = new myo::Hub("com.example.hello-myo");
+
+			std::cout << "Attempting to find a Myo..." << std::endl;
+
+			// Next, we attempt to find a Myo to use. If a Myo is already paired in Myo Connect, this will return that Myo
+			// immediately.
+			// waitForMyo() takes a timeout value in milliseconds. In this case we will try to find a Myo for 10 seconds, and
+			// if that fails, the function will return a null pointer.
+			myo::Myo* myo = hub->waitForMyo(10000);
+
+			// If waitForMyo() returned a null pointer, we failed to find a Myo, so exit with an error message.
+			if (!myo) {
+				throw std::runtime_error("Unable to find a Myo!");
+			}
 
-		// We've found a Myo.
-		std::cout << "Connected to a Myo armband!" << std::endl << std::endl;
+			// We've found a Myo.
+			std::cout << "Connected to a Myo armband!" << std::endl << std::endl;
+
+			source = new MyoSource(hub, streamEmg);
+#endif
+		}
 
-		// Next we construct an instance of our DeviceListener, so that we can register it with the Hub.
+		// Next we construct an instance of our SampleListener, so that we can register it with the source.
 		DataCollector * collector = new DataCollector();
-		GestureRecorder * recorder = new GestureRecorder(myo, hub, collector);
-		GestureListener * listener = new GestureListener(myo, hub, collector);
-		Gestures gestures;
+		source->addListener(collector);
+
+		RawCapture * capture = 0;
+		if (!capturePath.empty())
+		{
+			// An hour at the Myo's 50 Hz IMU rate.
+			capture = new RawCapture(50 * 60 * 60);
+			capture->start();
+			// The capture holds one armband's data; with several, it follows the first one seen.
+			collector->device(0)->capture = capture;
+		}
+
+		SessionLog * sessionLog = 0;
+		if (!logPath.empty())
+		{
+			sessionLog = new SessionLog(logPath);
+			collector->setLog(sessionLog);
+		}
+
+		// From here on the source runs on its own thread; the recorder and listener are woken as samples arrive.
+		HubPump * pump = new HubPump(source, 1000/FREQUENCY);
+		pump->start();
+
+		// One recorder and listener per armband, each reading only that armband's samples.
+		GestureRecorder * recorders[MAX_DEVICES];
+		GestureListener * listeners[MAX_DEVICES];
+		for (int i = 0; i < MAX_DEVICES; i++)
+		{
+			recorders[i] = new GestureRecorder(pump, collector->device(i));
+			listeners[i] = new GestureListener(pump, collector->device(i));
+			listeners[i]->setMode(matchMode);
+		}
 
 		while (true)
 		{
-			std::cout << "\n1. Therapist - Record a gesture \n2. Patient - Perform reps of a gesture" << std::endl;
+			std::cout << "\n1. Therapist - Record a gesture \n2. Patient - Perform reps of a gesture"
+				<< "\n3. Patient - Perform any gesture" << std::endl;
 			int inputNum;
 			char saveChar;
-			std::cin >> inputNum;
+			// Stop when input runs out, e.g. a scripted session against a replay file.
+			if (!(std::cin >> inputNum))
+			{
+				break;
+			}
+
+			// With more than one armband connected, ask which one the exercise is for.
+			int device = 0;
+			int devices = collector->deviceCount();
+			if (inputNum >= 1 && inputNum <= 3 && devices > 1)
+			{
+				std::cout << "Which armband (1-" << devices << ")? ";
+				if (!(std::cin >> device) || device < 1 || device > devices)
+				{
+					std::cout << "Incorrect input!" << std::endl;
+					continue;
+				}
+				device--;
+			}
 
 			// Record gesture
 			if (inputNum == 1) {
-				recorder->record();
+				// Further takes of the same exercise are averaged into one template.
+				recorders[device]->record();
+				std::vector<Gesture*> takes(1, recorders[device]->getGesture());
+				while (true)
+				{
+					std::cout << "\nRecord another take to average with (Y/N)? ";
+					std::cin >> saveChar;
+					if (saveChar == 'Y' || saveChar == 'y')
+					{
+						recorders[device]->record();
+						takes.push_back(recorders[device]->getGesture());
+					}
+					else if (saveChar == 'N' || saveChar == 'n')
+					{
+						break;
+					}
+					else
+					{
+						std::cout << "Invalid!" << std::endl;
+					}
+				}
+				Gesture* recorded = takes[0];
+				if (takes.size() > 1)
+				{
+					recorded = averageGestures(takes);
+					std::cout << "Averaged " << takes.size() << " takes into " << recorded->getNumSteps() << " steps."
+						<< std::endl;
+				}
+
 				std::cout << "Do you want to save (Y/N)? ";
 				std::cin >> saveChar;
 				while (saveChar != 'Y' && saveChar != 'N' && saveChar != 'y' && saveChar != 'n')
@@ -542,8 +1989,9 @@ int main(int argc, char** argv)
 					std::string name;
 					std::cin >> name;
 
-					gestures.gest[name] = recorder->getGesture();
-					std::cout << "\nGesture " << name << " saved!" << std::endl;
+					gestures.add(name, recorded);
+					gestures.save(libraryPath);
+					std::cout << "\nGesture " << name << " saved! " << recorded->getNumSteps() << " steps." << std::endl;
 				}
 				else
 				{
@@ -569,19 +2017,74 @@ int main(int argc, char** argv)
 				//Sorry for the sloppy code. It's 6:14am...
 				std::cout << "How many reps would you like to perform? ";
 				std::cin >> totalReps;
+				if (listeners[device]->getMode() == matchSpring)
+				{
+					// One continuous set instead of one attempt per rep.
+					reps = listeners[device]->countReps(gestures.gest[gestures.keyAt(input - 1)], totalReps);
+					std::cout << "Reps: " << reps << " / " << totalReps << std::endl;
+					continue;
+				}
 				while (reps <= totalReps)
 				{
 					std::cout << "Reps: " << reps << " / " << totalReps << std::endl;
-					listener->isGesture(gestures.gest[gestures.keyAt(input - 1)]);
+					listeners[device]->isGesture(gestures.gest[gestures.keyAt(input - 1)]);
 					reps++;
 				}
 			}
+			else if (inputNum == 3 && listeners[device]->getMode() == matchDtw)
+			{
+				// Record the attempt as a whole, then find the closest exercise in the library.
+				std::cout << "Perform the exercise, then double tap." << std::endl;
+				recorders[device]->record();
+				float distance;
+				std::string name = gestures.nearest(recorders[device]->getGesture(), distance);
+				if (name.empty() || distance > DTW_TOLERANCE)
+				{
+					std::cout << "\nNo gesture recognized." << std::endl;
+				}
+				else
+				{
+					std::cout << "\nRecognized " << name << " (distance " << distance << ")!" << std::endl;
+				}
+			}
+			else if (inputNum == 3)
+			{
+				// Recognize whichever exercise from the library the patient does.
+				std::string name = listeners[device]->isGesture(gestures);
+				if (name.empty())
+				{
+					std::cout << "\nNo gesture recognized." << std::endl;
+				}
+				else
+				{
+					std::cout << "\nRecognized " << name << "!" << std::endl;
+				}
+			}
 			else {
 				std::cout << "Incorrect input!" << std::endl;
 				continue;
 			}
 		}
 
+		pump->stop();
+		if (sessionLog)
+		{
+			sessionLog->stop();
+			if (sessionLog->recordsDropped() > 0)
+			{
+				std::cout << sessionLog->recordsDropped() << " samples were dropped from the session log." << std::endl;
+			}
+		}
+		if (!exportPath.empty())
+		{
+			gestures.exportJSON(exportPath);
+		}
+		if (capture)
+		{
+			capture->stop();
+			capture->writeReplay(capturePath, 0);
+		}
+		return 0;
 
 		// If a standard exception occurred, we print out its message and exit.
 	}
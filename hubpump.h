@@ -0,0 +1,135 @@
+#ifndef HUBPUMP_H
+#define HUBPUMP_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "samplesource.h"
+
+// Wakes consumers when the producer has queued new samples. notify() costs one atomic increment and one load while
+// nobody is asleep; it only touches the mutex to wake a consumer that is actually blocked in wait().
+class SampleSignal
+{
+public:
+	SampleSignal()
+		: sequence(0), waiters(0)
+	{
+	}
+
+	void notify()
+	{
+		sequence.fetch_add(1);
+		if (waiters.load() != 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			condition.notify_all();
+		}
+	}
+
+	// Take a ticket before checking for data, then pass it to wait() so a notify() in between is never missed.
+	uint64_t ticket() const
+	{
+		return sequence.load();
+	}
+
+	// Blocks until notify() has been called since ticket was taken, or until timeoutMs elapses.
+	void wait(uint64_t ticket, unsigned int timeoutMs)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		waiters.fetch_add(1);
+		condition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&] { return sequence.load() != ticket; });
+		waiters.fetch_sub(1);
+	}
+
+private:
+	std::atomic<uint64_t> sequence;
+	std::atomic<int> waiters;
+	std::mutex mutex;
+	std::condition_variable condition;
+};
+
+// Runs a sample source (normally the Myo hub) on its own thread so sensor events are dispatched as soon as they
+// arrive, independently of whatever the console thread is doing. Listeners registered on the source are called from
+// this thread.
+class HubPump
+{
+public:
+	HubPump(SampleSource* source, unsigned int sliceMs)
+		: source(source), sliceMs(sliceMs), running(false), failed(false), exhausted(false)
+	{
+	}
+
+	~HubPump()
+	{
+		stop();
+	}
+
+	void start()
+	{
+		if (running.exchange(true))
+		{
+			return;
+		}
+		thread = std::thread(&HubPump::pump, this);
+	}
+
+	void stop()
+	{
+		running = false;
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
+
+	// True once a finite source (a replay file, a bounded simulation) has delivered everything it had.
+	bool finished() const
+	{
+		return exhausted.load();
+	}
+
+	// Rethrows on the calling thread anything the hub threw on the pump thread, e.g. losing Myo Connect.
+	void check()
+	{
+		if (failed.load())
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	void pump()
+	{
+		try {
+			// run() dispatches events as they come in; the slice only bounds how long stop() has to wait.
+			while (running.load())
+			{
+				if (!source->run(sliceMs))
+				{
+					exhausted = true;
+					break;
+				}
+			}
+		}
+		catch (...) {
+			error = std::current_exception();
+			failed = true;
+			running = false;
+		}
+	}
+
+	SampleSource* source;
+	unsigned int sliceMs;
+	std::atomic<bool> running;
+	std::atomic<bool> failed;
+	std::atomic<bool> exhausted;
+	std::exception_ptr error;
+	std::thread thread;
+};
+
+#endif // HUBPUMP_H
@@ -0,0 +1,748 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Streaming JSON output. Values are appended to one buffer as they are written, with the commas worked out from a
+// stack of open containers, so a document of any size costs one pass and no temporaries. With a sink, the buffer is
+// written out whenever it passes flushBytes and by flush(); without one, the whole document is left in buffer().
+// clear() starts a new document but keeps the memory, so writing the next one allocates nothing.
+//
+// The writer trusts its caller to nest begin and end calls properly and to give every object member a key.
+class JsonWriter
+{
+public:
+	explicit JsonWriter(std::ostream* sink = 0, size_t flushBytes = 1 << 16)
+		: sink(sink), flushBytes(flushBytes), afterKey(false)
+	{
+	}
+
+	void clear()
+	{
+		out.clear();
+		untouched.clear();
+		afterKey = false;
+	}
+
+	const std::string& buffer() const
+	{
+		return out;
+	}
+
+	void beginObject()
+	{
+		open('{');
+	}
+
+	void endObject()
+	{
+		close('}');
+	}
+
+	void beginArray()
+	{
+		open('[');
+	}
+
+	void endArray()
+	{
+		close(']');
+	}
+
+	// The next member's name, inside an object.
+	void key(const char* name, size_t length)
+	{
+		separate();
+		quote(name, length);
+		out += ':';
+		afterKey = true;
+	}
+
+	void key(const char* name)
+	{
+		key(name, std::strlen(name));
+	}
+
+	void key(const std::string& name)
+	{
+		key(name.data(), name.size());
+	}
+
+	void value(int number)
+	{
+		separate();
+		// Filled from the end. Negated as unsigned so INT_MIN works too.
+		char digits[12];
+		char* first = digits + sizeof(digits);
+		uint32_t magnitude = number < 0 ? 0u - static_cast<uint32_t>(number) : static_cast<uint32_t>(number);
+		do
+		{
+			*--first = static_cast<char>('0' + magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude != 0);
+		if (number < 0)
+		{
+			*--first = '-';
+		}
+		out.append(first, digits + sizeof(digits) - first);
+		written();
+	}
+
+	// Nine significant digits, enough to read back the same float. JSON has no infinities or NaNs; they are written
+	// as null.
+	void value(float number)
+	{
+		separate();
+		if (number != number || number - number != 0)
+		{
+			out.append("null", 4);
+		}
+		else
+		{
+			char text[32];
+			int n = std::snprintf(text, sizeof(text), "%.9g", number);
+			out.append(text, n);
+		}
+		written();
+	}
+
+	void value(const char* text, size_t length)
+	{
+		separate();
+		quote(text, length);
+		written();
+	}
+
+	void value(const char* text)
+	{
+		value(text, std::strlen(text));
+	}
+
+	void value(const std::string& text)
+	{
+		value(text.data(), text.size());
+	}
+
+	void value(bool flag)
+	{
+		separate();
+		if (flag)
+		{
+			out.append("true", 4);
+		}
+		else
+		{
+			out.append("false", 5);
+		}
+		written();
+	}
+
+	// Writes out everything buffered so far, if there is a sink.
+	void flush()
+	{
+		if (sink != 0 && !out.empty())
+		{
+			sink->write(out.data(), out.size());
+			out.clear();
+		}
+	}
+
+private:
+	void open(char bracket)
+	{
+		separate();
+		out += bracket;
+		untouched.push_back(true);
+	}
+
+	void close(char bracket)
+	{
+		out += bracket;
+		untouched.pop_back();
+		written();
+	}
+
+	// A comma before every member or element but the first. A value right after its key needs none.
+	void separate()
+	{
+		if (afterKey)
+		{
+			afterKey = false;
+			return;
+		}
+		if (!untouched.empty())
+		{
+			if (!untouched.back())
+			{
+				out += ',';
+			}
+			untouched.back() = false;
+		}
+	}
+
+	void written()
+	{
+		if (sink != 0 && out.size() >= flushBytes)
+		{
+			flush();
+		}
+	}
+
+	// text as a JSON string: quotes, backslashes and control characters escaped, everything else, UTF-8 included,
+	// as it is.
+	void quote(const char* text, size_t length)
+	{
+		static const char hex[] = "0123456789abcdef";
+		out += '"';
+		size_t run = 0;
+		for (size_t i = 0; i < length; i++)
+		{
+			unsigned char c = static_cast<unsigned char>(text[i]);
+			if (c >= 0x20 && c != '"' && c != '\\')
+			{
+				continue;
+			}
+			out.append(text + run, i - run);
+			run = i + 1;
+			out += '\\';
+			switch (c)
+			{
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '\n': out += 'n'; break;
+			case '\r': out += 'r'; break;
+			case '\t': out += 't'; break;
+			default:
+				out.append("u00", 3);
+				out += hex[c >> 4];
+				out += hex[c & 15];
+			}
+		}
+		out.append(text + run, length - run);
+		out += '"';
+	}
+
+	std::ostream* sink;
+	size_t flushBytes;
+	std::string out;
+
+	// One flag per open container: nothing written in it yet.
+	std::vector<char> untouched;
+	bool afterKey;
+};
+
+enum JsonToken
+{
+	jsonBeginObject,
+	jsonEndObject,
+	jsonBeginArray,
+	jsonEndArray,
+	jsonKey,
+	jsonString,
+	jsonNumber,
+	jsonTrue,
+	jsonFalse,
+	jsonNull,
+	jsonEnd
+};
+
+// Pull parsing straight out of a buffer, e.g. a MappedFile: each next() returns the next token of the document and
+// the caller decides what to do with it, so nothing is built that the caller doesn't ask for. Keys, strings and
+// numbers are kept as where they lie in the buffer; text() decodes one into a string the caller can reuse, and
+// textEquals() compares without decoding into anything. Nesting is tracked in a fixed stack, so parsing allocates
+// nothing at all.
+//
+// The whole grammar is checked as it goes (RFC 8259, without a byte-order mark), and anything malformed, including
+// nesting deeper than MAX_DEPTH, throws with the byte offset. The buffer must outlive the reader.
+class JsonReader
+{
+public:
+	enum { MAX_DEPTH = 64 };
+
+	JsonReader(const char* data, size_t size)
+		: start(data), position(data), end(data + size), depth(0), afterKey(false), afterValue(false), done(false),
+		textBegin(0), textEnd(0), escaped(false)
+	{
+	}
+
+	JsonToken next()
+	{
+		skipSpace();
+		if (done)
+		{
+			if (position != end)
+			{
+				fail("more after the end of the document");
+			}
+			return jsonEnd;
+		}
+		if (afterKey)
+		{
+			if (position == end || *position != ':')
+			{
+				fail("expected ':'");
+			}
+			position++;
+			afterKey = false;
+			return parseValue();
+		}
+		if (depth == 0)
+		{
+			return parseValue();
+		}
+
+		char closing = stack[depth - 1] == '{' ? '}' : ']';
+		if (position != end && *position == closing)
+		{
+			position++;
+			depth--;
+			finishValue();
+			return closing == '}' ? jsonEndObject : jsonEndArray;
+		}
+		if (afterValue)
+		{
+			if (position == end || *position != ',')
+			{
+				fail(closing == '}' ? "expected ',' or '}'" : "expected ',' or ']'");
+			}
+			position++;
+			skipSpace();
+		}
+		if (closing == ']')
+		{
+			return parseValue();
+		}
+		if (position == end || *position != '"')
+		{
+			fail("expected a key");
+		}
+		parseString();
+		afterKey = true;
+		return jsonKey;
+	}
+
+	// Reads the next token and throws unless it is token.
+	void expect(JsonToken token)
+	{
+		if (next() != token)
+		{
+			fail("unexpected token");
+		}
+	}
+
+	// Reads the next element of an array: false at the array's end, otherwise throws unless it starts with token.
+	bool nextElement(JsonToken token)
+	{
+		JsonToken found = next();
+		if (found == jsonEndArray)
+		{
+			return false;
+		}
+		if (found != token)
+		{
+			fail("unexpected token");
+		}
+		return true;
+	}
+
+	// Skips the value after a key, or the next element of an array, however deeply nested.
+	void skip()
+	{
+		int level = 0;
+		do
+		{
+			JsonToken token = next();
+			if (token == jsonBeginObject || token == jsonBeginArray)
+			{
+				level++;
+			}
+			else if (token == jsonEndObject || token == jsonEndArray)
+			{
+				level--;
+			}
+			else if (token == jsonEnd)
+			{
+				fail("nothing left to skip");
+			}
+		} while (level > 0);
+	}
+
+	// The last key or string, decoded, replacing what was in out.
+	void text(std::string& out) const
+	{
+		out.clear();
+		if (!escaped)
+		{
+			out.append(textBegin, textEnd - textBegin);
+			return;
+		}
+		const char* p = textBegin;
+		char utf8[4];
+		while (p < textEnd)
+		{
+			out.append(utf8, decode(p, utf8));
+		}
+	}
+
+	// Whether the last key or string, decoded, is exactly s.
+	bool textEquals(const char* s) const
+	{
+		size_t length = std::strlen(s);
+		if (!escaped)
+		{
+			return static_cast<size_t>(textEnd - textBegin) == length && std::memcmp(textBegin, s, length) == 0;
+		}
+		const char* p = textBegin;
+		size_t matched = 0;
+		char utf8[4];
+		while (p < textEnd)
+		{
+			int n = decode(p, utf8);
+			if (matched + n > length || std::memcmp(utf8, s + matched, n) != 0)
+			{
+				return false;
+			}
+			matched += n;
+		}
+		return matched == length;
+	}
+
+	// The last number, after jsonNumber.
+	double number() const
+	{
+		char copy[64];
+		size_t length = textEnd - textBegin;
+		if (length >= sizeof(copy))
+		{
+			fail("number too long");
+		}
+		std::memcpy(copy, textBegin, length);
+		copy[length] = 0;
+		return std::strtod(copy, 0);
+	}
+
+	// The last number, after jsonNumber, which must be a whole number that fits in an int.
+	int integer() const
+	{
+		const char* p = textBegin;
+		bool negative = *p == '-';
+		if (negative)
+		{
+			p++;
+		}
+		int64_t magnitude = 0;
+		for (; p < textEnd; p++)
+		{
+			if (*p < '0' || *p > '9' || magnitude > (int64_t(1) << 31))
+			{
+				fail("expected an integer");
+			}
+			magnitude = magnitude * 10 + (*p - '0');
+		}
+		int64_t result = negative ? -magnitude : magnitude;
+		if (result < INT32_MIN || result > INT32_MAX)
+		{
+			fail("integer out of range");
+		}
+		return static_cast<int>(result);
+	}
+
+	// Bytes consumed so far.
+	size_t offset() const
+	{
+		return position - start;
+	}
+
+private:
+	void fail(const char* problem) const
+	{
+		throw std::runtime_error(std::string("Malformed JSON at byte ") + std::to_string(position - start) + ": " +
+			problem);
+	}
+
+	void skipSpace()
+	{
+		while (position != end && (*position == ' ' || *position == '\n' || *position == '\r' || *position == '\t'))
+		{
+			position++;
+		}
+	}
+
+	// A value just ended: the container it was in now needs a comma or its end, or, at the top, the document ends.
+	void finishValue()
+	{
+		afterValue = true;
+		if (depth == 0)
+		{
+			done = true;
+		}
+	}
+
+	JsonToken parseValue()
+	{
+		skipSpace();
+		if (position == end)
+		{
+			fail("unexpected end");
+		}
+		char c = *position;
+		if (c == '{' || c == '[')
+		{
+			if (depth == MAX_DEPTH)
+			{
+				fail("nested too deeply");
+			}
+			stack[depth++] = c;
+			position++;
+			afterValue = false;
+			return c == '{' ? jsonBeginObject : jsonBeginArray;
+		}
+		if (c == '"')
+		{
+			parseString();
+			finishValue();
+			return jsonString;
+		}
+		if (c == '-' || (c >= '0' && c <= '9'))
+		{
+			parseNumber();
+			finishValue();
+			return jsonNumber;
+		}
+		if (literal("true"))
+		{
+			finishValue();
+			return jsonTrue;
+		}
+		if (literal("false"))
+		{
+			finishValue();
+			return jsonFalse;
+		}
+		if (literal("null"))
+		{
+			finishValue();
+			return jsonNull;
+		}
+		fail("expected a value");
+		return jsonEnd;
+	}
+
+	bool literal(const char* word)
+	{
+		size_t length = std::strlen(word);
+		if (static_cast<size_t>(end - position) < length || std::memcmp(position, word, length) != 0)
+		{
+			return false;
+		}
+		position += length;
+		return true;
+	}
+
+	// Checks the string starting at the quote under position and notes where its contents are.
+	void parseString()
+	{
+		position++;
+		textBegin = position;
+		escaped = false;
+		while (true)
+		{
+			if (position == end)
+			{
+				fail("unterminated string");
+			}
+			unsigned char c = static_cast<unsigned char>(*position);
+			if (c == '"')
+			{
+				break;
+			}
+			if (c < 0x20)
+			{
+				fail("control character in string");
+			}
+			if (c == '\\')
+			{
+				escaped = true;
+				position++;
+				if (position == end || std::strchr("\"\\/bfnrtu", *position) == 0 || *position == 0)
+				{
+					fail("bad escape");
+				}
+				if (*position == 'u')
+				{
+					for (int k = 1; k <= 4; k++)
+					{
+						if (position + k == end || hexDigit(position[k]) < 0)
+						{
+							fail("bad \\u escape");
+						}
+					}
+					position += 4;
+				}
+			}
+			position++;
+		}
+		textEnd = position;
+		position++;
+	}
+
+	void parseNumber()
+	{
+		textBegin = position;
+		if (*position == '-')
+		{
+			position++;
+		}
+		if (position != end && *position == '0')
+		{
+			position++;
+		}
+		else if (!digits())
+		{
+			fail("bad number");
+		}
+		if (position != end && *position == '.')
+		{
+			position++;
+			if (!digits())
+			{
+				fail("bad number");
+			}
+		}
+		if (position != end && (*position == 'e' || *position == 'E'))
+		{
+			position++;
+			if (position != end && (*position == '+' || *position == '-'))
+			{
+				position++;
+			}
+			if (!digits())
+			{
+				fail("bad number");
+			}
+		}
+		textEnd = position;
+	}
+
+	bool digits()
+	{
+		const char* first = position;
+		while (position != end && *position >= '0' && *position <= '9')
+		{
+			position++;
+		}
+		return position != first;
+	}
+
+	static int hexDigit(char c)
+	{
+		if (c >= '0' && c <= '9')
+		{
+			return c - '0';
+		}
+		if (c >= 'a' && c <= 'f')
+		{
+			return c - 'a' + 10;
+		}
+		if (c >= 'A' && c <= 'F')
+		{
+			return c - 'A' + 10;
+		}
+		return -1;
+	}
+
+	static uint32_t hex4(const char* p)
+	{
+		return (hexDigit(p[0]) << 12) | (hexDigit(p[1]) << 8) | (hexDigit(p[2]) << 4) | hexDigit(p[3]);
+	}
+
+	// Decodes one character of a checked string at p into UTF-8 and moves p past it. Returns the bytes written. A
+	// \u escape of half a surrogate pair without its other half becomes U+FFFD.
+	static int decode(const char*& p, char* utf8)
+	{
+		if (*p != '\\')
+		{
+			utf8[0] = *p++;
+			return 1;
+		}
+		char c = p[1];
+		p += 2;
+		switch (c)
+		{
+		case 'b': utf8[0] = '\b'; return 1;
+		case 'f': utf8[0] = '\f'; return 1;
+		case 'n': utf8[0] = '\n'; return 1;
+		case 'r': utf8[0] = '\r'; return 1;
+		case 't': utf8[0] = '\t'; return 1;
+		case 'u': break;
+		default: utf8[0] = c; return 1;
+		}
+
+		uint32_t code = hex4(p);
+		p += 4;
+		if (code >= 0xd800 && code < 0xdc00 && p[0] == '\\' && p[1] == 'u')
+		{
+			uint32_t low = hex4(p + 2);
+			if (low >= 0xdc00 && low < 0xe000)
+			{
+				code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+				p += 6;
+			}
+		}
+		if (code >= 0xd800 && code < 0xe000)
+		{
+			code = 0xfffd;
+		}
+		if (code < 0x80)
+		{
+			utf8[0] = static_cast<char>(code);
+			return 1;
+		}
+		if (code < 0x800)
+		{
+			utf8[0] = static_cast<char>(0xc0 | (code >> 6));
+			utf8[1] = static_cast<char>(0x80 | (code & 0x3f));
+			return 2;
+		}
+		if (code < 0x10000)
+		{
+			utf8[0] = static_cast<char>(0xe0 | (code >> 12));
+			utf8[1] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+			utf8[2] = static_cast<char>(0x80 | (code & 0x3f));
+			return 3;
+		}
+		utf8[0] = static_cast<char>(0xf0 | (code >> 18));
+		utf8[1] = static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+		utf8[2] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+		utf8[3] = static_cast<char>(0x80 | (code & 0x3f));
+		return 4;
+	}
+
+	const char* start;
+	const char* position;
+	const char* end;
+
+	// The open containers, '{' or '['.
+	char stack[MAX_DEPTH];
+	int depth;
+
+	// A key was just read, so a ':' and its value come next; a value was just read, so a ',' or the container's end
+	// comes next; the top-level value has been read.
+	bool afterKey;
+	bool afterValue;
+	bool done;
+
+	// The last key, string or number as it lies in the buffer, and whether a string has escapes to decode.
+	const char* textBegin;
+	const char* textEnd;
+	bool escaped;
+};
+
+#endif // JSON_H
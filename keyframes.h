@@ -0,0 +1,141 @@
+#ifndef KEYFRAMES_H
+#define KEYFRAMES_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// A recording compressed to keyframes joined by straight lines (piecewise-linear approximation). Arm movements are
+// mostly smooth sweeps, which the filtered stream records as long runs of one-bucket steps in the same direction;
+// each run becomes one segment. Every original step lies within maxError buckets, on every axis, of the line between
+// the keyframes around it, so reconstruct() gives the recording back to within that at its original length.
+//
+// Keyframes are original steps, and compress() picks the fewest that keep the bound: the shortest path through the
+// steps where an edge is any span the line between its ends covers. That is cubic in the length of the recording,
+// which for the few hundred steps of an exercise is a few milliseconds, so it is left until a template is first
+// matched against keyframes and kept from then on.
+struct KeyframeTrack
+{
+	// The original step of each keyframe, from 0 to length() - 1, and its position.
+	std::vector<int> index;
+	std::vector<float> roll, pitch, yaw;
+
+	KeyframeTrack()
+		: steps(0)
+	{
+	}
+
+	// Steps in the original recording.
+	int length() const
+	{
+		return steps;
+	}
+
+	int keyframes() const
+	{
+		return static_cast<int>(index.size());
+	}
+
+	void compress(const float* stepRoll, const float* stepPitch, const float* stepYaw, int count, float maxError)
+	{
+		steps = count;
+		index.clear();
+		roll.clear();
+		pitch.clear();
+		yaw.clear();
+		if (count == 0)
+		{
+			return;
+		}
+
+		// fewest[j]: keyframes needed up to step j when j is one; from[j]: the keyframe before it.
+		std::vector<int> fewest(count, count + 1);
+		std::vector<int> from(count, -1);
+		fewest[0] = 1;
+		for (int j = 1; j < count; j++)
+		{
+			// Longer spans first, so ties keep the longest last segment.
+			for (int i = 0; i < j; i++)
+			{
+				if (fewest[i] + 1 < fewest[j] && covers(stepRoll, stepPitch, stepYaw, i, j, maxError))
+				{
+					fewest[j] = fewest[i] + 1;
+					from[j] = i;
+				}
+			}
+		}
+
+		for (int k = count - 1; k >= 0; k = from[k])
+		{
+			index.push_back(k);
+		}
+		std::reverse(index.begin(), index.end());
+		for (size_t k = 0; k < index.size(); k++)
+		{
+			roll.push_back(stepRoll[index[k]]);
+			pitch.push_back(stepPitch[index[k]]);
+			yaw.push_back(stepYaw[index[k]]);
+		}
+	}
+
+	// Takes the keyframes compress() picked earlier, given as their steps, instead of searching again. keyframes must
+	// run from step 0 to count - 1 in increasing order.
+	void select(const float* stepRoll, const float* stepPitch, const float* stepYaw, int count, const int* keyframes,
+		int n)
+	{
+		steps = count;
+		index.assign(keyframes, keyframes + n);
+		roll.clear();
+		pitch.clear();
+		yaw.clear();
+		for (int k = 0; k < n; k++)
+		{
+			roll.push_back(stepRoll[index[k]]);
+			pitch.push_back(stepPitch[index[k]]);
+			yaw.push_back(stepYaw[index[k]]);
+		}
+	}
+
+	// Writes the length() interpolated steps.
+	void reconstruct(float* outRoll, float* outPitch, float* outYaw) const
+	{
+		for (int k = 0; k + 1 < keyframes(); k++)
+		{
+			int span = index[k + 1] - index[k];
+			for (int i = index[k]; i < index[k + 1]; i++)
+			{
+				float t = static_cast<float>(i - index[k]) / span;
+				outRoll[i] = roll[k] + (roll[k + 1] - roll[k]) * t;
+				outPitch[i] = pitch[k] + (pitch[k + 1] - pitch[k]) * t;
+				outYaw[i] = yaw[k] + (yaw[k + 1] - yaw[k]) * t;
+			}
+		}
+		if (keyframes() > 0)
+		{
+			outRoll[steps - 1] = roll.back();
+			outPitch[steps - 1] = pitch.back();
+			outYaw[steps - 1] = yaw.back();
+		}
+	}
+
+private:
+	// Whether the line from step i to step j passes within maxError of every step between them.
+	static bool covers(const float* r, const float* p, const float* y, int i, int j, float maxError)
+	{
+		for (int k = i + 1; k < j; k++)
+		{
+			float t = static_cast<float>(k - i) / (j - i);
+			if (std::fabs(r[k] - (r[i] + (r[j] - r[i]) * t)) > maxError ||
+				std::fabs(p[k] - (p[i] + (p[j] - p[i]) * t)) > maxError ||
+				std::fabs(y[k] - (y[i] + (y[j] - y[i]) * t)) > maxError)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int steps;
+};
+
+#endif // KEYFRAMES_H
@@ -0,0 +1,366 @@
+#ifndef LIBRARYFILE_H
+#define LIBRARYFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+#include "samplesource.h"
+
+// The gesture library on disk, so recorded exercises outlive the process. The file is made to be used where it lies:
+// it is opened with MappedFile, checked, and read straight out of the mapping, so opening a library of thousands of
+// templates costs the same as opening one, and processes that open the same library share its pages.
+//
+//   header        LibraryHeader: what the file is, the quantizer it was recorded with, counts and section offsets
+//   entries       one LibraryEntry per template: where its name and its runs of the arrays below are
+//   names         every name back to back, without terminators
+//   steps         one StoredStep per step of every template, template after template
+//   orientations  one quaternion per step
+//   tolerances    one byte per step, for the templates that have their own
+//   keyframes     the step index of each keyframe (see keyframes.h)
+//
+// Every section starts on a 16-byte boundary. Numbers are stored in the writing machine's byte order, which is
+// little-endian on everything the app runs on; the header records it, and files from a machine with the other order
+// are rejected rather than converted.
+
+// A step's roll, pitch and yaw buckets.
+struct StoredStep
+{
+	uint8_t roll;
+	uint8_t pitch;
+	uint8_t yaw;
+};
+
+struct LibraryHeader
+{
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t version;
+	uint32_t bins;
+	uint32_t templates;
+	uint64_t fileSize;
+	uint64_t nameBytes;
+	uint64_t steps;
+	uint64_t tolerances;
+	uint64_t keyframes;
+	uint64_t entryOffset;
+	uint64_t nameOffset;
+	uint64_t stepOffset;
+	uint64_t orientationOffset;
+	uint64_t toleranceOffset;
+	uint64_t keyframeOffset;
+};
+
+// Runs are start and count in their section. A template without its own tolerances has none.
+struct LibraryEntry
+{
+	uint32_t nameStart;
+	uint32_t nameLength;
+	uint32_t firstStep;
+	uint32_t steps;
+	uint32_t firstTolerance;
+	uint32_t tolerances;
+	uint32_t firstKeyframe;
+	uint32_t keyframes;
+};
+
+static_assert(sizeof(StoredStep) == 3, "StoredStep must be packed");
+static_assert(sizeof(LibraryHeader) == 112, "LibraryHeader must not be padded");
+static_assert(sizeof(LibraryEntry) == 32, "LibraryEntry must not be padded");
+static_assert(sizeof(Quat) == 4 * sizeof(float), "Quat must be four packed floats");
+
+const char LIBRARY_MAGIC[8] = { 'M', 'Y', 'O', 'G', 'L', 'I', 'B', 0 };
+const uint32_t LIBRARY_BYTE_ORDER = 0x01020304;
+const uint32_t LIBRARY_VERSION = 1;
+
+// One template to write.
+struct LibraryTemplate
+{
+	std::string name;
+	std::vector<StoredStep> steps;
+
+	// One per step.
+	std::vector<Quat> orientations;
+
+	// One per step, or none to use the matchers' own.
+	std::vector<uint8_t> tolerances;
+
+	std::vector<uint32_t> keyframes;
+};
+
+// Pads out with zeros up to offset, the start of the next section.
+inline void padTo(std::ofstream& out, uint64_t offset)
+{
+	const char zeros[16] = { 0 };
+	out.write(zeros, static_cast<std::streamsize>(offset - static_cast<uint64_t>(out.tellp())));
+}
+
+// Writes templates, recorded with a quantizer of the given bins, as a library file at path. The file is written
+// next to path and then moved over it, so a reader never sees half a library.
+inline void writeLibrary(const std::string& path, int bins, const std::vector<LibraryTemplate>& templates)
+{
+	if (bins < 0 || bins > 255)
+	{
+		throw std::runtime_error("Library steps hold at most 255 buckets per axis");
+	}
+	LibraryHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, LIBRARY_MAGIC, sizeof(header.magic));
+	header.byteOrder = LIBRARY_BYTE_ORDER;
+	header.version = LIBRARY_VERSION;
+	header.bins = static_cast<uint32_t>(bins);
+	header.templates = static_cast<uint32_t>(templates.size());
+
+	std::vector<LibraryEntry> entries(templates.size());
+	for (size_t t = 0; t < templates.size(); t++)
+	{
+		const LibraryTemplate& source = templates[t];
+		if (source.orientations.size() != source.steps.size() ||
+			(!source.tolerances.empty() && source.tolerances.size() != source.steps.size()))
+		{
+			throw std::runtime_error("Template " + source.name + " needs one orientation and tolerance per step");
+		}
+		LibraryEntry& entry = entries[t];
+		entry.nameStart = static_cast<uint32_t>(header.nameBytes);
+		entry.nameLength = static_cast<uint32_t>(source.name.size());
+		entry.firstStep = static_cast<uint32_t>(header.steps);
+		entry.steps = static_cast<uint32_t>(source.steps.size());
+		entry.firstTolerance = static_cast<uint32_t>(header.tolerances);
+		entry.tolerances = static_cast<uint32_t>(source.tolerances.size());
+		entry.firstKeyframe = static_cast<uint32_t>(header.keyframes);
+		entry.keyframes = static_cast<uint32_t>(source.keyframes.size());
+		header.nameBytes += source.name.size();
+		header.steps += source.steps.size();
+		header.tolerances += source.tolerances.size();
+		header.keyframes += source.keyframes.size();
+	}
+	if (header.nameBytes > UINT32_MAX || header.steps > UINT32_MAX)
+	{
+		throw std::runtime_error("Library too large for " + path);
+	}
+
+	uint64_t offset = sizeof(LibraryHeader);
+	header.entryOffset = offset;
+	offset = (offset + entries.size() * sizeof(LibraryEntry) + 15) / 16 * 16;
+	header.nameOffset = offset;
+	offset = (offset + header.nameBytes + 15) / 16 * 16;
+	header.stepOffset = offset;
+	offset = (offset + header.steps * sizeof(StoredStep) + 15) / 16 * 16;
+	header.orientationOffset = offset;
+	offset = (offset + header.steps * sizeof(Quat) + 15) / 16 * 16;
+	header.toleranceOffset = offset;
+	offset = (offset + header.tolerances + 15) / 16 * 16;
+	header.keyframeOffset = offset;
+	header.fileSize = offset + header.keyframes * sizeof(uint32_t);
+
+	std::string temporary = path + ".tmp";
+	try {
+		{
+			std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				throw std::runtime_error("Unable to write library to " + temporary);
+			}
+			// Sections are written in order, each padded out to where the next one starts.
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			if (!entries.empty())
+			{
+				out.write(reinterpret_cast<const char*>(&entries[0]), entries.size() * sizeof(LibraryEntry));
+			}
+			padTo(out, header.nameOffset);
+			for (size_t t = 0; t < templates.size(); t++)
+			{
+				out.write(templates[t].name.data(), templates[t].name.size());
+			}
+			padTo(out, header.stepOffset);
+			for (size_t t = 0; t < templates.size(); t++)
+			{
+				if (!templates[t].steps.empty())
+				{
+					out.write(reinterpret_cast<const char*>(&templates[t].steps[0]),
+						templates[t].steps.size() * sizeof(StoredStep));
+				}
+			}
+			padTo(out, header.orientationOffset);
+			for (size_t t = 0; t < templates.size(); t++)
+			{
+				if (!templates[t].orientations.empty())
+				{
+					out.write(reinterpret_cast<const char*>(&templates[t].orientations[0]),
+						templates[t].orientations.size() * sizeof(Quat));
+				}
+			}
+			padTo(out, header.toleranceOffset);
+			for (size_t t = 0; t < templates.size(); t++)
+			{
+				if (!templates[t].tolerances.empty())
+				{
+					out.write(reinterpret_cast<const char*>(&templates[t].tolerances[0]),
+						templates[t].tolerances.size());
+				}
+			}
+			padTo(out, header.keyframeOffset);
+			for (size_t t = 0; t < templates.size(); t++)
+			{
+				if (!templates[t].keyframes.empty())
+				{
+					out.write(reinterpret_cast<const char*>(&templates[t].keyframes[0]),
+						templates[t].keyframes.size() * sizeof(uint32_t));
+				}
+			}
+			out.flush();
+			if (!out)
+			{
+				throw std::runtime_error("Unable to write library to " + temporary);
+			}
+		}
+		replaceFile(temporary, path);
+	}
+	catch (...) {
+		// Don't leave half a file behind.
+		std::remove(temporary.c_str());
+		throw;
+	}
+}
+
+// A library file, mapped and checked. Everything it hands out points into the mapping and lives as long as it does.
+//
+// Opening checks the header and every entry, so nothing read through it can point outside the file, and that the
+// keyframes run from a template's first step to its last. Step values are not checked; the matchers clamp them.
+class LibraryFile
+{
+public:
+	explicit LibraryFile(const std::string& path)
+		: file(path), path(path)
+	{
+		if (file.size() < sizeof(LibraryHeader))
+		{
+			fail("is too short");
+		}
+		header = reinterpret_cast<const LibraryHeader*>(file.data());
+		if (std::memcmp(header->magic, LIBRARY_MAGIC, sizeof(header->magic)) != 0)
+		{
+			fail("is not a gesture library");
+		}
+		if (header->byteOrder != LIBRARY_BYTE_ORDER)
+		{
+			fail("was written with another byte order");
+		}
+		if (header->version != LIBRARY_VERSION)
+		{
+			fail("is version " + std::to_string(header->version) + ", expected " + std::to_string(LIBRARY_VERSION));
+		}
+		if (header->fileSize != file.size())
+		{
+			fail("is truncated");
+		}
+		section(header->entryOffset, header->templates, sizeof(LibraryEntry));
+		section(header->nameOffset, header->nameBytes, 1);
+		section(header->stepOffset, header->steps, sizeof(StoredStep));
+		section(header->orientationOffset, header->steps, sizeof(Quat));
+		section(header->toleranceOffset, header->tolerances, 1);
+		section(header->keyframeOffset, header->keyframes, sizeof(uint32_t));
+
+		entries = reinterpret_cast<const LibraryEntry*>(file.data() + header->entryOffset);
+		for (uint32_t t = 0; t < header->templates; t++)
+		{
+			const LibraryEntry& entry = entries[t];
+			if (static_cast<uint64_t>(entry.nameStart) + entry.nameLength > header->nameBytes ||
+				static_cast<uint64_t>(entry.firstStep) + entry.steps > header->steps ||
+				static_cast<uint64_t>(entry.firstTolerance) + entry.tolerances > header->tolerances ||
+				(entry.tolerances != 0 && entry.tolerances != entry.steps) ||
+				static_cast<uint64_t>(entry.firstKeyframe) + entry.keyframes > header->keyframes)
+			{
+				fail("has a template outside the file");
+			}
+			const uint32_t* index = keyframes(static_cast<int>(t));
+			for (uint32_t k = 0; k < entry.keyframes; k++)
+			{
+				if (index[k] >= entry.steps || (k == 0 ? index[k] != 0 : index[k] <= index[k - 1]) ||
+					(k + 1 == entry.keyframes && index[k] != entry.steps - 1))
+				{
+					fail("has keyframes out of order");
+				}
+			}
+		}
+	}
+
+	// Templates in the file.
+	int size() const
+	{
+		return static_cast<int>(header->templates);
+	}
+
+	// Buckets per axis of the quantizer the steps were recorded with.
+	int bins() const
+	{
+		return static_cast<int>(header->bins);
+	}
+
+	std::string name(int t) const
+	{
+		return std::string(file.data() + header->nameOffset + entries[t].nameStart, entries[t].nameLength);
+	}
+
+	int stepCount(int t) const
+	{
+		return static_cast<int>(entries[t].steps);
+	}
+
+	const StoredStep* steps(int t) const
+	{
+		return reinterpret_cast<const StoredStep*>(file.data() + header->stepOffset) + entries[t].firstStep;
+	}
+
+	const Quat* orientations(int t) const
+	{
+		return reinterpret_cast<const Quat*>(file.data() + header->orientationOffset) + entries[t].firstStep;
+	}
+
+	// One per step, or null if the template has no tolerances of its own.
+	const uint8_t* tolerances(int t) const
+	{
+		if (entries[t].tolerances == 0)
+		{
+			return 0;
+		}
+		return reinterpret_cast<const uint8_t*>(file.data() + header->toleranceOffset) + entries[t].firstTolerance;
+	}
+
+	int keyframeCount(int t) const
+	{
+		return static_cast<int>(entries[t].keyframes);
+	}
+
+	const uint32_t* keyframes(int t) const
+	{
+		return reinterpret_cast<const uint32_t*>(file.data() + header->keyframeOffset) + entries[t].firstKeyframe;
+	}
+
+private:
+	// Checks that count items of size bytes from offset, which must be 16-byte aligned, lie within the file.
+	void section(uint64_t offset, uint64_t count, uint64_t size) const
+	{
+		if (offset % 16 != 0 || offset > file.size() || count > (file.size() - offset) / size)
+		{
+			fail("has a section outside the file");
+		}
+	}
+
+	void fail(const std::string& problem) const
+	{
+		throw std::runtime_error("Library " + path + " " + problem);
+	}
+
+	MappedFile file;
+	std::string path;
+	const LibraryHeader* header;
+	const LibraryEntry* entries;
+};
+
+#endif // LIBRARYFILE_H
@@ -0,0 +1,482 @@
+#ifndef LIBRARYMATCHER_H
+#define LIBRARYMATCHER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "threadpool.h"
+
+// Follows every template in a gesture library at once, with the same rules GestureListener uses for one: a sample
+// within tolerance of a template's next step advances it, and after maxStrikes misses in a row it starts over.
+//
+// Most samples can't advance most templates, so instead of testing every template, an inverted index maps each
+// coarse (roll, pitch, yaw) cell to the (template, step) pairs some sample in it could be within tolerance of. A cell
+// is twice the tolerance across, so the box of samples a step accepts overlaps at most two cells on each axis and the
+// step is listed in at most 8. Tolerances scale with the quantizer's buckets, so however fine those are, the whole
+// index is a couple of hundred lists. A sample only visits the pairs in its own cell, and a template is only touched
+// when its next step is one of them, which is then checked exactly, the way EulerAngle::equals() does. A cell can
+// list more pairs than there are templates, as it usually does for a small library; checking every template's next
+// step directly is cheaper then, so that is what happens instead. Misses are not applied as they happen; each
+// template remembers the last sample it saw, and the strikes for everything since are worked out in one go the next
+// time it is touched. See --bench library for how it compares with scanning every template.
+//
+// Adding a template only appends to the lists of the cells around its steps, so the index grows with the library
+// instead of being rebuilt. Disabling one leaves its entries behind until they make up half the index, and then
+// every list is swept of them at once.
+//
+// The index (LibraryIndex) is only read while matching, so any number of streams can be followed against one index,
+// each with its own LibraryCursor holding where every template has got to. LibraryMatcher is the two together, for
+// following a single stream.
+class LibraryIndex
+{
+public:
+	// Samples and steps span 0..bins on each axis, the range the quantizer produces, and bins can't pass 255. Cells
+	// are sized for steps with the default tolerance; a step given a wider one of its own is still matched exactly,
+	// but is listed in more cells.
+	LibraryIndex(int bins, int tolerance, int maxStrikes)
+		: bins(bins), side(2 * std::max(1, tolerance)), tolerance(tolerance), maxStrikes(maxStrikes), live(0),
+		entries(0), dead(0)
+	{
+		axis = bins / side + 1;
+		index.resize(static_cast<size_t>(axis) * axis * axis);
+		for (int b = 0; b <= bins; b++)
+		{
+			cellOf.push_back(b / side);
+		}
+	}
+
+	void clear()
+	{
+		for (size_t c = 0; c < index.size(); c++)
+		{
+			index[c].clear();
+		}
+		length.clear();
+		postings.clear();
+		first.clear();
+		steps.clear();
+		live = 0;
+		entries = 0;
+		dead = 0;
+	}
+
+	// Adds a template and returns its index. Empty templates are accepted but never match. tolerances, if given, has
+	// one per step and overrides the matcher's tolerance for that step.
+	int add(const int* roll, const int* pitch, const int* yaw, int count, const int* tolerances = 0)
+	{
+		int t = static_cast<int>(length.size());
+		length.push_back(count);
+		postings.push_back(0);
+		first.push_back(static_cast<int>(steps.size()));
+		if (count > 0)
+		{
+			live++;
+		}
+
+		for (int j = 0; j < count; j++)
+		{
+			int reach = std::min(255, tolerances ? tolerances[j] : tolerance);
+			Step step = { static_cast<uint8_t>(roll[j]), static_cast<uint8_t>(pitch[j]), static_cast<uint8_t>(yaw[j]),
+				static_cast<uint8_t>(reach) };
+			steps.push_back(step);
+
+			Entry entry = { t, j };
+			for (int r = coarse(roll[j] - reach); r <= coarse(roll[j] + reach); r++)
+			{
+				for (int p = coarse(pitch[j] - reach); p <= coarse(pitch[j] + reach); p++)
+				{
+					for (int y = coarse(yaw[j] - reach); y <= coarse(yaw[j] + reach); y++)
+					{
+						index[cell(r, p, y)].push_back(entry);
+						postings[t]++;
+					}
+				}
+			}
+		}
+		entries += postings[t];
+		return t;
+	}
+
+	// Takes a template out of the running, e.g. when a gesture is saved over. Its number is not given out again.
+	void disable(int t)
+	{
+		if (length[t] > 0)
+		{
+			live--;
+		}
+		length[t] = 0;
+		dead += postings[t];
+		postings[t] = 0;
+		if (dead * 2 > entries)
+		{
+			compact();
+		}
+	}
+
+	int size() const
+	{
+		return static_cast<int>(length.size());
+	}
+
+	// Index entries held, those of disabled templates not yet swept out included.
+	size_t entryCount() const
+	{
+		return entries;
+	}
+
+	// Bytes held by the index and the templates' steps.
+	size_t memoryBytes() const
+	{
+		size_t bytes = index.capacity() * sizeof(std::vector<Entry>) + (length.capacity() + first.capacity()) *
+			sizeof(int) + postings.capacity() * sizeof(size_t) + steps.capacity() * sizeof(Step);
+		for (size_t c = 0; c < index.size(); c++)
+		{
+			bytes += index[c].capacity() * sizeof(Entry);
+		}
+		return bytes;
+	}
+
+private:
+	friend class LibraryCursor;
+
+	struct Entry
+	{
+		int templateIndex;
+		int step;
+	};
+
+	// A template step and how far from it, in buckets on each axis, a sample may be.
+	struct Step
+	{
+		uint8_t roll;
+		uint8_t pitch;
+		uint8_t yaw;
+		uint8_t reach;
+
+		// Whether a sample is within reach on every axis. The three tests are combined without branching: which way
+		// each goes is close to random, and mispredicting them costs more than the tests.
+		bool accepts(int r, int p, int y) const
+		{
+			unsigned width = 2u * reach;
+			return (static_cast<unsigned>(r - roll + reach) <= width) & (static_cast<unsigned>(p - pitch + reach) <=
+				width) & (static_cast<unsigned>(y - yaw + reach) <= width);
+		}
+	};
+
+	// The cell along one axis that a bucket falls in, for buckets clamped to 0..bins.
+	int coarse(int bucket) const
+	{
+		return cellOf[std::min(bins, std::max(0, bucket))];
+	}
+
+	size_t cell(int roll, int pitch, int yaw) const
+	{
+		return (static_cast<size_t>(roll) * axis + pitch) * axis + yaw;
+	}
+
+	// Whether a sample is within tolerance of template t's step j.
+	bool accepts(int t, int j, int roll, int pitch, int yaw) const
+	{
+		return steps[first[t] + j].accepts(roll, pitch, yaw);
+	}
+
+	// Drops the entries and steps of every disabled template, keeping the rest in template order.
+	void compact()
+	{
+		size_t packed = 0;
+		for (size_t t = 0; t < length.size(); t++)
+		{
+			std::copy(steps.begin() + first[t], steps.begin() + first[t] + length[t], steps.begin() + packed);
+			first[t] = static_cast<int>(packed);
+			packed += length[t];
+		}
+		steps.resize(packed);
+
+		for (size_t c = 0; c < index.size(); c++)
+		{
+			std::vector<Entry>& list = index[c];
+			size_t kept = 0;
+			for (size_t k = 0; k < list.size(); k++)
+			{
+				if (length[list[k].templateIndex] != 0)
+				{
+					list[kept++] = list[k];
+				}
+			}
+			list.resize(kept);
+		}
+		entries -= dead;
+		dead = 0;
+	}
+
+	const std::vector<Entry>& candidates(int roll, int pitch, int yaw) const
+	{
+		return index[cell(coarse(roll), coarse(pitch), coarse(yaw))];
+	}
+
+	int bins;
+	int side;
+	int axis;
+	int tolerance;
+	int maxStrikes;
+	// The cell along one axis for each bucket, to keep a division per axis out of every sample.
+	std::vector<int> cellOf;
+
+	// For each cell, every (template, step) a sample in it could be within tolerance of, in template order.
+	std::vector<std::vector<Entry> > index;
+
+	// Per template: steps, 0 once disabled, entries in the index, 0 once disabled, and where its steps start in
+	// steps, every template's steps back to back for checking candidates exactly.
+	std::vector<int> length;
+	std::vector<size_t> postings;
+	std::vector<int> first;
+	std::vector<Step> steps;
+
+	// Templates with steps that aren't disabled.
+	int live;
+
+	// Entries in the index, and how many of them belong to disabled templates.
+	size_t entries;
+	size_t dead;
+};
+
+// One stream's progress through every template of a LibraryIndex. Templates added to the index since the cursor last
+// moved join it at their first step.
+class LibraryCursor
+{
+public:
+	LibraryCursor()
+		: scanned(-1), sample(0)
+	{
+	}
+
+	// Sends every template back to its first step.
+	void reset()
+	{
+		Progress start = { 0, 0 };
+		std::fill(progress.begin(), progress.end(), start);
+		std::fill(seen.begin(), seen.end(), sample - 1);
+	}
+
+	// Forgets every template, for when the index has been cleared.
+	void clear()
+	{
+		progress.clear();
+		seen.clear();
+		sample = 0;
+		scanned = -1;
+	}
+
+	// Advances every template of library by one sample. Returns the index of a template this sample completed, or -1.
+	// If several complete on the same sample, the one added first wins. A completed template starts over.
+	int push(const LibraryIndex& library, int roll, int pitch, int yaw)
+	{
+		if (progress.size() < library.length.size())
+		{
+			Progress start = { 0, 0 };
+			progress.resize(library.length.size(), start);
+			seen.resize(library.length.size(), sample - 1);
+		}
+		const std::vector<LibraryIndex::Entry>& candidates = library.candidates(roll, pitch, yaw);
+
+		int completed = -1;
+		if (candidates.size() > static_cast<size_t>(library.live))
+		{
+			// The miss rules are applied here and now, as a plain scan would, rather than caught up on later. Templates
+			// are only behind if the last sample wasn't a scan too.
+			const int* length = library.length.data();
+			const int* first = library.first.data();
+			const LibraryIndex::Step* steps = library.steps.data();
+			const int templates = library.size();
+			const int maxStrikes = library.maxStrikes;
+			const bool behind = scanned != sample - 1;
+			for (int t = 0; t < templates; t++)
+			{
+				if (length[t] == 0)
+				{
+					continue;
+				}
+				if (behind)
+				{
+					catchUp(t, maxStrikes);
+				}
+				Progress& current = progress[t];
+				const LibraryIndex::Step& next = steps[first[t] + current.position];
+				if (next.accepts(roll, pitch, yaw))
+				{
+					if (++current.position == length[t])
+					{
+						current.position = 0;
+						current.strikes = 0;
+						completed = completed < 0 ? t : completed;
+					}
+				}
+				else if (current.strikes >= maxStrikes)
+				{
+					current.position = 0;
+					current.strikes = 0;
+				}
+				else
+				{
+					current.strikes++;
+				}
+			}
+			scanned = sample;
+		}
+		else
+		{
+			for (size_t k = 0; k < candidates.size(); k++)
+			{
+				int t = candidates[k].templateIndex;
+				// A template with several steps in this cell only moves once per sample.
+				if (seen[t] == sample || library.length[t] == 0)
+				{
+					continue;
+				}
+				catchUp(t, library.maxStrikes);
+				Progress& current = progress[t];
+				if (current.position == candidates[k].step && library.accepts(t, current.position, roll, pitch, yaw))
+				{
+					seen[t] = sample;
+					if (++current.position == library.length[t])
+					{
+						current.position = 0;
+						current.strikes = 0;
+						if (completed < 0 || t < completed)
+						{
+							completed = t;
+						}
+					}
+				}
+			}
+		}
+		sample++;
+		return completed;
+	}
+
+private:
+	// A template's step it is waiting for and its strikes.
+	struct Progress
+	{
+		int position;
+		int strikes;
+	};
+
+	// Applies the misses between the last sample template t saw and this one. Each miss adds a strike, and the one
+	// after maxStrikes sends the template back to its first step with none, so the strikes just cycle from there.
+	void catchUp(int t, int maxStrikes)
+	{
+		Progress& current = progress[t];
+		int64_t misses = sample - 1 - std::max(seen[t], scanned);
+		int64_t room = maxStrikes - current.strikes;
+		if (misses <= room)
+		{
+			current.strikes += static_cast<int>(misses);
+		}
+		else
+		{
+			current.position = 0;
+			current.strikes = static_cast<int>((misses - room - 1) % (maxStrikes + 1));
+		}
+		seen[t] = sample - 1;
+	}
+
+	std::vector<Progress> progress;
+
+	// Per template, the last sample applied to it. A scan applies one to every template at once, so the last scan
+	// counts too.
+	std::vector<int64_t> seen;
+	int64_t scanned;
+
+	// Samples pushed so far.
+	int64_t sample;
+};
+
+// An index and one cursor through it.
+class LibraryMatcher
+{
+public:
+	LibraryMatcher(int bins, int tolerance, int maxStrikes)
+		: library(bins, tolerance, maxStrikes)
+	{
+	}
+
+	void clear()
+	{
+		library.clear();
+		cursor.clear();
+	}
+
+	int add(const int* roll, const int* pitch, const int* yaw, int steps, const int* tolerances = 0)
+	{
+		return library.add(roll, pitch, yaw, steps, tolerances);
+	}
+
+	void disable(int t)
+	{
+		library.disable(t);
+	}
+
+	int size() const
+	{
+		return library.size();
+	}
+
+	void reset()
+	{
+		cursor.reset();
+	}
+
+	int push(int roll, int pitch, int yaw)
+	{
+		return cursor.push(library, roll, pitch, yaw);
+	}
+
+	const LibraryIndex& index() const
+	{
+		return library;
+	}
+
+private:
+	LibraryIndex library;
+	LibraryCursor cursor;
+};
+
+// One recorded session's quantized samples, as columns.
+struct SessionColumns
+{
+	std::vector<int> roll, pitch, yaw;
+};
+
+// Re-scores recorded sessions against a library offline: replays each one through library from a fresh start and
+// counts how often each template completes, completions[s * library.size() + t]. Sessions don't depend on each other,
+// so they are spread across pool. Every pool thread reads the one index and only has a cursor of its own.
+inline void rescoreSessions(const LibraryIndex& library, const std::vector<SessionColumns>& sessions,
+	ThreadPool& pool, std::vector<int>& completions)
+{
+	int templates = library.size();
+	completions.assign(sessions.size() * templates, 0);
+	std::vector<LibraryCursor> cursors(pool.size());
+	pool.parallelFor(static_cast<int>(sessions.size()), 1, [&](int begin, int end, int thread)
+	{
+		LibraryCursor& replay = cursors[thread];
+		for (int s = begin; s < end; s++)
+		{
+			const SessionColumns& session = sessions[s];
+			int* counts = templates > 0 ? &completions[static_cast<size_t>(s) * templates] : 0;
+			replay.reset();
+			for (size_t i = 0; i < session.roll.size(); i++)
+			{
+				int completed = replay.push(library, session.roll[i], session.pitch[i], session.yaw[i]);
+				if (completed >= 0)
+				{
+					counts[completed]++;
+				}
+			}
+		}
+	});
+}
+
+#endif // LIBRARYMATCHER_H
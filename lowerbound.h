@@ -0,0 +1,285 @@
+#ifndef LOWERBOUND_H
+#define LOWERBOUND_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "dtw.h"
+#include "simd.h"
+#include "threadpool.h"
+
+// Nearest-template search over a gesture library with DTW, pruned by cheap lower bounds so that most templates are
+// never fully scored (the cascade from Rakthanmanon et al., "Searching and mining trillions of time series subsequences
+// under dynamic time warping", 2012). Each candidate goes through:
+//
+//   LB_Kim    the first and last steps must be aligned with each other, so their costs alone are a bound. O(1).
+//   LB_Keogh  every query step is aligned to some template step within the band, so it costs at least its distance
+//             from the template's envelope, the min and max of the template over the band around it. O(length).
+//   DTW       early abandoning: a row whose every cell is already over the best distance so far can't recover.
+//
+// A candidate is dropped as soon as a bound reaches the best distance found so far. Lower bounds need the query and
+// template to line up index for index, so both are first resampled to the same fixed length.
+
+// Linear resampling of one column to length points.
+inline void resampleColumn(const float* in, int n, float* out, int length)
+{
+	for (int i = 0; i < length; i++)
+	{
+		float position = length > 1 && n > 1 ? static_cast<float>(i) * (n - 1) / (length - 1) : 0.0f;
+		int k = std::min(n - 1, static_cast<int>(position));
+		int next = std::min(n - 1, k + 1);
+		float t = position - k;
+		out[i] = in[k] + (in[next] - in[k]) * t;
+	}
+}
+
+// A sequence of steps resampled to a fixed length, with its upper and lower envelope over a band of the given
+// radius. Templates build this once when they are saved; queries only need the resampled columns.
+struct DtwEnvelope
+{
+	int band;
+	std::vector<float> roll, pitch, yaw;
+	std::vector<float> upperRoll, upperPitch, upperYaw;
+	std::vector<float> lowerRoll, lowerPitch, lowerYaw;
+
+	DtwEnvelope()
+		: band(0)
+	{
+	}
+
+	int length() const
+	{
+		return static_cast<int>(roll.size());
+	}
+
+	void build(const float* stepRoll, const float* stepPitch, const float* stepYaw, int steps, int length, int band)
+	{
+		this->band = band;
+		roll.resize(length);
+		pitch.resize(length);
+		yaw.resize(length);
+		if (steps == 0)
+		{
+			roll.clear();
+			pitch.clear();
+			yaw.clear();
+		}
+		else
+		{
+			resampleColumn(stepRoll, steps, &roll[0], length);
+			resampleColumn(stepPitch, steps, &pitch[0], length);
+			resampleColumn(stepYaw, steps, &yaw[0], length);
+		}
+		envelope(roll, upperRoll, lowerRoll);
+		envelope(pitch, upperPitch, lowerPitch);
+		envelope(yaw, upperYaw, lowerYaw);
+	}
+
+private:
+	void envelope(const std::vector<float>& column, std::vector<float>& upper, std::vector<float>& lower)
+	{
+		int n = static_cast<int>(column.size());
+		upper.resize(n);
+		lower.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			int first = std::max(0, i - band);
+			int last = std::min(n - 1, i + band);
+			upper[i] = *std::max_element(column.begin() + first, column.begin() + last + 1);
+			lower[i] = *std::min_element(column.begin() + first, column.begin() + last + 1);
+		}
+	}
+};
+
+// How far value lies outside [lower, upper].
+inline float outside(float value, float lower, float upper)
+{
+	return std::max(0.0f, std::max(value - upper, lower - value));
+}
+
+// The Chebyshev cost of aligning the first steps plus that of the last steps.
+inline float lbKim(const DtwEnvelope& query, const DtwEnvelope& candidate)
+{
+	int last = query.length() - 1;
+	float first = std::max(std::fabs(query.roll[0] - candidate.roll[0]), std::max(std::fabs(query.pitch[0] -
+		candidate.pitch[0]), std::fabs(query.yaw[0] - candidate.yaw[0])));
+	if (last == 0)
+	{
+		return first;
+	}
+	return first + std::max(std::fabs(query.roll[last] - candidate.roll[last]), std::max(
+		std::fabs(query.pitch[last] - candidate.pitch[last]), std::fabs(query.yaw[last] - candidate.yaw[last])));
+}
+
+// The sum of each query step's distance outside the candidate's envelope, four steps at a time. Stops early, with
+// whatever it has, once that exceeds abandonAbove.
+inline float lbKeogh(const DtwEnvelope& query, const DtwEnvelope& candidate, float abandonAbove)
+{
+	float bound = 0;
+	int n = query.length();
+	int i = 0;
+#ifdef MYO_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= n && bound <= abandonAbove; i += 4)
+	{
+		__m128 r = _mm_loadu_ps(&query.roll[i]);
+		__m128 p = _mm_loadu_ps(&query.pitch[i]);
+		__m128 y = _mm_loadu_ps(&query.yaw[i]);
+		__m128 outRoll = _mm_max_ps(_mm_sub_ps(r, _mm_loadu_ps(&candidate.upperRoll[i])),
+			_mm_sub_ps(_mm_loadu_ps(&candidate.lowerRoll[i]), r));
+		__m128 outPitch = _mm_max_ps(_mm_sub_ps(p, _mm_loadu_ps(&candidate.upperPitch[i])),
+			_mm_sub_ps(_mm_loadu_ps(&candidate.lowerPitch[i]), p));
+		__m128 outYaw = _mm_max_ps(_mm_sub_ps(y, _mm_loadu_ps(&candidate.upperYaw[i])),
+			_mm_sub_ps(_mm_loadu_ps(&candidate.lowerYaw[i]), y));
+		__m128 sum = _mm_max_ps(zero, _mm_max_ps(outRoll, _mm_max_ps(outPitch, outYaw)));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		bound += _mm_cvtss_f32(sum);
+	}
+#endif
+	for (; i < n && bound <= abandonAbove; i++)
+	{
+		bound += std::max(outside(query.roll[i], candidate.lowerRoll[i], candidate.upperRoll[i]), std::max(
+			outside(query.pitch[i], candidate.lowerPitch[i], candidate.upperPitch[i]),
+			outside(query.yaw[i], candidate.lowerYaw[i], candidate.upperYaw[i])));
+	}
+	return bound;
+}
+
+// Where each candidate dropped out, for measuring the cascade. abandoned counts the candidates DTW didn't improve on,
+// most of which it gave up on part way; scored counts the ones that became the best so far.
+struct CascadeStats
+{
+	size_t candidates;
+	size_t prunedByKim;
+	size_t prunedByKeogh;
+	size_t abandoned;
+	size_t scored;
+
+	CascadeStats()
+		: candidates(0), prunedByKim(0), prunedByKeogh(0), abandoned(0), scored(0)
+	{
+	}
+};
+
+// The index of the candidate nearest to query by banded DTW, or -1 if there are none, with its distance. All
+// envelopes must have the query's length and band, and dtw the same band radius (at least 1, the narrowest band
+// DtwMatcher uses). Candidates of another length, such as empty ones, are skipped.
+inline int nearestTemplate(const DtwEnvelope& query, const DtwEnvelope* const* candidates, int count, DtwMatcher& dtw,
+	float& distance, CascadeStats& stats)
+{
+	int best = -1;
+	distance = std::numeric_limits<float>::infinity();
+	if (query.length() == 0)
+	{
+		return best;
+	}
+	for (int c = 0; c < count; c++)
+	{
+		const DtwEnvelope& candidate = *candidates[c];
+		if (candidate.length() != query.length())
+		{
+			continue;
+		}
+		stats.candidates++;
+		if (lbKim(query, candidate) >= distance)
+		{
+			stats.prunedByKim++;
+			continue;
+		}
+		if (lbKeogh(query, candidate, distance) >= distance)
+		{
+			stats.prunedByKeogh++;
+			continue;
+		}
+		float d = dtw.distance(&query.roll[0], &query.pitch[0], &query.yaw[0], query.length(), &candidate.roll[0],
+			&candidate.pitch[0], &candidate.yaw[0], candidate.length(), distance);
+		if (d < distance)
+		{
+			stats.scored++;
+			distance = d;
+			best = c;
+		}
+		else
+		{
+			stats.abandoned++;
+		}
+	}
+	return best;
+}
+
+// Candidates per chunk when the cascade is spread across threads.
+const int CASCADE_GRAIN = 64;
+
+// nearestTemplate() with the candidates spread across pool, using dtws[thread] on each pool thread. The threads share
+// the best distance so far, so each prunes with what all of them have found. Since candidates are taken out of order,
+// a candidate is only dropped once a bound is strictly above that distance and ties go to the lower index, which picks
+// the same candidate the one-thread version does. How the candidates split between the stats depends on the timing.
+inline int nearestTemplate(const DtwEnvelope& query, const DtwEnvelope* const* candidates, int count, ThreadPool& pool,
+	std::vector<DtwMatcher>& dtws, float& distance, CascadeStats& stats)
+{
+	int best = -1;
+	distance = std::numeric_limits<float>::infinity();
+	if (query.length() == 0)
+	{
+		return best;
+	}
+
+	std::atomic<float> bound(distance);
+	std::mutex mutex;
+	pool.parallelFor(count, CASCADE_GRAIN, [&](int begin, int end, int thread)
+	{
+		CascadeStats local;
+		DtwMatcher& dtw = dtws[thread];
+		for (int c = begin; c < end; c++)
+		{
+			const DtwEnvelope& candidate = *candidates[c];
+			if (candidate.length() != query.length())
+			{
+				continue;
+			}
+			local.candidates++;
+			float limit = bound.load(std::memory_order_relaxed);
+			if (lbKim(query, candidate) > limit)
+			{
+				local.prunedByKim++;
+				continue;
+			}
+			if (lbKeogh(query, candidate, limit) > limit)
+			{
+				local.prunedByKeogh++;
+				continue;
+			}
+			float d = dtw.distance(&query.roll[0], &query.pitch[0], &query.yaw[0], query.length(), &candidate.roll[0],
+				&candidate.pitch[0], &candidate.yaw[0], candidate.length(), limit);
+
+			if (d <= bound.load(std::memory_order_relaxed) && d != std::numeric_limits<float>::infinity())
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (d < distance || (d == distance && c < best))
+				{
+					local.scored++;
+					distance = d;
+					best = c;
+					bound.store(d, std::memory_order_relaxed);
+					continue;
+				}
+			}
+			local.abandoned++;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.candidates += local.candidates;
+		stats.prunedByKim += local.prunedByKim;
+		stats.prunedByKeogh += local.prunedByKeogh;
+		stats.abandoned += local.abandoned;
+		stats.scored += local.scored;
+	});
+	return best;
+}
+
+#endif // LOWERBOUND_H
@@ -0,0 +1,173 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only into memory. Pages are only read in from disk when first touched, and every process
+// that maps the same file shares them, so opening even a large file is a few system calls. The file must not be
+// changed in place while it is mapped; writers replace it instead (see replaceFile()).
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path)
+		: bytes(0), length(0)
+	{
+#ifdef _WIN32
+		mapping = 0;
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, 0);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("Unable to open " + path);
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+		{
+			close();
+			throw std::runtime_error("Unable to read the size of " + path);
+		}
+		length = static_cast<size_t>(size.QuadPart);
+		if (length > 0)
+		{
+			mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+			if (mapping != 0)
+			{
+				bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			}
+			if (bytes == 0)
+			{
+				close();
+				throw std::runtime_error("Unable to map " + path);
+			}
+		}
+#else
+		descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0)
+		{
+			throw std::runtime_error("Unable to open " + path);
+		}
+		struct stat status;
+		if (fstat(descriptor, &status) != 0)
+		{
+			close();
+			throw std::runtime_error("Unable to read the size of " + path);
+		}
+		length = static_cast<size_t>(status.st_size);
+		if (length > 0)
+		{
+			void* view = mmap(0, length, PROT_READ, MAP_SHARED, descriptor, 0);
+			if (view == MAP_FAILED)
+			{
+				close();
+				throw std::runtime_error("Unable to map " + path);
+			}
+			bytes = static_cast<const char*>(view);
+		}
+#endif
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	// The file's contents, or null if it is empty.
+	const char* data() const
+	{
+		return bytes;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void close()
+	{
+#ifdef _WIN32
+		if (bytes != 0)
+		{
+			UnmapViewOfFile(bytes);
+		}
+		if (mapping != 0)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+		mapping = 0;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (bytes != 0)
+		{
+			munmap(const_cast<char*>(bytes), length);
+		}
+		if (descriptor >= 0)
+		{
+			::close(descriptor);
+		}
+		descriptor = -1;
+#endif
+		bytes = 0;
+	}
+
+	const char* bytes;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int descriptor;
+#endif
+};
+
+// Whether path names a file that can be opened for reading.
+inline bool fileExists(const std::string& path)
+{
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == 0)
+	{
+		return false;
+	}
+	std::fclose(file);
+	return true;
+}
+
+// Moves from over to, replacing whatever was at to in one step, so a reader sees either the old file or the new one
+// and never half of either. On POSIX a process that still has the old file mapped keeps its copy. Windows refuses to
+// replace a file while anyone has it mapped, so readers there should copy what they need and unmap it.
+inline void replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+	bool moved = MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool moved = std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	if (!moved)
+	{
+		throw std::runtime_error("Unable to replace " + to);
+	}
+}
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,179 @@
+#ifndef MYOSOURCE_H
+#define MYOSOURCE_H
+
+#include <vector>
+
+#include <myo/myo.hpp>
+
+#include "samplesource.h"
+
+// Adapts a myo::Hub to the SampleSource interface. It also owns the bits of device behavior that need the SDK, like
+// keeping the Myo unlocked while a pose is held and turning on EMG streaming.
+class MyoSource : public SampleSource, private myo::DeviceListener
+{
+public:
+	explicit MyoSource(myo::Hub* hub, bool streamEmg = false)
+		: hub(hub), streamEmg(streamEmg)
+	{
+		hub->addListener(this);
+	}
+
+	~MyoSource()
+	{
+		hub->removeListener(this);
+	}
+
+	bool run(unsigned int durationMs)
+	{
+		hub->run(durationMs);
+		return true;
+	}
+
+private:
+	int deviceIndex(myo::Myo* myo)
+	{
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			if (devices[i] == myo)
+			{
+				return static_cast<int>(i);
+			}
+		}
+		devices.push_back(myo);
+		if (streamEmg)
+		{
+			myo->setStreamEmg(myo::Myo::streamEmgEnabled);
+		}
+		return static_cast<int>(devices.size() - 1);
+	}
+
+	void onPair(myo::Myo* myo, uint64_t timestamp, myo::FirmwareVersion firmwareVersion)
+	{
+		int device = deviceIndex(myo);
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onPair(device, timestamp);
+		}
+	}
+
+	void onUnpair(myo::Myo* myo, uint64_t timestamp)
+	{
+		int device = deviceIndex(myo);
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onUnpair(device, timestamp);
+		}
+	}
+
+	void onArmSync(myo::Myo* myo, uint64_t timestamp, myo::Arm arm, myo::XDirection xDirection, float rotation,
+		myo::WarmupState warmupState)
+	{
+		int device = deviceIndex(myo);
+		ArmSide side = arm == myo::armLeft ? sideLeft : arm == myo::armRight ? sideRight : sideUnknown;
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onArmSync(device, timestamp, side);
+		}
+	}
+
+	void onArmUnsync(myo::Myo* myo, uint64_t timestamp)
+	{
+		int device = deviceIndex(myo);
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onArmUnsync(device, timestamp);
+		}
+	}
+
+	void onUnlock(myo::Myo* myo, uint64_t timestamp)
+	{
+		int device = deviceIndex(myo);
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onUnlock(device, timestamp);
+		}
+	}
+
+	void onLock(myo::Myo* myo, uint64_t timestamp)
+	{
+		int device = deviceIndex(myo);
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onLock(device, timestamp);
+		}
+	}
+
+	void onPose(myo::Myo* myo, uint64_t timestamp, myo::Pose pose)
+	{
+		if (pose != myo::Pose::unknown && pose != myo::Pose::rest) {
+			// Tell the Myo to stay unlocked until told otherwise. We do that here so you can hold the poses without the
+			// Myo becoming locked.
+			myo->unlock(myo::Myo::unlockHold);
+
+			// Notify the Myo that the pose has resulted in an action. The Myo will vibrate.
+			myo->notifyUserAction();
+		}
+
+		int device = deviceIndex(myo);
+		PoseType type = static_cast<PoseType>(pose.type());
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onPose(device, timestamp, type);
+		}
+	}
+
+	void onOrientationData(myo::Myo* myo, uint64_t timestamp, const myo::Quaternion<float>& quat)
+	{
+		int device = deviceIndex(myo);
+		Quat q;
+		q.w = quat.w();
+		q.x = quat.x();
+		q.y = quat.y();
+		q.z = quat.z();
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onOrientationData(device, timestamp, q);
+		}
+	}
+
+	void onAccelerometerData(myo::Myo* myo, uint64_t timestamp, const myo::Vector3<float>& accel)
+	{
+		int device = deviceIndex(myo);
+		Vec3 v;
+		v.x = accel.x();
+		v.y = accel.y();
+		v.z = accel.z();
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onAccelerometerData(device, timestamp, v);
+		}
+	}
+
+	void onGyroscopeData(myo::Myo* myo, uint64_t timestamp, const myo::Vector3<float>& gyro)
+	{
+		int device = deviceIndex(myo);
+		Vec3 v;
+		v.x = gyro.x();
+		v.y = gyro.y();
+		v.z = gyro.z();
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onGyroscopeData(device, timestamp, v);
+		}
+	}
+
+	void onEmgData(myo::Myo* myo, uint64_t timestamp, const int8_t* emg)
+	{
+		int device = deviceIndex(myo);
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			listeners[i]->onEmgData(device, timestamp, emg);
+		}
+	}
+
+	myo::Hub* hub;
+	bool streamEmg;
+	std::vector<myo::Myo*> devices;
+};
+
+#endif // MYOSOURCE_H
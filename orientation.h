@@ -0,0 +1,279 @@
+#ifndef ORIENTATION_H
+#define ORIENTATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "samplesource.h"
+#include "simd.h"
+
+// Calculate Euler angles (roll, pitch, and yaw), in radians, from a unit quaternion.
+inline void quaternionToEuler(const Quat& quat, float& roll, float& pitch, float& yaw)
+{
+	using std::atan2;
+	using std::asin;
+	using std::max;
+	using std::min;
+
+	roll = atan2(2.0f * (quat.w * quat.x + quat.y * quat.z),
+		1.0f - 2.0f * (quat.x * quat.x + quat.y * quat.y));
+	pitch = asin(max(-1.0f, min(1.0f, 2.0f * (quat.w * quat.y - quat.z * quat.x))));
+	yaw = atan2(2.0f * (quat.w * quat.z + quat.x * quat.y),
+		1.0f - 2.0f * (quat.y * quat.y + quat.z * quat.z));
+}
+
+// The inverse of quaternionToEuler: the unit quaternion for roll, pitch and yaw in radians.
+inline Quat quatFromEuler(float roll, float pitch, float yaw)
+{
+	float cr = std::cos(roll * 0.5f), sr = std::sin(roll * 0.5f);
+	float cp = std::cos(pitch * 0.5f), sp = std::sin(pitch * 0.5f);
+	float cy = std::cos(yaw * 0.5f), sy = std::sin(yaw * 0.5f);
+	Quat q;
+	q.w = cr * cp * cy + sr * sp * sy;
+	q.x = sr * cp * cy - cr * sp * sy;
+	q.y = cr * sp * cy + sr * cp * sy;
+	q.z = cr * cp * sy - sr * sp * cy;
+	return q;
+}
+
+// Spherical linear interpolation between unit quaternions, t from 0 (a) to 1 (b), along the shorter arc. Nearly
+// parallel inputs fall back to a normalized lerp, where the slerp weights would divide by almost zero.
+inline Quat slerp(const Quat& a, const Quat& b, float t)
+{
+	float dot = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+	float sign = 1.0f;
+	if (dot < 0)
+	{
+		// q and -q are the same rotation; flip b so we don't go the long way round.
+		dot = -dot;
+		sign = -1.0f;
+	}
+
+	float wa, wb;
+	if (dot > 0.9995f)
+	{
+		wa = 1.0f - t;
+		wb = t;
+	}
+	else
+	{
+		float theta = std::acos(dot);
+		float sinTheta = std::sin(theta);
+		wa = std::sin((1.0f - t) * theta) / sinTheta;
+		wb = std::sin(t * theta) / sinTheta;
+	}
+	wb *= sign;
+
+	Quat q = { wa * a.w + wb * b.w, wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z };
+	float length = std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+	q.w /= length;
+	q.x /= length;
+	q.y /= length;
+	q.z /= length;
+	return q;
+}
+
+// The batched kernels' atan2/asin approximations are within about 2e-6 rad of the library functions. A lane whose
+// scaled angle lands within QUANTIZE_GUARD of a bucket boundary, where that error could flip the bucket, is redone
+// with the scalar path, so the buckets never differ.
+const float QUANTIZE_GUARD = 1e-3f;
+
+// Number of buckets per axis. 18 is what the app has always used; small-joint exercises want finer resolution, so
+// builds can pick e.g. 36 or 72 and every constant below folds at compile time.
+#ifndef EULER_BINS
+#define EULER_BINS 18
+#endif
+
+// Maps one angle range onto Bins buckets. The range, in degrees, is centered on 0; angles outside it land in the
+// first or last bucket.
+template <int Bins, int RangeDegrees>
+struct AxisQuantizer
+{
+	static_assert(Bins > 0 && RangeDegrees > 0 && RangeDegrees <= 360, "AxisQuantizer needs bins and a range");
+
+	static constexpr double range()
+	{
+		return M_PI * (RangeDegrees / 180.0);
+	}
+
+	static int bucket(float angle)
+	{
+		int value = static_cast<int>((angle + static_cast<float>(range() / 2)) / range() * Bins);
+		return std::min(Bins, std::max(0, value));
+	}
+
+	// The angle in the middle of a bucket, the best guess at an angle that was only kept as its bucket.
+	static float center(int bucket)
+	{
+		return static_cast<float>((bucket + 0.5) * range() / Bins - range() / 2);
+	}
+};
+
+// Quantizes orientation into Bins buckets per axis: roll and yaw over RollYawDegrees, pitch over PitchDegrees. The
+// defaults cover every orientation; Quantizer<18> is the scale the app has always used, 0 to 18.
+template <int Bins, int RollYawDegrees = 360, int PitchDegrees = 180>
+struct Quantizer
+{
+	enum { bins = Bins };
+
+	typedef AxisQuantizer<Bins, RollYawDegrees> RollYaw;
+	typedef AxisQuantizer<Bins, PitchDegrees> Pitch;
+
+	// Converts a distance in 18-bucket units, the scale TOLERANCE and friends were tuned on, to this resolution.
+	static constexpr int scale(int buckets18)
+	{
+		return buckets18 * Bins / 18;
+	}
+
+	static void quantize(const Quat& quat, int& roll_w, int& pitch_w, int& yaw_w)
+	{
+		float roll, pitch, yaw;
+		quaternionToEuler(quat, roll, pitch, yaw);
+
+		roll_w = RollYaw::bucket(roll);
+		pitch_w = Pitch::bucket(pitch);
+		yaw_w = RollYaw::bucket(yaw);
+	}
+
+	// quantize() over n quaternions, given as separate w/x/y/z arrays. The output is identical to calling the
+	// single-quaternion version on each one, but it runs four at a time with polynomial atan2/asin instead of the
+	// library calls. That is only worth it for bulk work like re-quantizing recorded sessions; a live armband delivers
+	// one sample at a time. Returns the number of samples that needed the scalar fallback (see QUANTIZE_GUARD).
+	static size_t quantize(const float* w, const float* x, const float* y, const float* z, size_t n,
+		int* roll, int* pitch, int* yaw);
+};
+
+typedef Quantizer<EULER_BINS> EulerQuantizer;
+
+// Convert a unit quaternion to roll, pitch and yaw on a scale from 0 to EULER_BINS.
+inline void quantizeOrientation(const Quat& quat, int& roll_w, int& pitch_w, int& yaw_w)
+{
+	EulerQuantizer::quantize(quat, roll_w, pitch_w, yaw_w);
+}
+
+#ifdef MYO_SSE2
+namespace orientation_detail
+{
+	// atan2 for four lanes. Reduces to atan(a) with 0 <= a <= 1, evaluates a minimax polynomial, then unfolds the
+	// octant from the signs and magnitudes of y and x.
+	inline __m128 atan2ps(__m128 y, __m128 x)
+	{
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		__m128 ay = _mm_andnot_ps(signBit, y);
+		__m128 ax = _mm_andnot_ps(signBit, x);
+		__m128 swap = _mm_cmpgt_ps(ay, ax);
+		__m128 num = _mm_min_ps(ay, ax);
+		__m128 den = _mm_max_ps(ay, ax);
+		// 0 / 0 only happens for atan2(0, 0), which the library defines as 0.
+		den = _mm_max_ps(den, _mm_set1_ps(1e-30f));
+		__m128 a = _mm_div_ps(num, den);
+		__m128 s = _mm_mul_ps(a, a);
+
+		__m128 r = _mm_set1_ps(-0.0117212f);
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.05265332f));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.11643287f));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.19354346f));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.33262347f));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.99997726f));
+		r = _mm_mul_ps(r, a);
+
+		const __m128 halfPi = _mm_set1_ps(static_cast<float>(M_PI / 2));
+		const __m128 pi = _mm_set1_ps(static_cast<float>(M_PI));
+		r = _mm_or_ps(_mm_and_ps(swap, _mm_sub_ps(halfPi, r)), _mm_andnot_ps(swap, r));
+		__m128 negX = _mm_cmplt_ps(x, _mm_setzero_ps());
+		r = _mm_or_ps(_mm_and_ps(negX, _mm_sub_ps(pi, r)), _mm_andnot_ps(negX, r));
+		return _mm_or_ps(r, _mm_and_ps(signBit, y));
+	}
+
+	// asin(v) = atan2(v, sqrt(1 - v^2)) for |v| <= 1.
+	inline __m128 asinps(__m128 v)
+	{
+		__m128 c = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(v, v))));
+		return atan2ps(v, c);
+	}
+
+	// Lanes of a scaled angle that sit too close to a bucket boundary to trust the approximation.
+	inline int nearBoundary(__m128 scaled)
+	{
+		__m128 frac = _mm_sub_ps(scaled, _mm_cvtepi32_ps(_mm_cvttps_epi32(scaled)));
+		__m128 low = _mm_cmplt_ps(frac, _mm_set1_ps(QUANTIZE_GUARD));
+		__m128 high = _mm_cmpgt_ps(frac, _mm_set1_ps(1.0f - QUANTIZE_GUARD));
+		return _mm_movemask_ps(_mm_or_ps(low, high));
+	}
+}
+#endif
+
+template <int Bins, int RollYawDegrees, int PitchDegrees>
+size_t Quantizer<Bins, RollYawDegrees, PitchDegrees>::quantize(const float* w, const float* x, const float* y,
+	const float* z, size_t n, int* roll, int* pitch, int* yaw)
+{
+	size_t fallbacks = 0;
+	size_t i = 0;
+
+#ifdef MYO_SSE2
+	using namespace orientation_detail;
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 top = _mm_set1_ps(static_cast<float>(Bins));
+	const __m128 rollYawOffset = _mm_set1_ps(static_cast<float>(RollYaw::range() / 2));
+	const __m128 pitchOffset = _mm_set1_ps(static_cast<float>(Pitch::range() / 2));
+	const __m128 rollYawScale = _mm_set1_ps(static_cast<float>(Bins / RollYaw::range()));
+	const __m128 pitchScale = _mm_set1_ps(static_cast<float>(Bins / Pitch::range()));
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 qw = _mm_loadu_ps(w + i);
+		__m128 qx = _mm_loadu_ps(x + i);
+		__m128 qy = _mm_loadu_ps(y + i);
+		__m128 qz = _mm_loadu_ps(z + i);
+
+		__m128 rollY = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(qw, qx), _mm_mul_ps(qy, qz)));
+		__m128 rollX = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy))));
+		__m128 sinPitch = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qw, qy), _mm_mul_ps(qz, qx)));
+		sinPitch = _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(one, sinPitch));
+		__m128 yawY = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(qw, qz), _mm_mul_ps(qx, qy)));
+		__m128 yawX = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(qy, qy), _mm_mul_ps(qz, qz))));
+
+		// Clamping pins out-of-range angles exactly onto a boundary, which sends them through the fallback too.
+		__m128 rollScaled = _mm_mul_ps(_mm_add_ps(atan2ps(rollY, rollX), rollYawOffset), rollYawScale);
+		__m128 pitchScaled = _mm_mul_ps(_mm_add_ps(asinps(sinPitch), pitchOffset), pitchScale);
+		__m128 yawScaled = _mm_mul_ps(_mm_add_ps(atan2ps(yawY, yawX), rollYawOffset), rollYawScale);
+		rollScaled = _mm_min_ps(top, _mm_max_ps(zero, rollScaled));
+		pitchScaled = _mm_min_ps(top, _mm_max_ps(zero, pitchScaled));
+		yawScaled = _mm_min_ps(top, _mm_max_ps(zero, yawScaled));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(roll + i), _mm_cvttps_epi32(rollScaled));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pitch + i), _mm_cvttps_epi32(pitchScaled));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(yaw + i), _mm_cvttps_epi32(yawScaled));
+
+		int redo = nearBoundary(rollScaled) | nearBoundary(pitchScaled) | nearBoundary(yawScaled);
+		for (int lane = 0; redo != 0; lane++, redo >>= 1)
+		{
+			if (redo & 1)
+			{
+				size_t k = i + lane;
+				Quat q = { w[k], x[k], y[k], z[k] };
+				quantize(q, roll[k], pitch[k], yaw[k]);
+				fallbacks++;
+			}
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		Quat q = { w[i], x[i], y[i], z[i] };
+		quantize(q, roll[i], pitch[i], yaw[i]);
+	}
+	return fallbacks;
+}
+
+inline size_t quantizeOrientations(const float* w, const float* x, const float* y, const float* z, size_t n,
+	int* roll, int* pitch, int* yaw)
+{
+	return EulerQuantizer::quantize(w, x, y, z, n, roll, pitch, yaw);
+}
+
+#endif // ORIENTATION_H
@@ -0,0 +1,226 @@
+#ifndef QUATMATCHER_H
+#define QUATMATCHER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "samplesource.h"
+#include "simd.h"
+
+// Template matching on the raw orientation instead of quantized Euler cells. A sample is within tolerance of a step
+// if the rotation between them is small: for unit quaternions, the angle between q1 and q2 is 2 acos(|q1 . q2|), so
+// the test is |q1 . q2| >= cos(tolerance / 2). Unlike a box of Euler buckets, that is the same size in every direction
+// and everywhere on the sphere; it doesn't stretch near pitch +-90 degrees, where roll and yaw stop meaning anything,
+// or split in two where yaw wraps around from +180 to -180. The absolute value makes q and -q, the same rotation,
+// match alike.
+//
+// Under the strike rules a template only ever waits for one step, so that is the only one a sample needs testing
+// against. Each template's next step is kept in a lane of its own, four templates to an SSE2 register, and each
+// template's position and strikes sit in the matching lanes of two more; a sample is one dot product and one strike
+// update per four templates, however long they are, and only a lane whose template moved has its step reloaded. The
+// rules are the ones GestureListener applies to one template: a sample within tolerance of a template's next step
+// advances it, and after maxStrikes misses it starts over. See --bench quaternion for how it compares with
+// quantizing each sample and using the cell masks.
+class QuaternionMatcher
+{
+public:
+	// tolerance is the largest rotation, in radians, between a sample and a step it matches, and must be under a
+	// half turn.
+	QuaternionMatcher(float tolerance, int maxStrikes)
+		: threshold(std::max(1e-6f, std::cos(tolerance / 2))), maxStrikes(maxStrikes)
+	{
+	}
+
+	void clear()
+	{
+		w.clear();
+		x.clear();
+		y.clear();
+		z.clear();
+		first.clear();
+		nextW.clear();
+		nextX.clear();
+		nextY.clear();
+		nextZ.clear();
+		length.clear();
+		position.clear();
+		strikes.clear();
+		done.clear();
+	}
+
+	// Adds a template of unit quaternions and returns its index. Empty templates are accepted but never match.
+	int add(const Quat* steps, int count)
+	{
+		int index = size();
+		first.push_back(static_cast<int>(w.size()));
+		for (int j = 0; j < count; j++)
+		{
+			w.push_back(steps[j].w);
+			x.push_back(steps[j].x);
+			y.push_back(steps[j].y);
+			z.push_back(steps[j].z);
+		}
+
+		// The lanes are padded to whole registers with zero quaternions, which never match.
+		size_t lanes = (first.size() + 3) / 4 * 4;
+		nextW.resize(lanes, 0);
+		nextX.resize(lanes, 0);
+		nextY.resize(lanes, 0);
+		nextZ.resize(lanes, 0);
+		length.resize(lanes, 0);
+		position.resize(lanes, 0);
+		strikes.resize(lanes, 0);
+		length[index] = count;
+		load(index);
+		return index;
+	}
+
+	int size() const
+	{
+		return static_cast<int>(first.size());
+	}
+
+	// Sends every template back to its first step, with no strikes.
+	void reset()
+	{
+		std::fill(position.begin(), position.end(), 0);
+		std::fill(strikes.begin(), strikes.end(), 0);
+		for (int t = 0; t < size(); t++)
+		{
+			load(t);
+		}
+	}
+
+	// Advances every template by one sample. Returns how many templates this sample completed, and completions()
+	// lists them. A completed template starts over. Without vectorized, or without SSE2, it goes one template at a
+	// time; both give the same results.
+	int push(const Quat& quat, bool vectorized = true)
+	{
+		done.clear();
+		int templates = size();
+		int t = 0;
+#ifdef MYO_SSE2
+		if (vectorized)
+		{
+			const __m128 qw = _mm_set1_ps(quat.w);
+			const __m128 qx = _mm_set1_ps(quat.x);
+			const __m128 qy = _mm_set1_ps(quat.y);
+			const __m128 qz = _mm_set1_ps(quat.z);
+			const __m128 limit = _mm_set1_ps(threshold);
+			const __m128 signBit = _mm_set1_ps(-0.0f);
+			const __m128i one = _mm_set1_epi32(1);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i mostStrikes = _mm_set1_epi32(maxStrikes - 1);
+			for (; t < templates; t += 4)
+			{
+				__m128 dot = _mm_mul_ps(qw, _mm_loadu_ps(&nextW[t]));
+				dot = _mm_add_ps(dot, _mm_mul_ps(qx, _mm_loadu_ps(&nextX[t])));
+				dot = _mm_add_ps(dot, _mm_mul_ps(qy, _mm_loadu_ps(&nextY[t])));
+				dot = _mm_add_ps(dot, _mm_mul_ps(qz, _mm_loadu_ps(&nextZ[t])));
+				__m128i hit = _mm_castps_si128(_mm_cmpge_ps(_mm_andnot_ps(signBit, dot), limit));
+
+				// A hit moves a lane on a step, and ends the template if that was its last. A miss adds a strike, or
+				// with the strikes used up starts the template over.
+				__m128i at = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&position[t]));
+				__m128i struck = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&strikes[t]));
+				__m128i advanced = _mm_sub_epi32(at, hit);
+				__m128i ended = _mm_and_si128(hit, _mm_cmpeq_epi32(advanced,
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(&length[t]))));
+				__m128i over = _mm_andnot_si128(hit, _mm_cmpgt_epi32(struck, mostStrikes));
+				__m128i restart = _mm_or_si128(ended, over);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(&position[t]), _mm_andnot_si128(restart, advanced));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(&strikes[t]), _mm_andnot_si128(restart,
+					_mm_add_epi32(struck, _mm_andnot_si128(hit, one))));
+
+				int moved = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(hit,
+					_mm_and_si128(over, _mm_cmpgt_epi32(at, zero)))));
+				int finished = _mm_movemask_ps(_mm_castsi128_ps(ended));
+				for (int lane = 0; moved != 0; lane++, moved >>= 1)
+				{
+					if (moved & 1)
+					{
+						load(t + lane);
+					}
+				}
+				for (int lane = 0; finished != 0; lane++, finished >>= 1)
+				{
+					if (finished & 1)
+					{
+						done.push_back(t + lane);
+					}
+				}
+			}
+		}
+#endif
+		for (; t < templates; t++)
+		{
+			float dot = quat.w * nextW[t];
+			dot += quat.x * nextX[t];
+			dot += quat.y * nextY[t];
+			dot += quat.z * nextZ[t];
+			if (std::fabs(dot) >= threshold)
+			{
+				if (++position[t] == length[t])
+				{
+					position[t] = 0;
+					strikes[t] = 0;
+					done.push_back(t);
+				}
+				load(t);
+			}
+			else if (strikes[t] >= maxStrikes)
+			{
+				position[t] = 0;
+				strikes[t] = 0;
+				load(t);
+			}
+			else
+			{
+				strikes[t]++;
+			}
+		}
+		return static_cast<int>(done.size());
+	}
+
+	// The templates the last push() completed, in the order they were added.
+	const std::vector<int>& completions() const
+	{
+		return done;
+	}
+
+private:
+	// Puts template t's next step in its lane.
+	void load(int t)
+	{
+		if (length[t] == 0)
+		{
+			return;
+		}
+		size_t i = first[t] + position[t];
+		nextW[t] = w[i];
+		nextX[t] = x[i];
+		nextY[t] = y[i];
+		nextZ[t] = z[i];
+	}
+
+	float threshold;
+	int maxStrikes;
+
+	// Every template step, back to back, and where each template's steps start.
+	std::vector<float> w, x, y, z;
+	std::vector<int> first;
+
+	// One lane per template, padded to whole registers: its next step, its steps, the step it is waiting for and
+	// its strikes.
+	std::vector<float> nextW, nextX, nextY, nextZ;
+	std::vector<int32_t> length;
+	std::vector<int32_t> position;
+	std::vector<int32_t> strikes;
+
+	// The templates the last sample completed.
+	std::vector<int> done;
+};
+
+#endif // QUATMATCHER_H
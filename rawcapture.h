@@ -0,0 +1,191 @@
+#ifndef RAWCAPTURE_H
+#define RAWCAPTURE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "samplesource.h"
+
+// One fixed-capacity structure-of-arrays stream: a timestamp column plus one float column per component. The
+// producer fills slots and then publishes the new size, so a reader can work on the first size() entries while
+// capture is still running. The columns are allocated up front and never move.
+template <int Components>
+class SoaStream
+{
+public:
+	explicit SoaStream(size_t capacity)
+		: timestamps(capacity), count(0), dropped(0)
+	{
+		for (int c = 0; c < Components; c++)
+		{
+			columns[c].resize(capacity);
+		}
+	}
+
+	// Producer side.
+	void append(uint64_t timestamp, const float* values)
+	{
+		size_t n = count.load(std::memory_order_relaxed);
+		if (n == timestamps.size())
+		{
+			dropped++;
+			return;
+		}
+		timestamps[n] = timestamp;
+		for (int c = 0; c < Components; c++)
+		{
+			columns[c][n] = values[c];
+		}
+		count.store(n + 1, std::memory_order_release);
+	}
+
+	size_t size() const
+	{
+		return count.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const
+	{
+		return timestamps.size();
+	}
+
+	uint64_t droppedCount() const
+	{
+		return dropped.load(std::memory_order_relaxed);
+	}
+
+	const uint64_t* timestamp() const
+	{
+		return timestamps.data();
+	}
+
+	const float* column(int component) const
+	{
+		return columns[component].data();
+	}
+
+	// Only safe while nothing is being appended.
+	void clear()
+	{
+		count.store(0, std::memory_order_release);
+		dropped = 0;
+	}
+
+private:
+	std::vector<uint64_t> timestamps;
+	std::vector<float> columns[Components];
+	std::atomic<size_t> count;
+	std::atomic<uint64_t> dropped;
+};
+
+// Full-resolution capture of everything the armband reports about motion: the raw orientation quaternion,
+// accelerometer (in g) and gyroscope (in deg/s). Nothing is quantized, so recordings can be re-quantized or
+// re-scored later without the patient.
+class RawCapture
+{
+public:
+	// Component order of the orientation stream.
+	enum { W, X, Y, Z };
+
+	explicit RawCapture(size_t capacity)
+		: orientation(capacity), accelerometer(capacity), gyroscope(capacity), enabled(false)
+	{
+	}
+
+	void start()
+	{
+		enabled = true;
+	}
+
+	void stop()
+	{
+		enabled = false;
+	}
+
+	bool capturing() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Producer side, called from the source thread.
+	void addOrientation(uint64_t timestamp, const Quat& quat)
+	{
+		if (capturing())
+		{
+			float values[4] = { quat.w, quat.x, quat.y, quat.z };
+			orientation.append(timestamp, values);
+		}
+	}
+
+	void addAccelerometer(uint64_t timestamp, const Vec3& accel)
+	{
+		if (capturing())
+		{
+			float values[3] = { accel.x, accel.y, accel.z };
+			accelerometer.append(timestamp, values);
+		}
+	}
+
+	void addGyroscope(uint64_t timestamp, const Vec3& gyro)
+	{
+		if (capturing())
+		{
+			float values[3] = { gyro.x, gyro.y, gyro.z };
+			gyroscope.append(timestamp, values);
+		}
+	}
+
+	// Writes everything captured so far in ReplaySource's format, merged in timestamp order.
+	void writeReplay(const std::string& path, int device) const
+	{
+		std::ofstream out(path.c_str());
+		if (!out)
+		{
+			throw std::runtime_error("Unable to write capture to " + path);
+		}
+		out.precision(9);
+		out << "# raw capture: orientation, accelerometer (g), gyroscope (deg/s)\n";
+
+		size_t o = 0, a = 0, g = 0;
+		size_t on = orientation.size(), an = accelerometer.size(), gn = gyroscope.size();
+		const uint64_t end = ~uint64_t(0);
+		while (o < on || a < an || g < gn)
+		{
+			uint64_t ot = o < on ? orientation.timestamp()[o] : end;
+			uint64_t at = a < an ? accelerometer.timestamp()[a] : end;
+			uint64_t gt = g < gn ? gyroscope.timestamp()[g] : end;
+			if (ot <= at && ot <= gt)
+			{
+				out << ot << ' ' << device << " o " << orientation.column(W)[o] << ' ' << orientation.column(X)[o]
+					<< ' ' << orientation.column(Y)[o] << ' ' << orientation.column(Z)[o] << '\n';
+				o++;
+			}
+			else if (at <= gt)
+			{
+				out << at << ' ' << device << " a " << accelerometer.column(0)[a] << ' ' << accelerometer.column(1)[a]
+					<< ' ' << accelerometer.column(2)[a] << '\n';
+				a++;
+			}
+			else
+			{
+				out << gt << ' ' << device << " g " << gyroscope.column(0)[g] << ' ' << gyroscope.column(1)[g]
+					<< ' ' << gyroscope.column(2)[g] << '\n';
+				g++;
+			}
+		}
+	}
+
+	SoaStream<4> orientation;
+	SoaStream<3> accelerometer;
+	SoaStream<3> gyroscope;
+
+private:
+	std::atomic<bool> enabled;
+};
+
+#endif // RAWCAPTURE_H
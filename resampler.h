@@ -0,0 +1,88 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+
+#include "orientation.h"
+#include "samplesource.h"
+
+// Turns orientation samples that arrive with uneven spacing into a stream at exactly rateHz, on the device's own
+// clock. Output k is at start + k / rateHz, slerped between the two inputs either side of it, so a recorded template
+// and a live attempt line up step for step no matter how the radio or the scheduler bunched the samples.
+//
+// A gap longer than maxGapUs (the armband dropping out, say) is not bridged; the output restarts at the next input.
+class Resampler
+{
+public:
+	explicit Resampler(unsigned int rateHz = 50, uint64_t maxGapUs = 250000)
+		: rateHz(rateHz), maxGapUs(maxGapUs)
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		primed = false;
+		start = 0;
+		index = 0;
+		previousTimestamp = 0;
+	}
+
+	unsigned int rate() const
+	{
+		return rateHz;
+	}
+
+	// Feeds one input sample and calls emit(timestamp, quat) for each output sample that is now known, in order.
+	// Inputs that are not newer than the last one are ignored.
+	template <class Emit>
+	void push(uint64_t timestamp, const Quat& quat, Emit emit)
+	{
+		if (primed && timestamp <= previousTimestamp)
+		{
+			return;
+		}
+		if (!primed || timestamp - previousTimestamp > maxGapUs)
+		{
+			primed = true;
+			start = timestamp;
+			index = 0;
+		}
+		else
+		{
+			uint64_t span = timestamp - previousTimestamp;
+			for (uint64_t next = outputTime(); next < timestamp; next = outputTime())
+			{
+				float t = static_cast<float>(next - previousTimestamp) / static_cast<float>(span);
+				emit(next, slerp(previous, quat, t));
+				index++;
+			}
+		}
+
+		// An input that lands exactly on the grid is passed through as is.
+		if (outputTime() == timestamp)
+		{
+			emit(timestamp, quat);
+			index++;
+		}
+		previous = quat;
+		previousTimestamp = timestamp;
+	}
+
+private:
+	// Computed from the output index rather than accumulated, so rates that don't divide a second evenly don't drift.
+	uint64_t outputTime() const
+	{
+		return start + index * 1000000 / rateHz;
+	}
+
+	unsigned int rateHz;
+	uint64_t maxGapUs;
+	bool primed;
+	uint64_t start;
+	uint64_t index;
+	Quat previous;
+	uint64_t previousTimestamp;
+};
+
+#endif // RESAMPLER_H
@@ -0,0 +1,86 @@
+#ifndef SAMPLEFILTER_H
+#define SAMPLEFILTER_H
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "samplesource.h"
+
+// Decides which quantized orientation samples are worth passing on. A sample that matches the last one passed adds
+// nothing. One that moved further than deadBand buckets on any axis is always passed. A move within the dead-band
+// is the kind of flicker you get when the arm rests on a bucket boundary, so it is only passed once the arm has held
+// the new position for holdSteps samples in a row. A change of pose always passes, so gestures like double tap are
+// never swallowed.
+//
+// A deadBand of 0 passes every change immediately.
+class SampleFilter
+{
+public:
+	SampleFilter(int deadBand, int holdSteps)
+		: deadBand(deadBand), holdSteps(holdSteps), lastRoll(0), lastPitch(0), lastYaw(0), lastPose(poseRest),
+		heldRoll(0), heldPitch(0), heldYaw(0)
+	{
+		reset();
+	}
+
+	// Forget the last sample, so the next one always passes.
+	void reset()
+	{
+		primed = false;
+		held = 0;
+	}
+
+	bool accept(int roll, int pitch, int yaw, PoseType pose)
+	{
+		if (primed && pose == lastPose)
+		{
+			int distance = std::max(std::abs(roll - lastRoll), std::max(std::abs(pitch - lastPitch),
+				std::abs(yaw - lastYaw)));
+			if (distance == 0)
+			{
+				held = 0;
+				return false;
+			}
+			if (distance <= deadBand)
+			{
+				if (held > 0 && roll == heldRoll && pitch == heldPitch && yaw == heldYaw)
+				{
+					held++;
+				}
+				else
+				{
+					heldRoll = roll;
+					heldPitch = pitch;
+					heldYaw = yaw;
+					held = 1;
+				}
+				if (held < holdSteps)
+				{
+					return false;
+				}
+			}
+		}
+
+		primed = true;
+		held = 0;
+		lastRoll = roll;
+		lastPitch = pitch;
+		lastYaw = yaw;
+		lastPose = pose;
+		return true;
+	}
+
+private:
+	int deadBand;
+	int holdSteps;
+
+	bool primed;
+	int lastRoll, lastPitch, lastYaw;
+	PoseType lastPose;
+
+	// The candidate position inside the dead-band, and for how many samples in a row it has been seen.
+	int heldRoll, heldPitch, heldYaw;
+	int held;
+};
+
+#endif // SAMPLEFILTER_H
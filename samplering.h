@@ -0,0 +1,82 @@
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded single-producer/single-consumer queue used to hand samples from the hub callbacks to whoever is consuming
+// them (the recorder or the listener). Each side owns one index, so neither ever takes a lock or waits on the other.
+// Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SampleRing
+{
+	static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "SampleRing capacity must be a power of two");
+
+public:
+	SampleRing()
+		: head(0), tail(0), dropped(0)
+	{
+	}
+
+	// Producer side. Returns false (and counts the sample as dropped) if the consumer is a whole ring behind; the
+	// callback must never wait for the consumer.
+	bool push(const T& value)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == Capacity)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		buffer[h & (Capacity - 1)] = value;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Returns false if there is nothing queued.
+	bool pop(T& value)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		value = buffer[t & (Capacity - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Throws away everything queued so far, e.g. samples that piled up while the menu was waiting
+	// for input.
+	void clear()
+	{
+		tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+	size_t size() const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	uint64_t droppedCount() const
+	{
+		return dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	// The indices are kept on separate cache lines so the producer and consumer don't false-share.
+	std::atomic<size_t> head;
+	char headPadding[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail;
+	char tailPadding[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<uint64_t> dropped;
+	T buffer[Capacity];
+};
+
+#endif // SAMPLERING_H
@@ -0,0 +1,106 @@
+#ifndef SAMPLESOURCE_H
+#define SAMPLESOURCE_H
+
+#include <cstdint>
+#include <vector>
+
+// Everything downstream of a SampleSource is independent of the Myo SDK, so the recorder and listener can be driven
+// by a real armband, a recorded file or a generator.
+
+// Same values as myo::Pose::Type.
+enum PoseType
+{
+	poseRest = 0,
+	poseFist = 1,
+	poseWaveIn = 2,
+	poseWaveOut = 3,
+	poseFingersSpread = 4,
+	poseDoubleTap = 5,
+	poseUnknown = 0xffff
+};
+
+inline const char* poseName(PoseType pose)
+{
+	switch (pose)
+	{
+	case poseRest: return "rest";
+	case poseFist: return "fist";
+	case poseWaveIn: return "waveIn";
+	case poseWaveOut: return "waveOut";
+	case poseFingersSpread: return "fingersSpread";
+	case poseDoubleTap: return "doubleTap";
+	default: return "unknown";
+	}
+}
+
+enum ArmSide
+{
+	sideLeft,
+	sideRight,
+	sideUnknown
+};
+
+// A unit quaternion.
+struct Quat
+{
+	float w;
+	float x;
+	float y;
+	float z;
+};
+
+struct Vec3
+{
+	float x;
+	float y;
+	float z;
+};
+
+// The SDK-independent counterpart of myo::DeviceListener. Devices are identified by a small index assigned by the
+// source in the order it first sees them. If you do not override an event, the default behavior is to do nothing.
+class SampleListener
+{
+public:
+	virtual ~SampleListener() {}
+
+	virtual void onPair(int device, uint64_t timestamp) {}
+	virtual void onUnpair(int device, uint64_t timestamp) {}
+	virtual void onArmSync(int device, uint64_t timestamp, ArmSide arm) {}
+	virtual void onArmUnsync(int device, uint64_t timestamp) {}
+	virtual void onUnlock(int device, uint64_t timestamp) {}
+	virtual void onLock(int device, uint64_t timestamp) {}
+	virtual void onPose(int device, uint64_t timestamp, PoseType pose) {}
+	virtual void onOrientationData(int device, uint64_t timestamp, const Quat& quat) {}
+	virtual void onAccelerometerData(int device, uint64_t timestamp, const Vec3& accel) {}
+	virtual void onGyroscopeData(int device, uint64_t timestamp, const Vec3& gyro) {}
+	// emg points at one signed 8-bit reading per channel (8 on a Myo).
+	virtual void onEmgData(int device, uint64_t timestamp, const int8_t* emg) {}
+};
+
+// Produces device events and hands them to its listeners, like myo::Hub does. run() is only ever called from one
+// thread (normally the HubPump), and listeners are called on that thread.
+class SampleSource
+{
+public:
+	virtual ~SampleSource() {}
+
+	void addListener(SampleListener* listener)
+	{
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			if (listeners[i] == listener)
+			{
+				return;
+			}
+		}
+		listeners.push_back(listener);
+	}
+
+	// Delivers events for roughly durationMs. Returns false once the source has nothing more to deliver.
+	virtual bool run(unsigned int durationMs) = 0;
+
+protected:
+	std::vector<SampleListener*> listeners;
+};
+
+#endif // SAMPLESOURCE_H
@@ -0,0 +1,273 @@
+#ifndef SESSIONARCHIVE_H
+#define SESSIONARCHIVE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libraryfile.h"
+#include "mappedfile.h"
+#include "streamcodec.h"
+
+// Sessions kept for the long term. A session log (see sessionlog.h) keeps every raw sample at 32 bytes each; an
+// archive keeps, for each device in each session, the steps the recognizer saw, packed with streamcodec.h, plus
+// enough about the raw stream to audit it. That is what re-scoring needs, at a small fraction of the size, so months
+// of sessions fit on a clinic's disk.
+//
+//   header    ArchiveHeader: what the file is, counts and section offsets
+//   sessions  one ArchiveSession per session
+//   streams   one ArchiveStream per device per session, in session order
+//   blocks    the block index of every stream, stream after stream
+//   data      every stream's packed steps, back to back
+//
+// Like a library, the file is mapped and read in place, sections start on 16-byte boundaries and numbers are in the
+// writing machine's byte order.
+
+struct ArchiveHeader
+{
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t version;
+	uint32_t sessions;
+	uint32_t streams;
+	uint64_t fileSize;
+	uint64_t blocks;
+	uint64_t dataBytes;
+	uint64_t sessionOffset;
+	uint64_t streamOffset;
+	uint64_t blockOffset;
+	uint64_t dataOffset;
+};
+
+struct ArchiveSession
+{
+	// Wall clock, in microseconds since 1970, when the session started.
+	uint64_t started;
+	// Raw records the session log dropped.
+	uint64_t dropped;
+};
+
+struct ArchiveStream
+{
+	// The raw stream: samples, how many of them were taken while locked, and the first and last device timestamps.
+	uint64_t samples;
+	uint64_t locked;
+	uint64_t first;
+	uint64_t last;
+	uint32_t session;
+	uint32_t device;
+
+	// The packed steps: runs of the blocks and data sections.
+	uint32_t steps;
+	uint32_t blocks;
+	uint64_t firstBlock;
+	uint64_t dataStart;
+	uint64_t dataBytes;
+};
+
+static_assert(sizeof(ArchiveHeader) == 80, "ArchiveHeader must not be padded");
+static_assert(sizeof(ArchiveSession) == 16, "ArchiveSession must not be padded");
+static_assert(sizeof(ArchiveStream) == 72, "ArchiveStream must not be padded");
+
+const char ARCHIVE_MAGIC[8] = { 'M', 'Y', 'O', 'S', 'A', 'R', 'C', 0 };
+const uint32_t ARCHIVE_BYTE_ORDER = 0x01020304;
+const uint32_t ARCHIVE_VERSION = 1;
+
+// Writes sessions and streams, with packed[s] the steps of streams[s], as an archive at path. The packed runs of
+// streams are filled in here. Like writeLibrary(), the file is written next to path and moved over it.
+inline void writeArchive(const std::string& path, const std::vector<ArchiveSession>& sessions,
+	std::vector<ArchiveStream> streams, const std::vector<PackedStream>& packed)
+{
+	if (packed.size() != streams.size())
+	{
+		throw std::runtime_error("Every archived stream needs its packed steps");
+	}
+	ArchiveHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+	header.byteOrder = ARCHIVE_BYTE_ORDER;
+	header.version = ARCHIVE_VERSION;
+	header.sessions = static_cast<uint32_t>(sessions.size());
+	header.streams = static_cast<uint32_t>(streams.size());
+	for (size_t s = 0; s < streams.size(); s++)
+	{
+		if (streams[s].session >= sessions.size() || packed[s].size() > UINT32_MAX)
+		{
+			throw std::runtime_error("Archived stream " + std::to_string(s) + " doesn't fit its session");
+		}
+		streams[s].steps = static_cast<uint32_t>(packed[s].size());
+		streams[s].blocks = static_cast<uint32_t>(packed[s].blockCount());
+		streams[s].firstBlock = header.blocks;
+		streams[s].dataStart = header.dataBytes;
+		streams[s].dataBytes = packed[s].dataBytes();
+		header.blocks += packed[s].blockCount();
+		header.dataBytes += packed[s].dataBytes();
+	}
+
+	uint64_t offset = sizeof(ArchiveHeader);
+	header.sessionOffset = offset;
+	offset = (offset + sessions.size() * sizeof(ArchiveSession) + 15) / 16 * 16;
+	header.streamOffset = offset;
+	offset = (offset + streams.size() * sizeof(ArchiveStream) + 15) / 16 * 16;
+	header.blockOffset = offset;
+	offset = (offset + header.blocks * sizeof(uint32_t) + 15) / 16 * 16;
+	header.dataOffset = offset;
+	header.fileSize = offset + header.dataBytes;
+
+	std::string temporary = path + ".tmp";
+	try {
+		{
+			std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				throw std::runtime_error("Unable to write archive to " + temporary);
+			}
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			if (!sessions.empty())
+			{
+				out.write(reinterpret_cast<const char*>(&sessions[0]), sessions.size() * sizeof(ArchiveSession));
+			}
+			padTo(out, header.streamOffset);
+			if (!streams.empty())
+			{
+				out.write(reinterpret_cast<const char*>(&streams[0]), streams.size() * sizeof(ArchiveStream));
+			}
+			padTo(out, header.blockOffset);
+			for (size_t s = 0; s < packed.size(); s++)
+			{
+				if (packed[s].blockCount() > 0)
+				{
+					out.write(reinterpret_cast<const char*>(packed[s].blocks()),
+						packed[s].blockCount() * sizeof(uint32_t));
+				}
+			}
+			padTo(out, header.dataOffset);
+			for (size_t s = 0; s < packed.size(); s++)
+			{
+				if (packed[s].dataBytes() > 0)
+				{
+					out.write(reinterpret_cast<const char*>(packed[s].data()), packed[s].dataBytes());
+				}
+			}
+			out.flush();
+			if (!out)
+			{
+				throw std::runtime_error("Unable to write archive to " + temporary);
+			}
+		}
+		replaceFile(temporary, path);
+	}
+	catch (...) {
+		// Don't leave half a file behind.
+		std::remove(temporary.c_str());
+		throw;
+	}
+}
+
+// An archive, mapped and checked. Opening checks that every stream's runs lie within the file, that it has a block
+// per PACKED_BLOCK_STEPS steps and that it has samples; decoding checks the packed data itself as it goes.
+class ArchiveFile
+{
+public:
+	explicit ArchiveFile(const std::string& path)
+		: file(path), path(path)
+	{
+		if (file.size() < sizeof(ArchiveHeader))
+		{
+			fail("is too short");
+		}
+		header = reinterpret_cast<const ArchiveHeader*>(file.data());
+		if (std::memcmp(header->magic, ARCHIVE_MAGIC, sizeof(header->magic)) != 0)
+		{
+			fail("is not a session archive");
+		}
+		if (header->byteOrder != ARCHIVE_BYTE_ORDER)
+		{
+			fail("was written with another byte order");
+		}
+		if (header->version != ARCHIVE_VERSION)
+		{
+			fail("is version " + std::to_string(header->version) + ", expected " + std::to_string(ARCHIVE_VERSION));
+		}
+		if (header->fileSize != file.size())
+		{
+			fail("is truncated");
+		}
+		section(header->sessionOffset, header->sessions, sizeof(ArchiveSession));
+		section(header->streamOffset, header->streams, sizeof(ArchiveStream));
+		section(header->blockOffset, header->blocks, sizeof(uint32_t));
+		section(header->dataOffset, header->dataBytes, 1);
+
+		for (uint32_t s = 0; s < header->streams; s++)
+		{
+			const ArchiveStream& entry = stream(static_cast<int>(s));
+			if (entry.session >= header->sessions ||
+				entry.blocks != (entry.steps + PACKED_BLOCK_STEPS - 1) / PACKED_BLOCK_STEPS ||
+				entry.firstBlock > header->blocks || entry.blocks > header->blocks - entry.firstBlock ||
+				entry.dataStart > header->dataBytes || entry.dataBytes > header->dataBytes - entry.dataStart)
+			{
+				fail("has a stream outside the file");
+			}
+			// Streams only exist for devices that sent something.
+			if (entry.samples == 0 || entry.locked > entry.samples)
+			{
+				fail("has a stream with " + std::to_string(entry.samples) + " samples, " +
+					std::to_string(entry.locked) + " of them locked");
+			}
+		}
+	}
+
+	int sessionCount() const
+	{
+		return static_cast<int>(header->sessions);
+	}
+
+	const ArchiveSession& session(int s) const
+	{
+		return reinterpret_cast<const ArchiveSession*>(file.data() + header->sessionOffset)[s];
+	}
+
+	int streamCount() const
+	{
+		return static_cast<int>(header->streams);
+	}
+
+	const ArchiveStream& stream(int s) const
+	{
+		return reinterpret_cast<const ArchiveStream*>(file.data() + header->streamOffset)[s];
+	}
+
+	// Decodes steps [first, first + count) of stream s.
+	void decode(int s, size_t first, size_t count, int* roll, int* pitch, int* yaw) const
+	{
+		const ArchiveStream& entry = stream(s);
+		decodePacked(reinterpret_cast<const uint8_t*>(file.data() + header->dataOffset) + entry.dataStart,
+			static_cast<size_t>(entry.dataBytes),
+			reinterpret_cast<const uint32_t*>(file.data() + header->blockOffset) + entry.firstBlock, entry.steps,
+			first, count, roll, pitch, yaw);
+	}
+
+private:
+	void section(uint64_t offset, uint64_t count, uint64_t size) const
+	{
+		if (offset % 16 != 0 || offset > file.size() || count > (file.size() - offset) / size)
+		{
+			fail("has a section outside the file");
+		}
+	}
+
+	void fail(const std::string& problem) const
+	{
+		throw std::runtime_error("Archive " + path + " " + problem);
+	}
+
+	MappedFile file;
+	std::string path;
+	const ArchiveHeader* header;
+};
+
+#endif // SESSIONARCHIVE_H
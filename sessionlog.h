@@ -0,0 +1,417 @@
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+#include "samplering.h"
+#include "samplesource.h"
+
+// Every session's raw stream, kept on disk so what a patient did can be audited and re-scored long after the app has
+// printed its reps and exited. The file is only ever appended to: a LogHeader when it is created, then LogRecords,
+// each session starting with a logSession record. Nothing already written is touched again, so a crash can at worst
+// cut the last record short.
+//
+// The source thread only pushes records into a SampleRing; a background thread drains it every batch interval and
+// appends the lot with one write, and asks the OS to put it on the disk (fsync) every sync interval. If the disk
+// falls a whole ring behind, records are dropped rather than stalling the callback, and a logDropped record says how
+// many went missing where.
+
+enum LogKind
+{
+	// Never written; zero bytes where a cut-short record was padded out.
+	logPadding,
+	// timestamp is the wall clock, in microseconds since 1970, when the app started.
+	logSession,
+	// A raw orientation sample, with the pose and lock state at the time.
+	logOrientation,
+	logPose,
+	logLock,
+	// count records before timestamp were dropped.
+	logDropped
+};
+
+// kind is the last byte, so a record whose write was cut short and then padded with zeros reads as logPadding.
+struct LogRecord
+{
+	uint64_t timestamp;
+	Quat quat;
+	uint32_t count;
+	uint8_t device;
+	uint8_t pose;
+	uint8_t locked;
+	uint8_t kind;
+};
+
+struct LogHeader
+{
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t version;
+};
+
+static_assert(sizeof(LogRecord) == 32, "LogRecord must not be padded");
+static_assert(sizeof(LogHeader) == 16, "LogHeader must not be padded");
+
+const char LOG_MAGIC[8] = { 'M', 'Y', 'O', 'S', 'L', 'O', 'G', 0 };
+const uint32_t LOG_BYTE_ORDER = 0x01020304;
+const uint32_t LOG_VERSION = 1;
+
+// About five minutes of one armband's 50 Hz stream, so only a stalled disk ever drops anything.
+const size_t LOG_RING_SIZE = 16384;
+
+// A file opened for appending, with an explicit flush to disk.
+class AppendFile
+{
+public:
+	explicit AppendFile(const std::string& path)
+		: path(path)
+	{
+#ifdef _WIN32
+		// Nobody else may write, so once at the end the file pointer stays there.
+		file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+		LARGE_INTEGER zero;
+		zero.QuadPart = 0;
+		bool opened = file != INVALID_HANDLE_VALUE && SetFilePointerEx(file, zero, 0, FILE_END) != 0;
+#else
+		descriptor = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+		bool opened = descriptor >= 0;
+#endif
+		if (!opened)
+		{
+			throw std::runtime_error("Unable to open " + path + " for appending");
+		}
+	}
+
+	~AppendFile()
+	{
+#ifdef _WIN32
+		CloseHandle(file);
+#else
+		close(descriptor);
+#endif
+	}
+
+	uint64_t size() const
+	{
+#ifdef _WIN32
+		LARGE_INTEGER size;
+		bool known = GetFileSizeEx(file, &size) != 0;
+		uint64_t bytes = static_cast<uint64_t>(size.QuadPart);
+#else
+		struct stat status;
+		bool known = fstat(descriptor, &status) == 0;
+		uint64_t bytes = static_cast<uint64_t>(status.st_size);
+#endif
+		if (!known)
+		{
+			throw std::runtime_error("Unable to read the size of " + path);
+		}
+		return bytes;
+	}
+
+	void append(const void* data, size_t bytes)
+	{
+		const char* next = static_cast<const char*>(data);
+		while (bytes > 0)
+		{
+#ifdef _WIN32
+			DWORD wrote = 0;
+			DWORD chunk = static_cast<DWORD>(std::min<size_t>(bytes, 1 << 30));
+			bool ok = WriteFile(file, next, chunk, &wrote, 0) != 0;
+#else
+			ssize_t wrote = write(descriptor, next, bytes);
+			bool ok = wrote > 0;
+#endif
+			if (!ok)
+			{
+				throw std::runtime_error("Unable to write to " + path);
+			}
+			next += wrote;
+			bytes -= static_cast<size_t>(wrote);
+		}
+	}
+
+	// Returns once everything appended so far is on the disk.
+	void sync()
+	{
+#ifdef _WIN32
+		bool ok = FlushFileBuffers(file) != 0;
+#else
+		bool ok = fsync(descriptor) == 0;
+#endif
+		if (!ok)
+		{
+			throw std::runtime_error("Unable to flush " + path + " to disk");
+		}
+	}
+
+private:
+	AppendFile(const AppendFile&);
+	AppendFile& operator=(const AppendFile&);
+
+	std::string path;
+#ifdef _WIN32
+	HANDLE file;
+#else
+	int descriptor;
+#endif
+};
+
+// The writing side. Opening it starts a new session at the end of the file. The record functions are for the source
+// thread only (the ring has a single producer) and never block.
+class SessionLog
+{
+public:
+	explicit SessionLog(const std::string& path, unsigned int batchMs = 100, unsigned int syncMs = 1000)
+		: file(path), path(path), batchMs(batchMs), syncMs(syncMs), stopping(false), written(0)
+	{
+		uint64_t size = file.size();
+		if (size == 0)
+		{
+			LogHeader header;
+			std::memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+			header.byteOrder = LOG_BYTE_ORDER;
+			header.version = LOG_VERSION;
+			file.append(&header, sizeof(header));
+		}
+		else
+		{
+			checkHeader(size);
+			// Pad a record cut short by a crash out to a whole one, so everything after it lines up again.
+			size_t torn = static_cast<size_t>((size - sizeof(LogHeader)) % sizeof(LogRecord));
+			if (torn != 0)
+			{
+				char zeros[sizeof(LogRecord)] = {};
+				file.append(zeros, sizeof(LogRecord) - torn);
+			}
+		}
+
+		LogRecord session = record(logSession, 0, static_cast<uint64_t>(std::chrono::duration_cast<
+			std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count()));
+		file.append(&session, sizeof(session));
+		file.sync();
+		writer = std::thread(&SessionLog::run, this);
+	}
+
+	~SessionLog()
+	{
+		finish();
+	}
+
+	void orientation(int device, uint64_t timestamp, const Quat& quat, PoseType pose, bool locked)
+	{
+		LogRecord entry = record(logOrientation, device, timestamp);
+		entry.quat = quat;
+		entry.pose = static_cast<uint8_t>(pose);
+		entry.locked = locked;
+		ring.push(entry);
+	}
+
+	void pose(int device, uint64_t timestamp, PoseType pose)
+	{
+		LogRecord entry = record(logPose, device, timestamp);
+		entry.pose = static_cast<uint8_t>(pose);
+		ring.push(entry);
+	}
+
+	void lock(int device, uint64_t timestamp, bool locked)
+	{
+		LogRecord entry = record(logLock, device, timestamp);
+		entry.locked = locked;
+		ring.push(entry);
+	}
+
+	// Writes out whatever is still queued, flushes it to disk and stops the writer. Call it once the source has
+	// stopped; it throws if any write failed along the way.
+	void stop()
+	{
+		finish();
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+	}
+
+	// Records on disk this session, not counting the logSession record, and records dropped.
+	uint64_t recordsWritten() const
+	{
+		return written.load(std::memory_order_relaxed);
+	}
+
+	uint64_t recordsDropped() const
+	{
+		return ring.droppedCount();
+	}
+
+private:
+	SessionLog(const SessionLog&);
+	SessionLog& operator=(const SessionLog&);
+
+	static LogRecord record(LogKind kind, int device, uint64_t timestamp)
+	{
+		LogRecord entry;
+		std::memset(&entry, 0, sizeof(entry));
+		entry.timestamp = timestamp;
+		entry.device = static_cast<uint8_t>(device);
+		entry.kind = static_cast<uint8_t>(kind);
+		return entry;
+	}
+
+	void checkHeader(uint64_t size)
+	{
+		LogHeader header;
+		std::ifstream in(path.c_str(), std::ios::binary);
+		if (size < sizeof(header) || !in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+			std::memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0 || header.byteOrder != LOG_BYTE_ORDER ||
+			header.version != LOG_VERSION)
+		{
+			throw std::runtime_error(path + " is not a session log this version can append to");
+		}
+	}
+
+	void finish()
+	{
+		if (!writer.joinable())
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		writer.join();
+	}
+
+	// The writer thread: every batchMs, everything queued goes out in one write.
+	void run()
+	{
+		std::vector<LogRecord> batch;
+		batch.reserve(LOG_RING_SIZE + 1);
+		uint64_t reported = 0;
+		std::chrono::steady_clock::time_point synced = std::chrono::steady_clock::now();
+		bool more = true;
+		while (more)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				more = !wake.wait_for(lock, std::chrono::milliseconds(batchMs), [&] { return stopping; });
+			}
+
+			batch.clear();
+			LogRecord entry;
+			while (ring.pop(entry))
+			{
+				batch.push_back(entry);
+			}
+			uint64_t dropped = ring.droppedCount();
+			if (dropped != reported)
+			{
+				LogRecord gap = record(logDropped, 0, batch.empty() ? 0 : batch.back().timestamp);
+				gap.count = static_cast<uint32_t>(std::min<uint64_t>(dropped - reported, UINT32_MAX));
+				batch.push_back(gap);
+				reported = dropped;
+			}
+			if (!error.empty())
+			{
+				continue;
+			}
+
+			try {
+				if (!batch.empty())
+				{
+					file.append(&batch[0], batch.size() * sizeof(LogRecord));
+					written.fetch_add(batch.size(), std::memory_order_relaxed);
+				}
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				if (!more || now - synced >= std::chrono::milliseconds(syncMs))
+				{
+					file.sync();
+					synced = now;
+				}
+			}
+			catch (const std::exception& e) {
+				// Keep draining so the callback never notices, but stop writing; stop() reports it.
+				error = e.what();
+			}
+		}
+	}
+
+	AppendFile file;
+	std::string path;
+	unsigned int batchMs;
+	unsigned int syncMs;
+	SampleRing<LogRecord, LOG_RING_SIZE> ring;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+	std::atomic<uint64_t> written;
+	std::string error;
+};
+
+// The reading side: a whole log mapped read-only. A record cut short at the very end is left out; records of kind
+// logPadding anywhere are to be skipped.
+class SessionLogFile
+{
+public:
+	explicit SessionLogFile(const std::string& path)
+		: file(path)
+	{
+		const LogHeader* header = reinterpret_cast<const LogHeader*>(file.data());
+		if (file.size() < sizeof(LogHeader) || std::memcmp(header->magic, LOG_MAGIC, sizeof(header->magic)) != 0)
+		{
+			throw std::runtime_error(path + " is not a session log");
+		}
+		if (header->byteOrder != LOG_BYTE_ORDER)
+		{
+			throw std::runtime_error(path + " was written with another byte order");
+		}
+		if (header->version != LOG_VERSION)
+		{
+			throw std::runtime_error(path + " is version " + std::to_string(header->version) + ", expected " +
+				std::to_string(LOG_VERSION));
+		}
+		count = (file.size() - sizeof(LogHeader)) / sizeof(LogRecord);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	const LogRecord* records() const
+	{
+		return reinterpret_cast<const LogRecord*>(file.data() + sizeof(LogHeader));
+	}
+
+private:
+	MappedFile file;
+	size_t count;
+};
+
+#endif // SESSIONLOG_H
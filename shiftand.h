@@ -0,0 +1,404 @@
+#ifndef SHIFTAND_H
+#define SHIFTAND_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// The bit-parallel automaton behind Shift-And template matching (Baeza-Yates and Gonnet), run with the same strike
+// rules GestureListener has always used: a sample within tolerance of a template's next step advances it, any other
+// sample is a strike, and the sample after maxStrikes strikes sends the template back to its first step with none.
+// Strikes are only cleared by starting over, so they add up over a whole attempt. Every template step gets one bit;
+// each sample arrives as a mask of the steps it is within tolerance of, and applying it to every step of every
+// template is a few shifts, ANDs and ORs and one add per 64 steps. How the mask is worked out is up to the matcher
+// that owns the automaton.
+//
+// The state has one row per number of strikes: bit j of row d is set if a template is waiting for its step at bit j
+// with d strikes so far. Each template is in exactly one place at a time, so it has exactly one bit set across the
+// rows. A hit moves the bit one step along in its row, a strike moves it up a row, and a template that completes or
+// runs out of strikes goes back to its first step in row 0.
+//
+// Templates are packed back to back into the bit vector, each one backwards: its first step takes the highest of its
+// bits and its last step the lowest, so moving on is a shift right. That puts each template's first bit above the
+// rest, where a carry can reach it: adding the bits of the templates that start over to the complement of the first
+// bits carries each of them up to its own template's first bit and no further, for any number of templates at once.
+class ShiftAndAutomaton
+{
+public:
+	explicit ShiftAndAutomaton(int maxStrikes)
+		: maxStrikes(maxStrikes), bits(0), words(0), carried(maxStrikes + 1)
+	{
+	}
+
+	void clear()
+	{
+		bits = 0;
+		words = 0;
+		first.clear();
+		last.clear();
+		templateStart.clear();
+		templateLength.clear();
+		state.clear();
+		ended.clear();
+		restart.clear();
+		done.clear();
+	}
+
+	// Adds a template of the given number of steps and returns its index. Its steps take bits start(index) to
+	// start(index) + steps - 1, in the order bit() gives. It joins at its first step, with no strikes.
+	int add(int steps)
+	{
+		int index = static_cast<int>(templateStart.size());
+		templateStart.push_back(bits);
+		templateLength.push_back(steps);
+		if (steps == 0)
+		{
+			return index;
+		}
+
+		int needed = (bits + steps + 63) / 64;
+		if (needed > words)
+		{
+			// The rows are laid out one after another, so each has to move to its new offset.
+			std::vector<uint64_t> grown(static_cast<size_t>(maxStrikes + 2) * needed, 0);
+			for (int d = 0; d <= maxStrikes; d++)
+			{
+				std::copy(row(d), row(d) + words, grown.begin() + static_cast<size_t>(d + 1) * needed);
+			}
+			state.swap(grown);
+			words = needed;
+			first.resize(words, 0);
+			last.resize(words, 0);
+			ended.resize(words, 0);
+			restart.resize(words, 0);
+		}
+		int top = bits + steps - 1;
+		first[top / 64] |= uint64_t(1) << (top % 64);
+		last[bits / 64] |= uint64_t(1) << (bits % 64);
+		row(0)[top / 64] |= uint64_t(1) << (top % 64);
+		bits += steps;
+		return index;
+	}
+
+	int size() const
+	{
+		return static_cast<int>(templateStart.size());
+	}
+
+	int start(int t) const
+	{
+		return templateStart[t];
+	}
+
+	// The bit of template t's step j.
+	int bit(int t, int j) const
+	{
+		return templateStart[t] + templateLength[t] - 1 - j;
+	}
+
+	// Total template steps, and the 64-bit words a sample's mask takes up.
+	int totalSteps() const
+	{
+		return bits;
+	}
+
+	int wordCount() const
+	{
+		return words;
+	}
+
+	// Sends every template back to its first step, with no strikes.
+	void reset()
+	{
+		std::fill(state.begin(), state.end(), 0);
+		std::copy(first.begin(), first.end(), state.begin() + words);
+	}
+
+	// Fills wanted with the steps whose mask bits the next step() will read: the step each template is waiting for,
+	// one per template. The rest of a mask doesn't matter, so a matcher that can't look a mask up in one go only needs
+	// to work out these bits.
+	void wanted(uint64_t* out) const
+	{
+		std::fill(out, out + words, uint64_t(0));
+		for (int d = 0; d <= maxStrikes; d++)
+		{
+			const uint64_t* strikes = row(d);
+			for (int w = 0; w < words; w++)
+			{
+				out[w] |= strikes[w];
+			}
+		}
+	}
+
+	// Advances every template by one sample, given as wordCount() words of the steps it is within tolerance of.
+	// Returns how many templates this sample completed, and completions() lists them. A completed template starts
+	// over.
+	int step(const uint64_t* mask)
+	{
+		done.clear();
+		if (words == 0)
+		{
+			return 0;
+		}
+		const int count = words;
+		const uint64_t* firsts = &first[0];
+		const uint64_t* lasts = &last[0];
+		uint64_t* ending = &ended[0];
+		uint64_t* restarting = &restart[0];
+
+		// Words from the top down, so each one's lowest hits can move down into the word below, and in each word the
+		// rows from the top down, so each one still reads the row below as it was before this sample. A hit moves
+		// one bit down, except from a template's last step onto the first step of the template below it; a strike
+		// moves a template from the row below up into this one. Below row 0 is a row of zeros.
+		uint64_t* down = &carried[0];
+		std::fill(down, down + maxStrikes + 1, uint64_t(0));
+		uint64_t* top = row(maxStrikes);
+		for (int w = count - 1; w >= 0; w--)
+		{
+			uint64_t accept = mask[w];
+			uint64_t steps = ~firsts[w];
+			// A strike with none left to give.
+			restarting[w] = top[w] & ~accept;
+			uint64_t ends = 0;
+			uint64_t* current = top + w;
+			for (int d = maxStrikes; d >= 0; d--, current -= count)
+			{
+				uint64_t hits = *current & accept;
+				ends |= hits;
+				*current = (((hits >> 1) | down[d]) & steps) | (current[-count] & ~accept);
+				down[d] = hits << 63;
+			}
+			ending[w] = ends & lasts[w];
+		}
+
+		// Templates that reached their last step, and those that struck out, start over: the carry takes each of
+		// their bits up through the rest of the template to its first step.
+		uint64_t* bottom = row(0);
+		uint64_t carry = 0;
+		uint64_t anyEnded = 0;
+		for (int w = 0; w < count; w++)
+		{
+			uint64_t starting = restarting[w] | ending[w];
+			uint64_t sum = starting + ~firsts[w];
+			uint64_t overflow = sum < starting ? 1 : 0;
+			uint64_t total = sum + carry;
+			overflow |= total < sum ? 1 : 0;
+			carry = overflow;
+			bottom[w] |= total & firsts[w];
+			anyEnded |= ending[w];
+		}
+
+		if (anyEnded != 0)
+		{
+			for (int w = 0; w < count; w++)
+			{
+				recordCompletions(w, ending[w]);
+			}
+		}
+		return static_cast<int>(done.size());
+	}
+
+	// The templates the last step() completed, in the order they were added.
+	const std::vector<int>& completions() const
+	{
+		return done;
+	}
+
+private:
+	// The row of templates with d strikes.
+	uint64_t* row(int d)
+	{
+		return state.data() + static_cast<size_t>(d + 1) * words;
+	}
+
+	const uint64_t* row(int d) const
+	{
+		return state.data() + static_cast<size_t>(d + 1) * words;
+	}
+
+	static int lowestBit(uint64_t value)
+	{
+		int bit = 0;
+		while ((value & 1) == 0)
+		{
+			value >>= 1;
+			bit++;
+		}
+		return bit;
+	}
+
+	// Adds the template of each last-step bit in word w of finished to done. Bits come in order, and so do templates.
+	void recordCompletions(int w, uint64_t finished)
+	{
+		while (finished != 0)
+		{
+			int bit = w * 64 + lowestBit(finished);
+			finished &= finished - 1;
+			// Empty templates share the start bit of the template after them.
+			int t = static_cast<int>(std::lower_bound(templateStart.begin(), templateStart.end(), bit)
+				- templateStart.begin());
+			while (templateLength[t] == 0)
+			{
+				t++;
+			}
+			done.push_back(t);
+		}
+	}
+
+	int maxStrikes;
+	int bits;
+	int words;
+
+	// Each template's first and last step.
+	std::vector<uint64_t> first;
+	std::vector<uint64_t> last;
+	std::vector<int> templateStart;
+	std::vector<int> templateLength;
+
+	// A row of zeros, then maxStrikes + 1 rows of words.
+	std::vector<uint64_t> state;
+
+	// While a sample is applied: the last steps it completed, the steps of templates it struck out, and each row's
+	// hits moving down into the word below.
+	std::vector<uint64_t> ended;
+	std::vector<uint64_t> restart;
+	std::vector<uint64_t> carried;
+
+	// The templates the last sample completed.
+	std::vector<int> done;
+};
+
+// Shift-And over quantized orientation buckets. A sample is within tolerance of a step if it is on every axis, so
+// its mask is the AND of three precompiled masks, one per axis: for each roll bucket, the steps that accept that roll,
+// and the same for pitch and yaw. That is exact, costs two ANDs per 64 steps, and takes three rows per bucket instead
+// of one per (roll, pitch, yaw) cell, so it stays small however many buckets the quantizer has.
+class ShiftAndMatcher
+{
+public:
+	// Buckets span 0..bins on each axis, the range the quantizer produces.
+	ShiftAndMatcher(int bins, int tolerance, int maxStrikes)
+		: axis(bins + 1), tolerance(tolerance), automaton(maxStrikes)
+	{
+	}
+
+	void clear()
+	{
+		rollMasks.clear();
+		pitchMasks.clear();
+		yawMasks.clear();
+		mask.clear();
+		automaton.clear();
+	}
+
+	// Adds a template, compiling each of its steps into the axis masks, and returns its index. Empty templates are
+	// accepted but never match. tolerances, if given, has one per step and overrides the matcher's tolerance for that
+	// step.
+	int add(const int* roll, const int* pitch, const int* yaw, int steps, const int* tolerances = 0)
+	{
+		int words = automaton.wordCount();
+		int index = automaton.add(steps);
+		int needed = automaton.wordCount();
+
+		// The masks are bucket-major, so a sample's lookup reads one contiguous run of words per axis. Growing the
+		// state means spreading them out, but that only happens when a template is added.
+		if (needed > words)
+		{
+			grow(rollMasks, words, needed);
+			grow(pitchMasks, words, needed);
+			grow(yawMasks, words, needed);
+			mask.resize(needed, 0);
+		}
+
+		for (int j = 0; j < steps; j++)
+		{
+			int bit = automaton.bit(index, j);
+			int reach = tolerances ? tolerances[j] : tolerance;
+			mark(rollMasks, roll[j], reach, bit, needed);
+			mark(pitchMasks, pitch[j], reach, bit, needed);
+			mark(yawMasks, yaw[j], reach, bit, needed);
+		}
+		return index;
+	}
+
+	int size() const
+	{
+		return automaton.size();
+	}
+
+	// Sends every template back to its first step, with no strikes.
+	void reset()
+	{
+		automaton.reset();
+	}
+
+	// Advances every template by one sample. Returns how many templates this sample completed, and completions()
+	// lists them. A completed template starts over.
+	int push(int roll, int pitch, int yaw)
+	{
+		int words = automaton.wordCount();
+		if (words == 0)
+		{
+			return 0;
+		}
+		const uint64_t* r = &rollMasks[bucket(roll) * words];
+		const uint64_t* p = &pitchMasks[bucket(pitch) * words];
+		const uint64_t* y = &yawMasks[bucket(yaw) * words];
+		for (int w = 0; w < words; w++)
+		{
+			mask[w] = r[w] & p[w] & y[w];
+		}
+		return automaton.step(&mask[0]);
+	}
+
+	// The templates the last push() completed, in the order they were added.
+	const std::vector<int>& completions() const
+	{
+		return automaton.completions();
+	}
+
+	// Bytes held by the masks.
+	size_t memoryBytes() const
+	{
+		return (rollMasks.capacity() + pitchMasks.capacity() + yawMasks.capacity() + mask.capacity()) *
+			sizeof(uint64_t);
+	}
+
+private:
+	size_t bucket(int value) const
+	{
+		return static_cast<size_t>(std::min(axis - 1, std::max(0, value)));
+	}
+
+	// Re-lays out one axis's masks from words to needed words per bucket.
+	void grow(std::vector<uint64_t>& masks, int words, int needed) const
+	{
+		std::vector<uint64_t> grown(static_cast<size_t>(needed) * axis, 0);
+		for (int b = 0; b < axis && words > 0; b++)
+		{
+			std::copy(&masks[static_cast<size_t>(b) * words], &masks[static_cast<size_t>(b) * words] + words,
+				&grown[static_cast<size_t>(b) * needed]);
+		}
+		masks.swap(grown);
+	}
+
+	// Sets bit in the masks of every bucket within reach of value.
+	void mark(std::vector<uint64_t>& masks, int value, int reach, int bit, int words) const
+	{
+		uint64_t flag = uint64_t(1) << (bit % 64);
+		for (int b = std::max(0, value - reach); b <= std::min(axis - 1, value + reach); b++)
+		{
+			masks[static_cast<size_t>(b) * words + bit / 64] |= flag;
+		}
+	}
+
+	int axis;
+	int tolerance;
+
+	// rollMasks[bucket * words + w]: word w of the steps that accept that roll bucket, and the same for pitch and
+	// yaw. mask is the current sample's, all three ANDed together.
+	std::vector<uint64_t> rollMasks, pitchMasks, yawMasks;
+	std::vector<uint64_t> mask;
+	ShiftAndAutomaton automaton;
+};
+
+#endif // SHIFTAND_H
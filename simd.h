@@ -0,0 +1,11 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// The vectorized kernels use SSE2, which every x64 target has. Other targets, or builds with MYO_NO_SIMD defined,
+// fall back to the plain scalar loops.
+#if !defined(MYO_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MYO_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#endif // SIMD_H
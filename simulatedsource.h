@@ -0,0 +1,397 @@
+#ifndef SIMULATEDSOURCE_H
+#define SIMULATEDSOURCE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "emg.h"
+#include "orientation.h"
+#include "samplesource.h"
+
+// Sources that don't need an armband: ReplaySource plays back a recorded text file and SyntheticSource generates
+// arm motion. Both can run at real time, at any multiple of it, or as fast as the consumers allow.
+
+// One device event, as read from a file or generated.
+struct SourceEvent
+{
+	enum Kind
+	{
+		orientationEvent,
+		poseEvent,
+		armSyncEvent,
+		armUnsyncEvent,
+		unlockEvent,
+		lockEvent,
+		accelerometerEvent,
+		gyroscopeEvent,
+		emgEvent
+	};
+
+	uint64_t timestamp;
+	int device;
+	Kind kind;
+	Quat quat;
+	Vec3 vec;
+	int8_t emg[EMG_CHANNELS];
+	PoseType pose;
+	ArmSide arm;
+};
+
+// Paces a stream of SourceEvents by their timestamps (in microseconds, like the Myo's) and dispatches them to the
+// listeners. A speed of 1 is real time, 10 is ten times faster, and 0 or less means no pacing at all.
+class ScriptedSource : public SampleSource
+{
+public:
+	explicit ScriptedSource(double speed)
+		: speed(speed), started(false), havePending(false)
+	{
+	}
+
+	bool run(unsigned int durationMs)
+	{
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point sliceEnd = Clock::now() + std::chrono::milliseconds(durationMs);
+
+		while (true)
+		{
+			if (!havePending)
+			{
+				if (!nextEvent(pending))
+				{
+					return false;
+				}
+				havePending = true;
+			}
+
+			if (speed > 0)
+			{
+				if (!started)
+				{
+					startWall = Clock::now();
+					startStamp = pending.timestamp;
+					started = true;
+				}
+				double offsetUs = static_cast<double>(pending.timestamp - startStamp) / speed;
+				Clock::time_point due = startWall + std::chrono::microseconds(static_cast<int64_t>(offsetUs));
+				if (due > sliceEnd)
+				{
+					std::this_thread::sleep_until(sliceEnd);
+					return true;
+				}
+				std::this_thread::sleep_until(due);
+			}
+			else if (Clock::now() >= sliceEnd)
+			{
+				return true;
+			}
+
+			dispatch(pending);
+			havePending = false;
+		}
+	}
+
+protected:
+	// Produces the next event in timestamp order, or returns false when there are no more.
+	virtual bool nextEvent(SourceEvent& event) = 0;
+
+private:
+	void dispatch(const SourceEvent& event)
+	{
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			SampleListener* listener = listeners[i];
+			switch (event.kind)
+			{
+			case SourceEvent::orientationEvent:
+				listener->onOrientationData(event.device, event.timestamp, event.quat);
+				break;
+			case SourceEvent::poseEvent: listener->onPose(event.device, event.timestamp, event.pose); break;
+			case SourceEvent::armSyncEvent: listener->onArmSync(event.device, event.timestamp, event.arm); break;
+			case SourceEvent::armUnsyncEvent: listener->onArmUnsync(event.device, event.timestamp); break;
+			case SourceEvent::unlockEvent: listener->onUnlock(event.device, event.timestamp); break;
+			case SourceEvent::lockEvent: listener->onLock(event.device, event.timestamp); break;
+			case SourceEvent::accelerometerEvent:
+				listener->onAccelerometerData(event.device, event.timestamp, event.vec);
+				break;
+			case SourceEvent::gyroscopeEvent:
+				listener->onGyroscopeData(event.device, event.timestamp, event.vec);
+				break;
+			case SourceEvent::emgEvent:
+				listener->onEmgData(event.device, event.timestamp, event.emg);
+				break;
+			}
+		}
+	}
+
+	double speed;
+	bool started;
+	std::chrono::steady_clock::time_point startWall;
+	uint64_t startStamp;
+	bool havePending;
+	SourceEvent pending;
+};
+
+// Plays back a text recording with one event per line:
+//
+//     <timestamp us> <device> o <w> <x> <y> <z>    orientation
+//     <timestamp us> <device> a <x> <y> <z>        accelerometer, in g
+//     <timestamp us> <device> g <x> <y> <z>        gyroscope, in deg/s
+//     <timestamp us> <device> e <8 values>         EMG, -128 to 127 per channel
+//     <timestamp us> <device> p <pose>             pose, as a PoseType number
+//     <timestamp us> <device> s <L|R|?>            arm sync
+//     <timestamp us> <device> n                    arm unsync
+//     <timestamp us> <device> u                    unlock
+//     <timestamp us> <device> l                    lock
+//
+// Blank lines and lines starting with '#' are ignored.
+class ReplaySource : public ScriptedSource
+{
+public:
+	ReplaySource(const std::string& path, double speed)
+		: ScriptedSource(speed), file(path.c_str()), lineNumber(0)
+	{
+		if (!file)
+		{
+			throw std::runtime_error("Unable to open replay file " + path);
+		}
+	}
+
+protected:
+	bool nextEvent(SourceEvent& event)
+	{
+		std::string line;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+			if (line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+
+			std::istringstream in(line);
+			char kind = 0;
+			in >> event.timestamp >> event.device >> kind;
+			switch (kind)
+			{
+			case 'o':
+				event.kind = SourceEvent::orientationEvent;
+				in >> event.quat.w >> event.quat.x >> event.quat.y >> event.quat.z;
+				break;
+			case 'a':
+				event.kind = SourceEvent::accelerometerEvent;
+				in >> event.vec.x >> event.vec.y >> event.vec.z;
+				break;
+			case 'g':
+				event.kind = SourceEvent::gyroscopeEvent;
+				in >> event.vec.x >> event.vec.y >> event.vec.z;
+				break;
+			case 'e':
+				event.kind = SourceEvent::emgEvent;
+				for (int c = 0; c < EMG_CHANNELS; c++)
+				{
+					int value = 0;
+					in >> value;
+					event.emg[c] = static_cast<int8_t>(value);
+				}
+				break;
+			case 'p':
+			{
+				int pose = poseUnknown;
+				in >> pose;
+				event.kind = SourceEvent::poseEvent;
+				event.pose = static_cast<PoseType>(pose);
+				break;
+			}
+			case 's':
+			{
+				char arm = '?';
+				in >> arm;
+				event.kind = SourceEvent::armSyncEvent;
+				event.arm = arm == 'L' ? sideLeft : arm == 'R' ? sideRight : sideUnknown;
+				break;
+			}
+			case 'n': event.kind = SourceEvent::armUnsyncEvent; break;
+			case 'u': event.kind = SourceEvent::unlockEvent; break;
+			case 'l': event.kind = SourceEvent::lockEvent; break;
+			default:
+				in.setstate(std::ios::failbit);
+			}
+			if (!in)
+			{
+				throw std::runtime_error("Malformed replay line " + std::to_string(lineNumber) + ": " + line);
+			}
+			return true;
+		}
+		return false;
+	}
+
+private:
+	std::ifstream file;
+	int lineNumber;
+};
+
+// Generates a repeating elbow-curl-like motion (a pitch swing with some roll and a slow yaw drift, plus a little
+// noise) for one or more devices, with IMU data at rateHz and EMG at four times that. Every tapPeriods periods every
+// device double taps and goes back to rest a step later, the way a patient ends a recording; 0 never taps. Runs for
+// durationSeconds of simulated time, or forever if that is 0.
+class SyntheticSource : public ScriptedSource
+{
+public:
+	SyntheticSource(double speed, double rateHz = 50.0, double periodSeconds = 4.0, double durationSeconds = 0.0,
+		int devices = 1, int tapPeriods = 1)
+		: ScriptedSource(speed), intervalUs(static_cast<uint64_t>(1e6 / rateHz)), periodSeconds(periodSeconds),
+		durationUs(static_cast<uint64_t>(durationSeconds * 1e6)),
+		tapUs(static_cast<uint64_t>(periodSeconds * tapPeriods * 1e6)), devices(devices), step(0), tick(0), device(0),
+		part(0), posed(0), announced(0), noiseState(12345)
+	{
+	}
+
+protected:
+	bool nextEvent(SourceEvent& event)
+	{
+		// Each device first syncs to an arm and settles into rest, like a freshly worn armband.
+		if (announced < devices * 2)
+		{
+			event.timestamp = 0;
+			event.device = announced / 2;
+			if (announced % 2 == 0)
+			{
+				event.kind = SourceEvent::armSyncEvent;
+				event.arm = event.device % 2 == 0 ? sideRight : sideLeft;
+			}
+			else
+			{
+				event.kind = SourceEvent::poseEvent;
+				event.pose = poseRest;
+			}
+			announced++;
+			return true;
+		}
+
+		// Each step covers one IMU interval. EMG runs at four times the IMU rate, so a step is split into four EMG
+		// ticks; the first one also carries the orientation, accelerometer and gyroscope events.
+		uint64_t timestamp = step * intervalUs + tick * intervalUs / EMG_PER_IMU;
+		if (durationUs != 0 && timestamp >= durationUs)
+		{
+			return false;
+		}
+
+		// A step that starts a new tap interval opens with a double tap on every device, and the step after it with
+		// the return to rest.
+		bool poseStep = tapped(step) || (step > 0 && tapped(step - 1));
+		if (tick == 0 && part == 0 && device == 0 && posed < devices && poseStep)
+		{
+			event.timestamp = timestamp;
+			event.device = posed++;
+			event.kind = SourceEvent::poseEvent;
+			event.pose = tapped(step) ? poseDoubleTap : poseRest;
+			return true;
+		}
+
+		double t = timestamp / 1e6;
+		double omega = 2.0 * M_PI / periodSeconds;
+		double phase = omega * t + device * 0.5;
+
+		event.timestamp = timestamp;
+		event.device = device;
+
+		int kind = tick == 0 ? part : 3;
+		if (kind == 0)
+		{
+			float roll = static_cast<float>(0.4 * std::sin(phase * 0.5) + noise());
+			float pitch = static_cast<float>(1.1 * std::sin(phase) + noise());
+			float yaw = static_cast<float>(std::fmod(0.05 * t, 2.0 * M_PI) - M_PI + noise());
+			quat = quatFromEuler(roll, pitch, yaw);
+			event.kind = SourceEvent::orientationEvent;
+			event.quat = quat;
+		}
+		else if (kind == 1)
+		{
+			// Gravity seen from the armband's frame, in g.
+			event.kind = SourceEvent::accelerometerEvent;
+			event.vec.x = 2.0f * (quat.x * quat.z - quat.w * quat.y);
+			event.vec.y = 2.0f * (quat.y * quat.z + quat.w * quat.x);
+			event.vec.z = 1.0f - 2.0f * (quat.x * quat.x + quat.y * quat.y);
+		}
+		else if (kind == 2)
+		{
+			// The Euler angle rates stand in for body rates; close enough for a simulation.
+			const double degrees = 180.0 / M_PI;
+			event.kind = SourceEvent::gyroscopeEvent;
+			event.vec.x = static_cast<float>(0.2 * omega * std::cos(phase * 0.5) * degrees);
+			event.vec.y = static_cast<float>(1.1 * omega * std::cos(phase) * degrees);
+			event.vec.z = static_cast<float>(0.05 * degrees);
+		}
+		else
+		{
+			// Muscle activity follows how hard the arm is swinging: noise whose amplitude tracks the pitch rate.
+			double amplitude = 4.0 + 80.0 * std::fabs(std::cos(phase));
+			event.kind = SourceEvent::emgEvent;
+			for (int c = 0; c < EMG_CHANNELS; c++)
+			{
+				double value = amplitude * noise() * 100.0 * (0.5 + 0.1 * c);
+				event.emg[c] = static_cast<int8_t>(std::max(-128.0, std::min(127.0, value)));
+			}
+		}
+
+		// Advance part, then device, then tick, then step.
+		if (++part < (tick == 0 ? 4 : 1))
+		{
+			return true;
+		}
+		part = 0;
+		if (++device < devices)
+		{
+			return true;
+		}
+		device = 0;
+		if (++tick < EMG_PER_IMU)
+		{
+			return true;
+		}
+		tick = 0;
+		step++;
+		posed = 0;
+		return true;
+	}
+
+private:
+	// Whether step s is the first of a tap interval, the first one excepted.
+	bool tapped(uint64_t s) const
+	{
+		return tapUs != 0 && s > 0 && s * intervalUs / tapUs != (s - 1) * intervalUs / tapUs;
+	}
+
+	// Small deterministic jitter, in radians, so runs are repeatable.
+	double noise()
+	{
+		noiseState = noiseState * 1664525u + 1013904223u;
+		return ((noiseState >> 8) / 16777216.0 - 0.5) * 0.02;
+	}
+
+	uint64_t intervalUs;
+	double periodSeconds;
+	uint64_t durationUs;
+	uint64_t tapUs;
+	int devices;
+	static const int EMG_PER_IMU = 4;
+
+	uint64_t step;
+	int tick;
+	int device;
+	int part;
+	// Devices that have had this step's pose event.
+	int posed;
+	Quat quat;
+	int announced;
+	uint32_t noiseState;
+};
+
+#endif // SIMULATEDSOURCE_H
@@ -0,0 +1,254 @@
+#ifndef SPRING_H
+#define SPRING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "keyframes.h"
+
+// One occurrence of the template found in the stream: the timestamps of its first and last live samples and its DTW
+// distance.
+struct SpringMatch
+{
+	uint64_t start;
+	uint64_t end;
+	float distance;
+};
+
+// Finds every occurrence of a template in an unbounded stream of orientation samples, with subsequence dynamic time
+// warping as in SPRING (Sakurai, Faloutsos and Yamamuro, 2007). Instead of scoring fixed windows, each DTW cell also
+// carries the timestamp its best path started at, and a match may start at any sample. A match is reported once no
+// path that overlaps it can still beat it, so every rep is reported exactly once, soon after it ends, and the next
+// rep is already being tracked while that happens.
+//
+// Two reps may share one sample, the end of one being the start of the next. The stream is filtered, so a single
+// sample stands for however long the arm rested there between reps.
+//
+// Each sample costs O(template length) time, and the only state is two columns of the template's length, so an
+// hour-long session needs no more memory than a single rep. A template given as keyframes (see keyframes.h) is matched
+// segment by segment instead, so a sample costs O(keyframes).
+class SpringMatcher
+{
+public:
+	// A match is accepted if its total distance is within threshold per template step.
+	explicit SpringMatcher(float threshold)
+		: threshold(threshold), segments(false), length(0)
+	{
+	}
+
+	// Copies the template, given as bucket columns, and starts over.
+	void setTemplate(const float* roll, const float* pitch, const float* yaw, int steps)
+	{
+		this->roll.assign(roll, roll + steps);
+		this->pitch.assign(pitch, pitch + steps);
+		this->yaw.assign(yaw, yaw + steps);
+		segments = false;
+		length = steps;
+		resize();
+	}
+
+	// Uses a compressed template instead. A sample's cost against a row is its distance from the row's stretch of the
+	// template: the first keyframe, each segment in turn, then the last keyframe, so a match still has to start and
+	// end at the template's ends. The threshold still counts the original steps.
+	void setTemplate(const KeyframeTrack& track)
+	{
+		int keyframes = track.keyframes();
+		roll.clear();
+		pitch.clear();
+		yaw.clear();
+		alongRoll.clear();
+		alongPitch.clear();
+		alongYaw.clear();
+		inverseSquared.clear();
+		span.clear();
+		for (int k = 0; k < keyframes; k++)
+		{
+			int previous = std::max(0, k - 1);
+			span.push_back(static_cast<float>(std::max(1, track.index[k] - track.index[previous])));
+			roll.push_back(track.roll[previous]);
+			pitch.push_back(track.pitch[previous]);
+			yaw.push_back(track.yaw[previous]);
+			along(track.roll[k] - track.roll[previous], track.pitch[k] - track.pitch[previous],
+				track.yaw[k] - track.yaw[previous]);
+		}
+		if (keyframes > 1)
+		{
+			roll.push_back(track.roll.back());
+			pitch.push_back(track.pitch.back());
+			yaw.push_back(track.yaw.back());
+			along(0, 0, 0);
+			span.push_back(1.0f);
+		}
+		segments = true;
+		length = track.length();
+		resize();
+	}
+
+	void reset()
+	{
+		std::fill(previousDistance.begin(), previousDistance.end(), std::numeric_limits<float>::infinity());
+		if (!previousDistance.empty())
+		{
+			previousDistance[0] = 0;
+		}
+		std::fill(previousStart.begin(), previousStart.end(), 0);
+		pending = false;
+	}
+
+	// Feeds the next sample. Returns true, and fills in match, when this sample confirms an earlier match.
+	bool push(uint64_t timestamp, float r, float p, float y, SpringMatch& match)
+	{
+		int rows = static_cast<int>(roll.size());
+		if (rows == 0)
+		{
+			return false;
+		}
+
+		// Row 0 is the empty template prefix: a match can start at any sample for free.
+		distance[0] = 0;
+		start[0] = timestamp;
+		for (int i = 1; i <= rows; i++)
+		{
+			// Staying on a row costs the sample's distance from it. Moving onto a row, from the row before, costs its
+			// distance from where the row starts, once for each template step the row stands for. For a single step
+			// both are the same thing. For a segment, entering it anywhere but its start costs about what skipping
+			// its steps would against the full template, so one sample can't cross a whole segment for free.
+			float entry = std::max(std::fabs(r - roll[i - 1]), std::max(std::fabs(p - pitch[i - 1]),
+				std::fabs(y - yaw[i - 1])));
+			float stay = entry;
+			if (segments)
+			{
+				stay = segmentCost(i - 1, r, p, y);
+				entry *= span[i - 1];
+			}
+
+			// Ties go to this sample's own column, so a match never claims to start before its first sample.
+			float vertical = distance[i - 1] + entry;
+			float horizontal = previousDistance[i] + stay;
+			float diagonal = previousDistance[i - 1] + entry;
+			bool across = horizontal < vertical;
+			float best = across ? horizontal : vertical;
+			uint64_t bestStart = across ? previousStart[i] : start[i - 1];
+			bool back = diagonal < best;
+			distance[i] = back ? diagonal : best;
+			start[i] = back ? previousStart[i - 1] : bestStart;
+		}
+
+		bool reported = false;
+		if (pending)
+		{
+			// The candidate is final once every path that overlaps it is already worse.
+			bool confirmed = true;
+			for (int i = 1; i <= rows && confirmed; i++)
+			{
+				confirmed = distance[i] >= candidate.distance || start[i] >= candidate.end;
+			}
+			if (confirmed)
+			{
+				match = candidate;
+				pending = false;
+				reported = true;
+				// Paths through the reported match can't be reused for the next one.
+				for (int i = 1; i <= rows; i++)
+				{
+					if (start[i] < candidate.end)
+					{
+						distance[i] = std::numeric_limits<float>::infinity();
+					}
+				}
+			}
+		}
+
+		if (distance[rows] <= threshold * length &&
+			(!pending || (distance[rows] < candidate.distance && start[rows] < candidate.end)))
+		{
+			pending = true;
+			candidate.start = start[rows];
+			candidate.end = timestamp;
+			candidate.distance = distance[rows];
+		}
+
+		distance.swap(previousDistance);
+		start.swap(previousStart);
+		return reported;
+	}
+
+	// Reports the pending candidate, if any, without waiting for the stream to confirm it. Used when the stream goes
+	// quiet or ends.
+	bool flush(SpringMatch& match)
+	{
+		if (!pending)
+		{
+			return false;
+		}
+		match = candidate;
+		pending = false;
+		for (size_t i = 1; i < previousDistance.size(); i++)
+		{
+			if (previousStart[i] < candidate.end)
+			{
+				previousDistance[i] = std::numeric_limits<float>::infinity();
+			}
+		}
+		return true;
+	}
+
+	bool hasCandidate() const
+	{
+		return pending;
+	}
+
+private:
+	void resize()
+	{
+		int rows = static_cast<int>(roll.size());
+		distance.resize(rows + 1);
+		previousDistance.resize(rows + 1);
+		start.resize(rows + 1);
+		previousStart.resize(rows + 1);
+		reset();
+	}
+
+	void along(float dr, float dp, float dy)
+	{
+		float squared = dr * dr + dp * dp + dy * dy;
+		alongRoll.push_back(dr);
+		alongPitch.push_back(dp);
+		alongYaw.push_back(dy);
+		inverseSquared.push_back(squared > 0 ? 1 / squared : 0.0f);
+	}
+
+	// The Chebyshev distance from the sample to the closest point, by straight-line distance, of the row's segment.
+	float segmentCost(int row, float r, float p, float y) const
+	{
+		float fromR = r - roll[row], fromP = p - pitch[row], fromY = y - yaw[row];
+		float dr = alongRoll[row], dp = alongPitch[row], dy = alongYaw[row];
+		float t = std::min(1.0f, std::max(0.0f, (fromR * dr + fromP * dp + fromY * dy) * inverseSquared[row]));
+		return std::max(std::fabs(fromR - dr * t), std::max(std::fabs(fromP - dp * t), std::fabs(fromY - dy * t)));
+	}
+
+	float threshold;
+
+	// One row per template step, or with keyframes one per stretch: from roll/pitch/yaw, along alongRoll/alongPitch/
+	// alongYaw, whose squared length inverseSquared inverts (0 for a single point).
+	std::vector<float> roll, pitch, yaw;
+	std::vector<float> alongRoll, alongPitch, alongYaw;
+	std::vector<float> inverseSquared;
+	bool segments;
+	// With segments, the template steps each row stands for.
+	std::vector<float> span;
+	// Original template steps, which the threshold is per.
+	int length;
+
+	// The current and previous sample's DTW columns, and where each cell's best path started.
+	std::vector<float> distance, previousDistance;
+	std::vector<uint64_t> start, previousStart;
+
+	bool pending;
+	SpringMatch candidate;
+};
+
+#endif // SPRING_H
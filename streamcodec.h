@@ -0,0 +1,266 @@
+#ifndef STREAMCODEC_H
+#define STREAMCODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+// Compact storage for quantized orientation streams: roll, pitch and yaw buckets, one triple per step. Successive
+// steps almost always move each axis by -1, 0 or +1 bucket, and a sweep repeats the same move for many steps, so the
+// stream is stored as runs of identical deltas:
+//
+//   token   bits 0-4: the delta, (roll + 1) * 9 + (pitch + 1) * 3 + (yaw + 1) when every axis moved by at most one
+//                     bucket, or PACKED_ESCAPE when one moved further
+//           bits 5-7: run length - 1, or 7 for a run of 8 or more
+//   run     varint, run length - 8, only when bits 5-7 are 7
+//   deltas  three zigzag varints, only for PACKED_ESCAPE
+//
+// A whole run is a byte or two however long it is, so a held position or a steady sweep costs almost nothing and
+// even a jittery stream costs a byte a step, against twelve for three ints.
+//
+// The stream is cut into blocks of PACKED_BLOCK_STEPS steps. Each block starts with its first step written out in
+// full, three bytes, and runs never cross into the next block, so any step can be reached by decoding at most one
+// block from the block index, which holds where each block starts.
+
+const size_t PACKED_BLOCK_STEPS = 256;
+const int PACKED_ESCAPE = 27;
+
+// Decodes steps [first, first + count) of a stream of steps steps, stored in bytes bytes with the given block index,
+// into roll, pitch and yaw. Throws if the data runs out or doesn't add up, so a damaged file can't overrun anything.
+inline void decodePacked(const uint8_t* data, size_t bytes, const uint32_t* blocks, size_t steps, size_t first,
+	size_t count, int* roll, int* pitch, int* yaw)
+{
+	if (first > steps || count > steps - first)
+	{
+		throw std::runtime_error("Packed stream read out of range");
+	}
+	const uint8_t* end = data + bytes;
+	size_t out = 0;
+	for (size_t block = first / PACKED_BLOCK_STEPS; out < count; block++)
+	{
+		size_t step = block * PACKED_BLOCK_STEPS;
+		size_t blockEnd = step + PACKED_BLOCK_STEPS < steps ? step + PACKED_BLOCK_STEPS : steps;
+		if (blocks[block] > bytes || end - (data + blocks[block]) < 3)
+		{
+			throw std::runtime_error("Packed stream is truncated");
+		}
+		const uint8_t* p = data + blocks[block];
+		int r = p[0], pi = p[1], y = p[2];
+		p += 3;
+		if (step >= first)
+		{
+			roll[out] = r;
+			pitch[out] = pi;
+			yaw[out] = y;
+			out++;
+		}
+		step++;
+
+		while (step < blockEnd && out < count)
+		{
+			if (p == end)
+			{
+				throw std::runtime_error("Packed stream is truncated");
+			}
+			int token = *p++;
+			size_t run = (token >> 5) + 1;
+			if (run == 8)
+			{
+				size_t extra = 0;
+				for (int shift = 0; ; shift += 7)
+				{
+					if (p == end || shift > 28)
+					{
+						throw std::runtime_error("Packed stream is truncated");
+					}
+					extra |= static_cast<size_t>(*p & 0x7f) << shift;
+					if ((*p++ & 0x80) == 0)
+					{
+						break;
+					}
+				}
+				run += extra;
+			}
+			int code = token & 0x1f;
+			int dr, dp, dy;
+			if (code < PACKED_ESCAPE)
+			{
+				dr = code / 9 - 1;
+				dp = code / 3 % 3 - 1;
+				dy = code % 3 - 1;
+			}
+			else
+			{
+				int deltas[3];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					uint32_t zigzag = 0;
+					for (int shift = 0; ; shift += 7)
+					{
+						if (p == end || shift > 28)
+						{
+							throw std::runtime_error("Packed stream is truncated");
+						}
+						zigzag |= static_cast<uint32_t>(*p & 0x7f) << shift;
+						if ((*p++ & 0x80) == 0)
+						{
+							break;
+						}
+					}
+					deltas[axis] = static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1);
+				}
+				dr = deltas[0];
+				dp = deltas[1];
+				dy = deltas[2];
+			}
+			if (run > blockEnd - step)
+			{
+				throw std::runtime_error("Packed stream run overruns its block");
+			}
+
+			// Skip what comes before first in one go, then write the rest of the run out.
+			if (step < first)
+			{
+				size_t skip = first - step < run ? first - step : run;
+				r += dr * static_cast<int>(skip);
+				pi += dp * static_cast<int>(skip);
+				y += dy * static_cast<int>(skip);
+				step += skip;
+				run -= skip;
+			}
+			if (run > count - out)
+			{
+				run = count - out;
+			}
+			for (size_t k = 0; k < run; k++)
+			{
+				r += dr;
+				pi += dp;
+				y += dy;
+				roll[out + k] = r;
+				pitch[out + k] = pi;
+				yaw[out + k] = y;
+			}
+			out += run;
+			step += run;
+		}
+	}
+}
+
+// An encoded stream and its block index, built in memory.
+class PackedStream
+{
+public:
+	PackedStream()
+		: steps(0)
+	{
+	}
+
+	// Replaces the stream with count steps. Every value must be a bucket from 0 to 255.
+	void encode(const int* roll, const int* pitch, const int* yaw, size_t count)
+	{
+		encoded.clear();
+		blockStarts.clear();
+		steps = count;
+		for (size_t block = 0; block < count; block += PACKED_BLOCK_STEPS)
+		{
+			size_t blockEnd = block + PACKED_BLOCK_STEPS < count ? block + PACKED_BLOCK_STEPS : count;
+			blockStarts.push_back(static_cast<uint32_t>(encoded.size()));
+			encoded.push_back(bucket(roll[block]));
+			encoded.push_back(bucket(pitch[block]));
+			encoded.push_back(bucket(yaw[block]));
+
+			size_t i = block + 1;
+			while (i < blockEnd)
+			{
+				int dr = roll[i] - roll[i - 1];
+				int dp = pitch[i] - pitch[i - 1];
+				int dy = yaw[i] - yaw[i - 1];
+				size_t run = 1;
+				while (i + run < blockEnd && roll[i + run] - roll[i + run - 1] == dr &&
+					pitch[i + run] - pitch[i + run - 1] == dp && yaw[i + run] - yaw[i + run - 1] == dy)
+				{
+					run++;
+				}
+				bool small = std::abs(dr) <= 1 && std::abs(dp) <= 1 && std::abs(dy) <= 1;
+				int code = small ? (dr + 1) * 9 + (dp + 1) * 3 + (dy + 1) : PACKED_ESCAPE;
+				encoded.push_back(static_cast<uint8_t>(code | (run < 8 ? run - 1 : 7) << 5));
+				if (run >= 8)
+				{
+					varint(static_cast<uint32_t>(run - 8));
+				}
+				if (!small)
+				{
+					varint(zigzag(dr));
+					varint(zigzag(dp));
+					varint(zigzag(dy));
+				}
+				i += run;
+			}
+		}
+	}
+
+	void decode(size_t first, size_t count, int* roll, int* pitch, int* yaw) const
+	{
+		decodePacked(data(), encoded.size(), blocks(), steps, first, count, roll, pitch, yaw);
+	}
+
+	size_t size() const
+	{
+		return steps;
+	}
+
+	const uint8_t* data() const
+	{
+		return encoded.empty() ? 0 : &encoded[0];
+	}
+
+	size_t dataBytes() const
+	{
+		return encoded.size();
+	}
+
+	// One entry per block: where in data() it starts.
+	const uint32_t* blocks() const
+	{
+		return blockStarts.empty() ? 0 : &blockStarts[0];
+	}
+
+	size_t blockCount() const
+	{
+		return blockStarts.size();
+	}
+
+private:
+	static uint8_t bucket(int value)
+	{
+		if (value < 0 || value > 255)
+		{
+			throw std::runtime_error("Packed streams only hold buckets from 0 to 255");
+		}
+		return static_cast<uint8_t>(value);
+	}
+
+	static uint32_t zigzag(int value)
+	{
+		return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+	}
+
+	void varint(uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			encoded.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		encoded.push_back(static_cast<uint8_t>(value));
+	}
+
+	std::vector<uint8_t> encoded;
+	std::vector<uint32_t> blockStarts;
+	size_t steps;
+};
+
+#endif // STREAMCODEC_H
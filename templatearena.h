@@ -0,0 +1,177 @@
+#ifndef TEMPLATEARENA_H
+#define TEMPLATEARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The steps of every template in a library in one block of memory. Each template's steps are contiguous and start
+// on a cache line, so walking a template never touches a line another one shares, and walking the whole library
+// walks one block front to back instead of chasing a pointer per template. With three-byte steps, a library of a
+// hundred templates of a few hundred steps is well under 100 KiB.
+//
+// Templates are referred to by run, which stays valid while the runs move. Releasing a run leaves a hole; once holes
+// make up more than half of what is in use, the live runs are packed down to close them. Step must be plain bytes,
+// as it is moved with memcpy.
+//
+// A run can also be adopted: its steps stay where they already are, typically in a mapped library file, and are
+// neither copied in nor ever moved. They must outlive the run.
+template <typename Step>
+class TemplateArena
+{
+public:
+	enum { ALIGNMENT = 64 };
+
+	TemplateArena()
+		: base(0), used(0), freed(0)
+	{
+	}
+
+	// Copies count steps in as a new run and returns it.
+	int add(const Step* steps, int count)
+	{
+		size_t offset = (used + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		size_t bytes = static_cast<size_t>(count) * sizeof(Step);
+		reserve(offset + bytes);
+		if (bytes > 0)
+		{
+			std::memcpy(base + offset, steps, bytes);
+		}
+		used = offset + bytes;
+
+		Run run = { offset, count, true, 0 };
+		return place(run);
+	}
+
+	// Adds count steps that stay at steps as a new run and returns it.
+	int adopt(const Step* steps, int count)
+	{
+		Run run = { 0, count, true, steps };
+		return place(run);
+	}
+
+	// Gives a run's space back. The run number may be handed out again by add() or adopt().
+	void release(int run)
+	{
+		runs[run].live = false;
+		if (runs[run].outside != 0)
+		{
+			runs[run].outside = 0;
+			return;
+		}
+		freed += static_cast<size_t>(runs[run].count) * sizeof(Step);
+		if (freed * 2 > used)
+		{
+			compact();
+		}
+	}
+
+	const Step* steps(int run) const
+	{
+		return runs[run].outside != 0 ? runs[run].outside : reinterpret_cast<const Step*>(base + runs[run].offset);
+	}
+
+	bool adopted(int run) const
+	{
+		return runs[run].outside != 0;
+	}
+
+	int count(int run) const
+	{
+		return runs[run].count;
+	}
+
+	// Bytes in use, holes and alignment padding included. Adopted runs take none.
+	size_t bytes() const
+	{
+		return used;
+	}
+
+private:
+	struct Run
+	{
+		size_t offset;
+		int count;
+		bool live;
+		// An adopted run's steps, or null for one in the block.
+		const Step* outside;
+	};
+
+	int place(const Run& run)
+	{
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			if (!runs[r].live)
+			{
+				runs[r] = run;
+				return static_cast<int>(r);
+			}
+		}
+		runs.push_back(run);
+		return static_cast<int>(runs.size() - 1);
+	}
+
+	// Grows the block to hold at least bytes, keeping everything at the same offset from the aligned base.
+	void reserve(size_t bytes)
+	{
+		if (base != 0 && bytes <= storage.size() - static_cast<size_t>(base - &storage[0]))
+		{
+			return;
+		}
+		size_t capacity = storage.empty() ? 4096 : storage.size() * 2;
+		while (capacity < bytes + ALIGNMENT)
+		{
+			capacity *= 2;
+		}
+		std::vector<char> grown(capacity);
+		char* grownBase = align(&grown[0]);
+		if (used > 0)
+		{
+			std::memcpy(grownBase, base, used);
+		}
+		storage.swap(grown);
+		base = grownBase;
+	}
+
+	// Moves every live run down over the holes, lowest first, so none is overwritten before it has moved.
+	void compact()
+	{
+		std::vector<size_t> order;
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			if (runs[r].live && runs[r].outside == 0)
+			{
+				order.push_back(r);
+			}
+		}
+		std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return runs[a].offset < runs[b].offset; });
+		size_t offset = 0;
+		for (size_t k = 0; k < order.size(); k++)
+		{
+			size_t r = order[k];
+			size_t bytes = static_cast<size_t>(runs[r].count) * sizeof(Step);
+			offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			std::memmove(base + offset, base + runs[r].offset, bytes);
+			runs[r].offset = offset;
+			offset += bytes;
+		}
+		used = offset;
+		freed = 0;
+	}
+
+	static char* align(char* pointer)
+	{
+		uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+		return pointer + (ALIGNMENT - address % ALIGNMENT) % ALIGNMENT;
+	}
+
+	std::vector<char> storage;
+	char* base;
+	size_t used;
+	size_t freed;
+	std::vector<Run> runs;
+};
+
+#endif // TEMPLATEARENA_H
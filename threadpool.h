@@ -0,0 +1,215 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads for splitting one batch of independent work items, such as the templates of a library or a
+// stack of recorded sessions, across every core. parallelFor() cuts the items into chunks and deals each thread a
+// contiguous run of them; a thread works through its own chunks from the front and, once they run out, steals from
+// the back of another thread's, so a thread that drew the expensive items doesn't leave the rest idle. The caller is
+// thread 0 and works too, so a pool of one runs everything inline.
+//
+// Each thread's chunks sit behind their own mutex, which only the owner and the odd thief take, once per chunk. With
+// chunks of dozens of items that is noise next to the work itself.
+class ThreadPool
+{
+public:
+	// threads counts the caller. 0 means one per hardware thread.
+	explicit ThreadPool(int threads = 0)
+		: body(0), count(0), grain(1), generation(0), pending(0), stopping(false)
+	{
+		if (threads <= 0)
+		{
+			threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		}
+		for (int i = 0; i < threads; i++)
+		{
+			queues.push_back(new Queue());
+		}
+		for (int i = 1; i < threads; i++)
+		{
+			workers.push_back(std::thread(&ThreadPool::work, this, i));
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+		for (size_t i = 0; i < queues.size(); i++)
+		{
+			delete queues[i];
+		}
+	}
+
+	// Threads, the caller included.
+	int size() const
+	{
+		return static_cast<int>(queues.size());
+	}
+
+	// Calls body(begin, end, thread) over [0, count) in chunks of up to grain items, and returns once all of them
+	// have run. thread, 0 to size() - 1, tells a body which of its per-thread scratch to use; no two chunks run on
+	// the same thread at once. Anything a body throws is rethrown here once the rest have finished. Only one thread
+	// may call this at a time, and not from inside a body.
+	void parallelFor(int count, int grain, const std::function<void(int, int, int)>& body)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+		grain = std::max(1, grain);
+		int chunks = (count + grain - 1) / grain;
+		if (chunks == 1 || size() == 1)
+		{
+			body(0, count, 0);
+			return;
+		}
+
+		this->body = &body;
+		this->count = count;
+		this->grain = grain;
+		error = std::exception_ptr();
+		pending.store(chunks);
+		for (int t = 0; t < size(); t++)
+		{
+			std::lock_guard<std::mutex> lock(queues[t]->mutex);
+			for (int c = static_cast<int>(static_cast<int64_t>(chunks) * t / size());
+				c < static_cast<int64_t>(chunks) * (t + 1) / size(); c++)
+			{
+				queues[t]->chunks.push_back(c);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+		}
+		wake.notify_all();
+
+		drain(0);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&] { return pending.load() == 0; });
+		}
+		this->body = 0;
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<int> chunks;
+	};
+
+	void work(int thread)
+	{
+		uint64_t seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+				{
+					return;
+				}
+				seen = generation;
+			}
+			drain(thread);
+		}
+	}
+
+	// Runs chunks, this thread's own first, then stolen ones, until there are none left anywhere.
+	void drain(int thread)
+	{
+		int chunk;
+		while (pop(thread, chunk) || steal(thread, chunk))
+		{
+			try {
+				(*body)(chunk * grain, std::min(count, (chunk + 1) * grain), thread);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error)
+				{
+					error = std::current_exception();
+				}
+			}
+			if (pending.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+	}
+
+	bool pop(int thread, int& chunk)
+	{
+		Queue& queue = *queues[thread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.chunks.empty())
+		{
+			return false;
+		}
+		chunk = queue.chunks.front();
+		queue.chunks.pop_front();
+		return true;
+	}
+
+	// Takes the last chunk of the next thread along that has any, the one its owner would get to last.
+	bool steal(int thread, int& chunk)
+	{
+		for (int k = 1; k < size(); k++)
+		{
+			Queue& queue = *queues[(thread + k) % size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.chunks.empty())
+			{
+				chunk = queue.chunks.back();
+				queue.chunks.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::vector<Queue*> queues;
+	std::vector<std::thread> workers;
+
+	// The batch in progress. A chunk can only be taken once these are set, and parallelFor() doesn't change them
+	// again until every chunk it handed out has finished.
+	const std::function<void(int, int, int)>* body;
+	int count;
+	int grain;
+	std::exception_ptr error;
+
+	// generation counts batches, so a sleeping worker knows there is a new one; pending counts its unfinished chunks.
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation;
+	std::atomic<int> pending;
+	bool stopping;
+};
+
+#endif // THREADPOOL_H